@@ -29,6 +29,7 @@
 #ifndef LIBBUFFER_H
 #define LIBBUFFER_H
 
+#include <stdio.h>
 #include <makestuff/common.h>
 
 #ifdef __cplusplus
@@ -47,6 +48,7 @@ extern "C" {
     size_t length;
     size_t capacity;
     uint8 fill;
+    bool mapped;
   };
   ///@endcond
 
@@ -65,7 +67,7 @@ extern "C" {
     BUF_FTELL,            ///< There was a binary file ftell() error.
     BUF_FEOF,             ///< There was an error testing for the end of a binary file.
     BUF_FERROR,           ///< Fewer bytes were read or written than expected.
-    HEX_EMPTY_FILE,       ///< The I8HEX file was empty.
+    HEX_EMPTY_FILE,       ///< The I8HEX or S-record file was empty.
     HEX_JUNK_START_CODE,  ///< The first char of the I8HEX line was not ":".
     HEX_JUNK_BYTE_COUNT,  ///< The I8HEX byte count was invalid.
     HEX_JUNK_ADDR_MSB,          ///< The I8HEX most-significant address byte was invalid.
@@ -77,10 +79,124 @@ extern "C" {
     HEX_BAD_CHECKSUM,          ///< The I8HEX line checksum did not match the line data.
     HEX_CORRUPT_LINE,          ///< The I8HEX line reconstruction did not match the original.
     HEX_MISSING_EOF,      ///< The I8HEX EOF record was missing.
-    HEX_BAD_EXT_SEG       ///< The I8HEX EXT_SEG record was invalid.
+    HEX_BAD_EXT_SEG,      ///< The I8HEX EXT_SEG record was invalid.
+    BUF_BAD_DELTA,        ///< The delta was malformed or made against a different base.
+    HEX_BAD_EXT_LIN,      ///< The I32HEX EXT_LIN record was invalid, or an address exceeded 4GiB.
+    HEX_BAD_INDEX,        ///< The hex file index was malformed or made from a different file.
+    BUF_BAD_HEX,          ///< A hex string had an odd length or a char which is not a hex digit.
+    SREC_BAD_RECORD,      ///< An S-record line was malformed, or had an unknown type.
+    SREC_BAD_CHECKSUM,    ///< An S-record line checksum did not match the line data.
+    SREC_MISSING_END,     ///< The S7, S8 or S9 record ending an S-record file was missing.
+    BUF_BAD_MEMINIT,      ///< The memory initialisation file format or word size was invalid.
+    BUF_BAD_ELF,          ///< The ELF file was malformed, or had a segment beyond 4GiB.
+    BUF_BAD_IMAGE,        ///< The image file was malformed, or had an unsupported version.
+    BUF_BAD_CRC           ///< An image file extent did not match its CRC.
   } BufferStatus;
+
+  /**
+   * Memory initialisation file formats, for \c bufWriteMemInitFile().
+   */
+  typedef enum {
+    MEMINIT_READMEMH,  ///< One word per line, as read by Verilog's \c $readmemh.
+    MEMINIT_MIF,       ///< An Altera/Intel Memory Initialization File.
+    MEMINIT_COE        ///< A Xilinx coefficient file.
+  } MemInitFormat;
   //@}
 
+  /**
+   * Function called by an Intel hex parser for each data record, if one was supplied to
+   * \c bufHexParserInit().
+   *
+   * @param context The context pointer given to \c bufHexParserInit().
+   * @param address The linear address of the first data byte.
+   * @param data The data bytes.
+   * @param count The number of data bytes.
+   * @param error Passed through from the parser; may be set to an allocated error message.
+   * @returns \c BUF_SUCCESS to continue parsing, or any other code to stop with that code.
+   */
+  typedef BufferStatus (*HexDataCallback)(
+    void *context, uint32 address, const uint8 *data, uint8 count, const char **error
+  );
+
+  /**
+   * A range of addresses covered by the data records of an Intel hex file.
+   */
+  struct HexInterval {
+    uint32 address;  ///< The linear address of the first byte.
+    uint32 length;   ///< The number of bytes.
+  };
+
+  /**
+   * One block of a batch given to an output sink.
+   */
+  struct SinkBlock {
+    const uint8 *data;  ///< The first byte of the block.
+    size_t length;      ///< The number of bytes in the block.
+  };
+
+  /**
+   * Function called by a writer to give an output sink some bytes. It must take all of them, or
+   * fail.
+   *
+   * @param context The sink's context pointer.
+   * @param data The bytes to write.
+   * @param length The number of bytes to write.
+   * @param error Passed through from the writer; set to an allocated error message on failure.
+   * @returns \c BUF_SUCCESS, or any other code to make the writer fail with that code.
+   */
+  typedef BufferStatus (*SinkWrite)(
+    void *context, const uint8 *data, size_t length, const char **error
+  );
+
+  /**
+   * Function called by a writer to give an output sink a batch of blocks at once, for example
+   * with a single \c writev(). It must take all of them, or fail.
+   *
+   * @param context The sink's context pointer.
+   * @param blocks The blocks to write, in order.
+   * @param count The number of blocks.
+   * @param error Passed through from the writer; set to an allocated error message on failure.
+   * @returns \c BUF_SUCCESS, or any other code to make the writer fail with that code.
+   */
+  typedef BufferStatus (*SinkWriteVector)(
+    void *context, const struct SinkBlock *blocks, size_t count, const char **error
+  );
+
+  /**
+   * Somewhere for a writer to send its output. Set one up with \c bufInitFileSink(),
+   * \c bufInitDescriptorSink() or \c bufInitBufferSink(), or fill in the fields directly to
+   * send output anywhere else.
+   */
+  struct BufferSink {
+    SinkWrite write;              ///< Write one block.
+    SinkWriteVector writeVector;  ///< Write a batch of blocks (may be \c NULL).
+    void *context;                ///< Passed to \c write and \c writeVector.
+  };
+
+  ///@cond STRUCT
+  /**
+   * The state of an incremental Intel hex parser. The fields are private.
+   */
+  struct HexParser {
+    struct Buffer *destData;
+    struct Buffer *destMask;
+    HexDataCallback callback;
+    void *context;
+    uint32 segment;
+    uint32 lineNumber;
+    uint8 recordType;
+    bool started;
+    BufferStatus status;
+    size_t carryLength;
+    char carry[528];
+  };
+  ///@endcond
+
+  /**
+   * A lazily-decoded Intel hex file, opened by \c bufHexImageOpen(). The fields are private.
+   */
+  struct HexImage;
+
   // ---------------------------------------------------------------------------------------------
   // Core Operations
   // ---------------------------------------------------------------------------------------------
@@ -167,6 +283,28 @@ extern "C" {
     struct Buffer *self
   );
 
+  /**
+   * @brief Make room in a buffer for a given number of bytes.
+   *
+   * Grow the buffer's capacity to at least \c capacity bytes, without changing its length, so
+   * that it can subsequently be filled to that size without any reallocation. If the buffer is
+   * already big enough, nothing is done.
+   *
+   * @param self The buffer to grow.
+   * @param capacity The number of bytes the buffer must be able to hold.
+   * @param error A pointer to a <code>char*</code> which will be set on exit to an allocated
+   *            error message if something goes wrong. Responsibility for this allocated memory
+   *            passes to the caller and must be freed with \c bufFreeError(). If \c error is
+   *            \c NULL, no allocation is done and no message is returned, but the return code
+   *            will still be valid.
+   * @returns
+   *     - \c BUF_SUCCESS if the operation completed successfully.
+   *     - \c BUF_NO_MEM if an allocation error occurred.
+   */
+  DLLEXPORT(BufferStatus) bufReserve(
+    struct Buffer *self, size_t capacity, const char **error
+  ) WARN_UNUSED_RESULT;
+
   /**
    * @brief Append a single byte to the end of a buffer.
    *
@@ -466,6 +604,50 @@ extern "C" {
   ) WARN_UNUSED_RESULT;
   //@}
 
+  // ---------------------------------------------------------------------------------------------
+  // Output Sinks
+  // ---------------------------------------------------------------------------------------------
+  /**
+   * @name Output Sinks
+   * @{
+   */
+  /**
+   * @brief Make an output sink which writes to a stdio stream.
+   *
+   * The stream is not closed or flushed by the writers.
+   *
+   * @param sink The sink to set up.
+   * @param file The stream to write to.
+   */
+  DLLEXPORT(void) bufInitFileSink(
+    struct BufferSink *sink, FILE *file
+  );
+
+  /**
+   * @brief Make an output sink which writes to a file descriptor.
+   *
+   * Suits pipes and sockets as well as files. Short writes are resumed, and batches of blocks
+   * are written with \c writev() where it is available. The descriptor is not closed by the
+   * writers.
+   *
+   * @param sink The sink to set up.
+   * @param fd The descriptor to write to.
+   */
+  DLLEXPORT(void) bufInitDescriptorSink(
+    struct BufferSink *sink, int fd
+  );
+
+  /**
+   * @brief Make an output sink which appends to a buffer.
+   *
+   * @param sink The sink to set up.
+   * @param dest The buffer to append to.
+   */
+  DLLEXPORT(void) bufInitBufferSink(
+    struct BufferSink *sink, struct Buffer *dest
+  );
+  //@}
+
   // ---------------------------------------------------------------------------------------------
   // Binary I/O
   // ---------------------------------------------------------------------------------------------
@@ -473,10 +655,38 @@ extern "C" {
    * @name Binary I/O
    * @{
    */
+  /**
+   * @brief Construct a buffer holding the contents of a binary file, without copying them.
+   *
+   * Where possible, the file is mmap()'d privately and the buffer uses the mapping as its data,
+   * so nothing is read until it is touched. The buffer can be written in place like any other;
+   * the pages written are copied by the kernel, and the file itself is never changed. The first
+   * time the buffer has to grow, its contents are copied into ordinary heap memory. Files which
+   * cannot be mapped (pipes, empty files, or any file on platforms without mmap()) are read into
+   * an ordinary buffer instead.
+   *
+   * @param self The buffer to construct.
+   * @param fileName The binary file to map.
+   * @param fill The fill byte for the buffer, as for \c bufInitialise().
+   * @param error A pointer to a <code>char*</code> which will be set on exit to an allocated
+   *            error message if something goes wrong. Responsibility for this allocated memory
+   *            passes to the caller and must be freed with \c bufFreeError(). If \c error is
+   *            \c NULL, no allocation is done and no message is returned, but the return code
+   *            will still be valid.
+   * @returns
+   *     - All the return codes of \c bufAppendFromBinaryFile().
+   */
+  DLLEXPORT(BufferStatus) bufMapBinaryFile(
+    struct Buffer *self, const char *fileName, uint8 fill, const char **error
+  ) WARN_UNUSED_RESULT;
+
   /**
    * @brief Append a binary file to the end of a buffer.
    *
-   * Reallocate if necessary.
+   * Reallocate if necessary. On POSIX platforms the file is read with \c pread() in large chunks,
+   * straight into the end of the buffer, so files larger than 2GiB load correctly even where
+   * \c long is 32 bits. Pipes, FIFOs and other files which cannot be sized up front are read
+   * until EOF with \c bufAppendFromDescriptor(). If the read fails, the buffer is left as it was.
    *
    * @param self The buffer to append to.
    * @param fileName The binary file to append.
@@ -489,15 +699,95 @@ extern "C" {
    *     - \c BUF_SUCCESS if the operation completed successfully.
    *     - \c BUF_NO_MEM if an allocation error occurred.
    *     - \c BUF_FOPEN if the file could not be opened for reading.
-   *     - \c BUF_FSEEK if the file could not be fseek()'d.
-   *     - \c BUF_FTELL if the file could not be ftell()'d.
-   *     - \c BUF_FEOF if the file could not be feof()'d.
-   *     - \c BUF_FERROR if the file could not be fread().
+   *     - \c BUF_FSEEK if the file could not be fseek()'d (WIN32 only).
+   *     - \c BUF_FTELL if the file could not be ftell()'d (WIN32 only).
+   *     - \c BUF_FEOF if the file was shorter than expected.
+   *     - \c BUF_FERROR if the file could not be read.
    */
   DLLEXPORT(BufferStatus) bufAppendFromBinaryFile(
     struct Buffer *self, const char *fileName, const char **error
   ) WARN_UNUSED_RESULT;
 
+  /**
+   * @brief Append everything read from a file descriptor to the end of a buffer.
+   *
+   * Reads until EOF, so it works on descriptors which cannot be seeked, like \c stdin, pipes
+   * and FIFOs. Each read goes straight into the spare capacity at the end of the buffer, which
+   * grows as usual whenever it fills up. The descriptor is not closed. If a read fails, the
+   * buffer is left as it was.
+   *
+   * @param self The buffer to append to.
+   * @param fd The descriptor to read from.
+   * @param error A pointer to a <code>char*</code> which will be set on exit to an allocated
+   *            error message if something goes wrong. Responsibility for this allocated memory
+   *            passes to the caller and must be freed with \c bufFreeError(). If \c error is
+   *            \c NULL, no allocation is done and no message is returned, but the return code
+   *            will still be valid.
+   * @returns
+   *     - \c BUF_SUCCESS if the operation completed successfully.
+   *     - \c BUF_NO_MEM if an allocation error occurred.
+   *     - \c BUF_FERROR if the descriptor could not be read.
+   */
+  DLLEXPORT(BufferStatus) bufAppendFromDescriptor(
+    struct Buffer *self, int fd, const char **error
+  ) WARN_UNUSED_RESULT;
+
+  /**
+   * @brief Append part of a binary file to the end of a buffer.
+   *
+   * Reads just \c count bytes from \c offset of the file, without reading the rest of it; useful
+   * for picking one region out of a large flash dump.
+   *
+   * @param self The buffer to append to.
+   * @param fileName The binary file to read from.
+   * @param offset The offset in the file of the first byte to read.
+   * @param count The number of bytes to read.
+   * @param error A pointer to a <code>char*</code> which will be set on exit to an allocated
+   *            error message if something goes wrong. Responsibility for this allocated memory
+   *            passes to the caller and must be freed with \c bufFreeError(). If \c error is
+   *            \c NULL, no allocation is done and no message is returned, but the return code
+   *            will still be valid.
+   * @returns
+   *     - \c BUF_SUCCESS if the operation completed successfully.
+   *     - \c BUF_NO_MEM if an allocation error occurred.
+   *     - \c BUF_FOPEN if the file could not be opened for reading.
+   *     - \c BUF_FSEEK if the file could not be fseek()'d, or is not a regular file.
+   *     - \c BUF_FEOF if the range extends beyond the end of the file.
+   *     - \c BUF_FERROR if the file could not be read.
+   */
+  DLLEXPORT(BufferStatus) bufAppendFromBinaryFileRange(
+    struct Buffer *self, const char *fileName, uint64 offset, size_t count, const char **error
+  ) WARN_UNUSED_RESULT;
+
+  /**
+   * @brief Read the loadable segments of an ELF file into a pair of buffers.
+   *
+   * Reads 32- and 64-bit ELF files of either byte order. The file bytes of each \c PT_LOAD
+   * segment are copied into \c destData at the segment's physical address, and the corresponding
+   * bytes of \c destMask are set to 0x01. Where a segment's memory size exceeds its file size
+   * (as for \c .bss), the buffers are extended to cover it, but the extra bytes are left at the
+   * fill value and unmasked. Other segments, and all sections, are ignored.
+   *
+   * @param destData The buffer to read data bytes into.
+   * @param destMask The buffer to read mask bytes into (may be \c NULL).
+   * @param fileName The ELF file to read.
+   * @param error A pointer to a <code>char*</code> which will be set on exit to an allocated
+   *            error message if something goes wrong. Responsibility for this allocated memory
+   *            passes to the caller and must be freed with \c bufFreeError(). If \c error is
+   *            \c NULL, no allocation is done and no message is returned, but the return code
+   *            will still be valid.
+   * @returns
+   *     - \c BUF_SUCCESS if the operation completed successfully.
+   *     - \c BUF_NO_MEM if an allocation error occurred.
+   *     - \c BUF_FOPEN if the file could not be opened for reading.
+   *     - \c BUF_FERROR if the file could not be read.
+   *     - \c BUF_BAD_ELF if the file is not a well-formed ELF file, or a segment would extend
+   *       beyond 4GiB.
+   */
+  DLLEXPORT(BufferStatus) bufReadFromElfFile(
+    struct Buffer *destData, struct Buffer *destMask, const char *fileName, const char **error
+  ) WARN_UNUSED_RESULT;
+
   /**
    * @brief Write a block of raw data from a buffer to a binary file.
    *
@@ -519,6 +809,27 @@ extern "C" {
     const struct Buffer *self, const char *fileName, size_t bufAddress, size_t count,
     const char **error
   ) WARN_UNUSED_RESULT;
+
+  /**
+   * @brief Write a block of raw data from a buffer to an output sink.
+   *
+   * @param self The buffer to save from.
+   * @param sink The sink to write to.
+   * @param bufAddress The offset of the data block to be saved.
+   * @param count The number of bytes to save.
+   * @param error A pointer to a <code>char*</code> which will be set on exit to an allocated
+   *            error message if something goes wrong. Responsibility for this allocated memory
+   *            passes to the caller and must be freed with \c bufFreeError(). If \c error is
+   *            \c NULL, no allocation is done and no message is returned, but the return code
+   *            will still be valid.
+   * @returns
+   *     - \c BUF_SUCCESS if the operation completed successfully.
+   *     - Any code returned by the sink.
+   */
+  DLLEXPORT(BufferStatus) bufWriteBinarySink(
+    const struct Buffer *self, const struct BufferSink *sink, size_t bufAddress, size_t count,
+    const char **error
+  ) WARN_UNUSED_RESULT;
   //@}
 
   // ---------------------------------------------------------------------------------------------
@@ -529,9 +840,11 @@ extern "C" {
    * @{
    */
   /**
-   * @brief Read an Intex hex (I8HEX) file into a buffer.
+   * @brief Read an Intex hex (I8HEX, I16HEX or I32HEX) file into a buffer.
    *
-   * Reallocate if necessary.
+   * Reallocate if necessary. Each data byte is stored at its linear address, so a file whose
+   * data lies at a high address yields a buffer at least that long; use
+   * \c bufReadFromIntelHexFileRebased() for such files. Start address records are ignored.
    *
    * @param destData The buffer to read data bytes into.
    * @param destMask The buffer to read mask bytes into (may be /c NULL).
@@ -545,6 +858,7 @@ extern "C" {
    *     - \c BUF_SUCCESS if the operation completed successfully.
    *     - \c BUF_NO_MEM if an allocation error occurred.
    *     - \c BUF_FOPEN if the file could not be opened for reading.
+   *     - \c BUF_FERROR if the file could not be read.
    *     - \c HEX_EMPTY_FILE if the file was found to be empty.
    *     - \c HEX_JUNK_START_CODE if a line starts with something other than ":".
    *     - \c HEX_JUNK_BYTE_COUNT if a byte count could not be parsed.
@@ -558,26 +872,153 @@ extern "C" {
    *     - \c HEX_CORRUPT_LINE if a line's reconstruction did not match the original.
    *     - \c HEX_MISSING_EOF if the file was missing its I8HEX EOF record.
    *     - \c HEX_BAD_EXT_SEG if an EXT_SEG record was invalid.
+   *     - \c HEX_BAD_EXT_LIN if an EXT_LIN record was invalid.
    */
   DLLEXPORT(BufferStatus) bufReadFromIntelHexFile(
     struct Buffer *destData, struct Buffer *destMask, const char *fileName, const char **error
   ) WARN_UNUSED_RESULT;
 
   /**
-   * @brief Write a buffer to an Intel hex (I8HEX) file.
+   * @brief Read an Intel hex file into a buffer holding only the address range it uses.
    *
-   * Writes out the content of a data buffer as I8HEX records, honouring an optional mask buffer.
-   * If the mask buffer is \c NULL, a mask buffer is derived. The derived mask can either be
-   * compressed or uncompressed. If compressed it just looks for sizeable runs of the fill byte in
-   * the data buffer. Deriving a mask with compression is dangerous because it assumes the
-   * consumer of your file will have initialised his or her buffer to a known value, which is not
-   * the case in general.
+   * Like \c bufReadFromIntelHexFile(), but the first byte of the buffers corresponds to linear
+   * address \c *baseAddress rather than zero. The base address is the lowest data address in
+   * the file, rounded down to a multiple of 64KiB, so an image for a device whose flash is at
+   * 0x08000000 needs a buffer only as big as the image itself. Write it back with
+   * \c bufWriteToIntelHexFileRebased().
    *
-   * @param sourceData The buffer to read data bytes from.
-   * @param sourceMask The buffer to read mask bytes from (may be \c NULL).
-   * @param fileName The I8HEX file to write.
-   * @param lineLength The I8HEX line length to use (usually 16 or 32 bytes).
-   * @param compress If sourceMask is \c NULL, whether the derived mask should be compressed.
+   * @param destData The buffer to read data bytes into.
+   * @param destMask The buffer to read mask bytes into (may be /c NULL).
+   * @param fileName The Intel hex file to read.
+   * @param baseAddress Set on exit to the linear address of the first byte of the buffers.
+   * @param error A pointer to a <code>char*</code> which will be set on exit to an allocated
+   *            error message if something goes wrong. Responsibility for this allocated memory
+   *            passes to the caller and must be freed with \c bufFreeError(). If \c error is
+   *            \c NULL, no allocation is done and no message is returned, but the return code
+   *            will still be valid.
+   * @returns
+   *     - All the return codes of \c bufReadFromIntelHexFile().
+   */
+  DLLEXPORT(BufferStatus) bufReadFromIntelHexFileRebased(
+    struct Buffer *destData, struct Buffer *destMask, const char *fileName, uint32 *baseAddress,
+    const char **error
+  ) WARN_UNUSED_RESULT;
+
+  /**
+   * @brief Read Intel hex text held in memory into a buffer.
+   *
+   * Behaves exactly like \c bufReadFromIntelHexFile(), but takes the text of the file from a
+   * buffer, so an image received in memory or embedded in another container needs no temporary
+   * file.
+   *
+   * @param destData The buffer to read data bytes into.
+   * @param destMask The buffer to read mask bytes into (may be /c NULL).
+   * @param text The buffer containing the Intel hex text.
+   * @param error A pointer to a <code>char*</code> which will be set on exit to an allocated
+   *            error message if something goes wrong. Responsibility for this allocated memory
+   *            passes to the caller and must be freed with \c bufFreeError(). If \c error is
+   *            \c NULL, no allocation is done and no message is returned, but the return code
+   *            will still be valid.
+   * @returns
+   *     - All the return codes of \c bufReadFromIntelHexFile(), except \c BUF_FOPEN and
+   *       \c BUF_FERROR.
+   */
+  DLLEXPORT(BufferStatus) bufReadFromIntelHexBuffer(
+    struct Buffer *destData, struct Buffer *destMask, const struct Buffer *text,
+    const char **error
+  ) WARN_UNUSED_RESULT;
+
+  /**
+   * @brief Read an Intel hex (I8HEX) file into a buffer, using several threads.
+   *
+   * Behaves exactly like \c bufReadFromIntelHexFile(), but splits the file into chunks at line
+   * boundaries and decodes them concurrently. A quick scan of each chunk first establishes the
+   * segment in effect at its start and the final extent of the data, so the buffers are sized
+   * once and each thread decodes straight into them. If the address ranges of two chunks overlap,
+   * or a chunk fails to decode, the whole file is read again serially instead, so the buffers,
+   * the return code and the error message are always those \c bufReadFromIntelHexFile() would
+   * give.
+   *
+   * @param destData The buffer to read data bytes into.
+   * @param destMask The buffer to read mask bytes into (may be /c NULL).
+   * @param fileName The I8HEX file to read.
+   * @param numThreads The maximum number of threads to use, or zero to use one per CPU.
+   * @param error A pointer to a <code>char*</code> which will be set on exit to an allocated
+   *            error message if something goes wrong. Responsibility for this allocated memory
+   *            passes to the caller and must be freed with \c bufFreeError(). If \c error is
+   *            \c NULL, no allocation is done and no message is returned, but the return code
+   *            will still be valid.
+   * @returns
+   *     - All the return codes of \c bufReadFromIntelHexFile().
+   *     - \c BUF_NO_MEM if a thread could not be created.
+   */
+  DLLEXPORT(BufferStatus) bufReadFromIntelHexFileParallel(
+    struct Buffer *destData, struct Buffer *destMask, const char *fileName, uint32 numThreads,
+    const char **error
+  ) WARN_UNUSED_RESULT;
+
+  /**
+   * @brief Check an Intel hex file without reading its data into a buffer.
+   *
+   * Performs every check that \c bufReadFromIntelHexFile() performs (start codes, digits,
+   * checksums, record types and the EOF record), but stores no data. Instead it reports which
+   * addresses the data records cover, as a sorted list of non-overlapping, non-adjacent
+   * intervals, and the total number of data bytes in the file.
+   *
+   * @param fileName The Intel hex file to check.
+   * @param intervals A buffer to receive the covered intervals, as an array of
+   *            <code>struct HexInterval</code> (may be \c NULL).
+   * @param payloadSize Set on exit to the total number of data bytes in the data records,
+   *            counting any bytes written more than once as often as they are written (may be
+   *            \c NULL).
+   * @param error A pointer to a <code>char*</code> which will be set on exit to an allocated
+   *            error message if something goes wrong. Responsibility for this allocated memory
+   *            passes to the caller and must be freed with \c bufFreeError(). If \c error is
+   *            \c NULL, no allocation is done and no message is returned, but the return code
+   *            will still be valid.
+   * @returns
+   *     - All the return codes of \c bufReadFromIntelHexFile().
+   */
+  DLLEXPORT(BufferStatus) bufValidateIntelHex(
+    const char *fileName, struct Buffer *intervals, uint64 *payloadSize, const char **error
+  ) WARN_UNUSED_RESULT;
+
+  /**
+   * @brief Build an index for random access into an Intel hex file.
+   *
+   * Checks the whole file as \c bufReadFromIntelHexFile() would, and records in \c index where
+   * in the file each short run of consecutive data is to be found. The index is about 0.6% of
+   * the size of the data. It is an ordinary buffer, so it can be kept in a sidecar file with
+   * \c bufWriteBinaryFile() and loaded again with \c bufAppendFromBinaryFile().
+   *
+   * @param fileName The Intel hex file to index.
+   * @param index The buffer to receive the index.
+   * @param error A pointer to a <code>char*</code> which will be set on exit to an allocated
+   *            error message if something goes wrong. Responsibility for this allocated memory
+   *            passes to the caller and must be freed with \c bufFreeError(). If \c error is
+   *            \c NULL, no allocation is done and no message is returned, but the return code
+   *            will still be valid.
+   * @returns
+   *     - All the return codes of \c bufReadFromIntelHexFile().
+   */
+  DLLEXPORT(BufferStatus) bufHexIndexBuild(
+    const char *fileName, struct Buffer *index, const char **error
+  ) WARN_UNUSED_RESULT;
+
+  /**
+   * @brief Read a range of addresses from an indexed Intel hex file.
+   *
+   * Uses an index made by \c bufHexIndexBuild() to find and decode only those lines of the
+   * memory-mapped file which hold data in the range. On exit \c destData holds \c length bytes,
+   * the first of which corresponds to \c address; bytes with no data in the file are left at
+   * the buffer's fill value, and are zero in \c destMask.
+   *
+   * @param index The index of the file.
+   * @param fileName The Intel hex file to read.
+   * @param address The linear address of the first byte to read.
+   * @param length The number of bytes to read.
+   * @param destData The buffer to read data bytes into.
+   * @param destMask The buffer to read mask bytes into (may be /c NULL).
    * @param error A pointer to a <code>char*</code> which will be set on exit to an allocated
    *            error message if something goes wrong. Responsibility for this allocated memory
    *            passes to the caller and must be freed with \c bufFreeError(). If \c error is
@@ -585,14 +1026,668 @@ extern "C" {
    *            will still be valid.
    * @returns
    *     - \c BUF_SUCCESS if the operation completed successfully.
-   *     - \c BUF_NO_MEM if an allocation error occurred during generation of the derived mask.
-   *     - \c BUF_FOPEN if the file could not be opened for writing.
-   *     - \c HEX_BAD_EXT_SEG if an EXT_SEG record was invalid.
+   *     - \c BUF_NO_MEM if an allocation error occurred.
+   *     - \c BUF_FOPEN if the file could not be opened for reading.
+   *     - \c BUF_FERROR if the file could not be read.
+   *     - \c HEX_BAD_INDEX if the index is malformed, or does not match the file.
+   *     - Any of the line errors returned by \c bufReadFromIntelHexFile(), if the file has
+   *       changed since it was indexed.
    */
-  DLLEXPORT(BufferStatus) bufWriteToIntelHexFile(
-    const struct Buffer *sourceData, const struct Buffer *sourceMask,
-    const char *fileName, uint8 lineLength, bool compress, const char **error
-  );
+  DLLEXPORT(BufferStatus) bufHexIndexRead(
+    const struct Buffer *index, const char *fileName, uint32 address, size_t length,
+    struct Buffer *destData, struct Buffer *destMask, const char **error
+  ) WARN_UNUSED_RESULT;
+
+  /**
+   * @brief Open an Intel hex file for lazy decoding.
+   *
+   * The file is memory-mapped and indexed, but only the headers of its data records are decoded,
+   * so opening even a very large file is quick. The addresses the file covers are divided into
+   * 4KiB pages, and each page is decoded the first time \c bufHexImageRead() touches it. Errors
+   * in the data or checksum of a data record are therefore reported by \c bufHexImageRead()
+   * rather than by this function. An image must not be used by more than one thread at a time.
+   *
+   * @param image A pointer to a <code>struct HexImage*</code> which will be set on successful
+   *            exit to the newly-opened image. It must be released with \c bufHexImageClose().
+   * @param fileName The Intel hex file to open.
+   * @param fill The value to return for addresses with no data in the file.
+   * @param error A pointer to a <code>char*</code> which will be set on exit to an allocated
+   *            error message if something goes wrong. Responsibility for this allocated memory
+   *            passes to the caller and must be freed with \c bufFreeError(). If \c error is
+   *            \c NULL, no allocation is done and no message is returned, but the return code
+   *            will still be valid.
+   * @returns
+   *     - All the return codes of \c bufReadFromIntelHexFile().
+   */
+  DLLEXPORT(BufferStatus) bufHexImageOpen(
+    struct HexImage **image, const char *fileName, uint8 fill, const char **error
+  ) WARN_UNUSED_RESULT;
+
+  /**
+   * @brief Get the range of addresses covered by a lazily-decoded Intel hex file.
+   *
+   * The range is rounded out to whole pages; addresses outside it certainly have no data.
+   *
+   * @param image The image.
+   * @param baseAddress Set on exit to the first address of the first page.
+   * @param length Set on exit to the number of bytes in all the pages.
+   */
+  DLLEXPORT(void) bufHexImageRange(
+    const struct HexImage *image, uint32 *baseAddress, uint64 *length
+  );
+
+  /**
+   * @brief Read a range of addresses from a lazily-decoded Intel hex file.
+   *
+   * Decodes any pages in the range which have not been read before, then copies the range out.
+   * Addresses with no data in the file read as the image's fill value, and are zero in \c mask.
+   *
+   * @param image The image.
+   * @param address The linear address of the first byte to read.
+   * @param length The number of bytes to read.
+   * @param data Where to put the \c length data bytes.
+   * @param mask Where to put the \c length mask bytes (may be \c NULL).
+   * @param error A pointer to a <code>char*</code> which will be set on exit to an allocated
+   *            error message if something goes wrong. Responsibility for this allocated memory
+   *            passes to the caller and must be freed with \c bufFreeError(). If \c error is
+   *            \c NULL, no allocation is done and no message is returned, but the return code
+   *            will still be valid.
+   * @returns
+   *     - \c BUF_SUCCESS if the operation completed successfully.
+   *     - \c BUF_NO_MEM if an allocation error occurred.
+   *     - Any of the line errors returned by \c bufReadFromIntelHexFile(), if a page being
+   *       decoded holds a bad data record.
+   */
+  DLLEXPORT(BufferStatus) bufHexImageRead(
+    struct HexImage *image, uint32 address, size_t length, uint8 *data, uint8 *mask,
+    const char **error
+  ) WARN_UNUSED_RESULT;
+
+  /**
+   * @brief Close a lazily-decoded Intel hex file.
+   *
+   * Unmaps the file and frees everything decoded from it.
+   *
+   * @param image The image to close (may be \c NULL).
+   */
+  DLLEXPORT(void) bufHexImageClose(
+    struct HexImage *image
+  );
+
+  /**
+   * @brief Prepare an incremental Intel hex parser.
+   *
+   * The parser accepts an Intel hex file in arbitrarily-sized pieces through
+   * \c bufHexParserFeed(), so a file arriving over a pipe or a network connection can be decoded
+   * as it arrives, without ever holding the whole of it in memory. The result is the same as if
+   * the file had been given to \c bufReadFromIntelHexFile().
+   *
+   * If \c callback is \c NULL, data records are written into \c destData and \c destMask, which
+   * are first cleared. Otherwise each data record is passed to \c callback instead, and the
+   * buffers are not used (so they may be \c NULL).
+   *
+   * @param self The parser to initialise.
+   * @param destData The buffer to read data bytes into.
+   * @param destMask The buffer to read mask bytes into (may be /c NULL).
+   * @param callback The function to call for each data record (may be \c NULL).
+   * @param context A pointer to pass to \c callback.
+   */
+  DLLEXPORT(void) bufHexParserInit(
+    struct HexParser *self, struct Buffer *destData, struct Buffer *destMask,
+    HexDataCallback callback, void *context
+  );
+
+  /**
+   * @brief Give the next piece of an Intel hex file to a parser.
+   *
+   * The piece may begin and end anywhere, even in the middle of a line; complete lines are
+   * processed immediately. Anything after the EOF record is ignored. Once the parser has failed,
+   * it returns the same code for every subsequent call.
+   *
+   * @param self The parser.
+   * @param data The next piece of the file.
+   * @param length The number of bytes in the piece.
+   * @param error A pointer to a <code>char*</code> which will be set on exit to an allocated
+   *            error message if something goes wrong. Responsibility for this allocated memory
+   *            passes to the caller and must be freed with \c bufFreeError(). If \c error is
+   *            \c NULL, no allocation is done and no message is returned, but the return code
+   *            will still be valid.
+   * @returns
+   *     - \c BUF_SUCCESS if the operation completed successfully.
+   *     - Any of the line errors returned by \c bufReadFromIntelHexFile().
+   *     - Any code returned by the callback.
+   */
+  DLLEXPORT(BufferStatus) bufHexParserFeed(
+    struct HexParser *self, const uint8 *data, size_t length, const char **error
+  ) WARN_UNUSED_RESULT;
+
+  /**
+   * @brief Tell a parser that the whole Intel hex file has been given to it.
+   *
+   * Processes the last line, if it had no terminator, and checks that the file ended properly.
+   *
+   * @param self The parser.
+   * @param error A pointer to a <code>char*</code> which will be set on exit to an allocated
+   *            error message if something goes wrong. Responsibility for this allocated memory
+   *            passes to the caller and must be freed with \c bufFreeError(). If \c error is
+   *            \c NULL, no allocation is done and no message is returned, but the return code
+   *            will still be valid.
+   * @returns
+   *     - \c BUF_SUCCESS if the operation completed successfully.
+   *     - \c HEX_EMPTY_FILE if the parser was given no data at all.
+   *     - \c HEX_MISSING_EOF if there was no EOF record.
+   *     - Any code returned by \c bufHexParserFeed().
+   */
+  DLLEXPORT(BufferStatus) bufHexParserFinish(
+    struct HexParser *self, const char **error
+  ) WARN_UNUSED_RESULT;
+
+  /**
+   * @brief Write a buffer to an Intel hex file.
+   *
+   * Writes out the content of a data buffer as Intel hex records, honouring an optional mask
+   * buffer. Data below 1MiB is addressed with EXT_SEG records, so a small buffer yields a plain
+   * I8HEX or I16HEX file; data above that is addressed with I32HEX EXT_LIN records.
+   * If the mask buffer is \c NULL, a mask buffer is derived. The derived mask can either be
+   * compressed or uncompressed. If compressed it just looks for sizeable runs of the fill byte in
+   * the data buffer. Deriving a mask with compression is dangerous because it assumes the
+   * consumer of your file will have initialised his or her buffer to a known value, which is not
+   * the case in general.
+   *
+   * @param sourceData The buffer to read data bytes from.
+   * @param sourceMask The buffer to read mask bytes from (may be \c NULL).
+   * @param fileName The I8HEX file to write.
+   * @param lineLength The I8HEX line length to use (usually 16 or 32 bytes).
+   * @param compress If sourceMask is \c NULL, whether the derived mask should be compressed.
+   * @param error A pointer to a <code>char*</code> which will be set on exit to an allocated
+   *            error message if something goes wrong. Responsibility for this allocated memory
+   *            passes to the caller and must be freed with \c bufFreeError(). If \c error is
+   *            \c NULL, no allocation is done and no message is returned, but the return code
+   *            will still be valid.
+   * @returns
+   *     - \c BUF_SUCCESS if the operation completed successfully.
+   *     - \c BUF_NO_MEM if an allocation error occurred.
+   *     - \c BUF_FOPEN if the file could not be opened for writing.
+   *     - \c BUF_FERROR if the file could not be written.
+   *     - \c HEX_BAD_EXT_LIN if the buffer extends beyond 4GiB.
+   */
+  DLLEXPORT(BufferStatus) bufWriteToIntelHexFile(
+    const struct Buffer *sourceData, const struct Buffer *sourceMask,
+    const char *fileName, uint8 lineLength, bool compress, const char **error
+  );
+
+  /**
+   * @brief Write a buffer to an Intel hex file, starting at a given address.
+   *
+   * Like \c bufWriteToIntelHexFile(), but the first byte of the buffers is written at linear
+   * address \c baseAddress rather than zero. This is the counterpart of
+   * \c bufReadFromIntelHexFileRebased().
+   *
+   * @param sourceData The buffer to read data bytes from.
+   * @param sourceMask The buffer to read mask bytes from (may be \c NULL).
+   * @param baseAddress The linear address of the first byte of the buffers.
+   * @param fileName The Intel hex file to write.
+   * @param lineLength The Intel hex line length to use (usually 16 or 32 bytes).
+   * @param compress If sourceMask is \c NULL, whether the derived mask should be compressed.
+   * @param error A pointer to a <code>char*</code> which will be set on exit to an allocated
+   *            error message if something goes wrong. Responsibility for this allocated memory
+   *            passes to the caller and must be freed with \c bufFreeError(). If \c error is
+   *            \c NULL, no allocation is done and no message is returned, but the return code
+   *            will still be valid.
+   * @returns
+   *     - All the return codes of \c bufWriteToIntelHexFile().
+   */
+  DLLEXPORT(BufferStatus) bufWriteToIntelHexFileRebased(
+    const struct Buffer *sourceData, const struct Buffer *sourceMask, uint32 baseAddress,
+    const char *fileName, uint8 lineLength, bool compress, const char **error
+  );
+
+  /**
+   * @brief Write a sparse buffer to an Intel hex file.
+   *
+   * Like \c bufWriteToIntelHexFile(), but a 64KiB window of the address space with no data in it
+   * gets no extended address record: the writer finds the next masked byte and goes straight to
+   * its window. The records read back exactly as those of \c bufWriteToIntelHexFile() do, but
+   * a large image with a little data in it is written without a record per empty window.
+   *
+   * @param sourceData The buffer to read data bytes from.
+   * @param sourceMask The buffer to read mask bytes from (may be \c NULL).
+   * @param fileName The Intel hex file to write.
+   * @param lineLength The Intel hex line length to use (usually 16 or 32 bytes).
+   * @param compress If sourceMask is \c NULL, whether the derived mask should be compressed.
+   * @param error A pointer to a <code>char*</code> which will be set on exit to an allocated
+   *            error message if something goes wrong. Responsibility for this allocated memory
+   *            passes to the caller and must be freed with \c bufFreeError(). If \c error is
+   *            \c NULL, no allocation is done and no message is returned, but the return code
+   *            will still be valid.
+   * @returns
+   *     - All the return codes of \c bufWriteToIntelHexFile().
+   */
+  DLLEXPORT(BufferStatus) bufWriteToIntelHexFileSparse(
+    const struct Buffer *sourceData, const struct Buffer *sourceMask, const char *fileName,
+    uint8 lineLength, bool compress, const char **error
+  ) WARN_UNUSED_RESULT;
+
+  /**
+   * @brief Write a buffer as Intel hex text into another buffer.
+   *
+   * Behaves exactly like \c bufWriteToIntelHexFile(), but the text replaces the contents of
+   * \c textOut rather than being written to a file.
+   *
+   * @param sourceData The buffer to read data bytes from.
+   * @param sourceMask The buffer to read mask bytes from (may be \c NULL).
+   * @param textOut The buffer to write the Intel hex text to.
+   * @param lineLength The Intel hex line length to use (usually 16 or 32 bytes).
+   * @param compress If sourceMask is \c NULL, whether the derived mask should be compressed.
+   * @param error A pointer to a <code>char*</code> which will be set on exit to an allocated
+   *            error message if something goes wrong. Responsibility for this allocated memory
+   *            passes to the caller and must be freed with \c bufFreeError(). If \c error is
+   *            \c NULL, no allocation is done and no message is returned, but the return code
+   *            will still be valid.
+   * @returns
+   *     - \c BUF_SUCCESS if the operation completed successfully.
+   *     - \c BUF_NO_MEM if an allocation error occurred.
+   *     - \c HEX_BAD_EXT_LIN if the buffer extends beyond 4GiB.
+   */
+  DLLEXPORT(BufferStatus) bufWriteToIntelHexBuffer(
+    const struct Buffer *sourceData, const struct Buffer *sourceMask, struct Buffer *textOut,
+    uint8 lineLength, bool compress, const char **error
+  ) WARN_UNUSED_RESULT;
+
+  /**
+   * @brief Write a buffer as Intel hex records to an output sink.
+   *
+   * Behaves exactly like \c bufWriteToIntelHexFile(), but the text goes to the sink, in blocks of
+   * up to 64KiB.
+   *
+   * @param sourceData The buffer to read data bytes from.
+   * @param sourceMask The buffer to read mask bytes from (may be \c NULL).
+   * @param sink The sink to write to.
+   * @param lineLength The Intel hex line length to use (usually 16 or 32 bytes).
+   * @param compress If sourceMask is \c NULL, whether the derived mask should be compressed.
+   * @param error A pointer to a <code>char*</code> which will be set on exit to an allocated
+   *            error message if something goes wrong. Responsibility for this allocated memory
+   *            passes to the caller and must be freed with \c bufFreeError(). If \c error is
+   *            \c NULL, no allocation is done and no message is returned, but the return code
+   *            will still be valid.
+   * @returns
+   *     - \c BUF_SUCCESS if the operation completed successfully.
+   *     - \c BUF_NO_MEM if an allocation error occurred.
+   *     - \c HEX_BAD_EXT_LIN if the buffer extends beyond 4GiB.
+   *     - Any code returned by the sink.
+   */
+  DLLEXPORT(BufferStatus) bufWriteToIntelHexSink(
+    const struct Buffer *sourceData, const struct Buffer *sourceMask,
+    const struct BufferSink *sink, uint8 lineLength, bool compress, const char **error
+  ) WARN_UNUSED_RESULT;
+
+  /**
+   * @brief Write a buffer to an Intel hex file, using several threads.
+   *
+   * Behaves exactly like \c bufWriteToIntelHexFile(), and writes exactly the same file, but the
+   * 64KiB windows of the address space are shared out between threads and formatted in parallel.
+   * The whole of the text is held in memory until it is written. On Windows this function just
+   * calls \c bufWriteToIntelHexFile().
+   *
+   * @param sourceData The buffer to read data bytes from.
+   * @param sourceMask The buffer to read mask bytes from (may be \c NULL).
+   * @param fileName The Intel hex file to write.
+   * @param lineLength The Intel hex line length to use (usually 16 or 32 bytes).
+   * @param compress If sourceMask is \c NULL, whether the derived mask should be compressed.
+   * @param numThreads The number of threads to use, or zero to use one per processor.
+   * @param error A pointer to a <code>char*</code> which will be set on exit to an allocated
+   *            error message if something goes wrong. Responsibility for this allocated memory
+   *            passes to the caller and must be freed with \c bufFreeError(). If \c error is
+   *            \c NULL, no allocation is done and no message is returned, but the return code
+   *            will still be valid.
+   * @returns
+   *     - All the return codes of \c bufWriteToIntelHexFile().
+   */
+  DLLEXPORT(BufferStatus) bufWriteToIntelHexFileParallel(
+    const struct Buffer *sourceData, const struct Buffer *sourceMask, const char *fileName,
+    uint8 lineLength, bool compress, uint32 numThreads, const char **error
+  ) WARN_UNUSED_RESULT;
+  //@}
+
+  // ---------------------------------------------------------------------------------------------
+  // S-Record I/O
+  // ---------------------------------------------------------------------------------------------
+  /**
+   * @name S-Record I/O
+   * @{
+   */
+  /**
+   * @brief Read Motorola S-records from a file into a pair of buffers.
+   *
+   * Reads S19, S28 and S37 files alike, into the same data and mask model as
+   * \c bufReadFromIntelHexFile(): the data bytes go into \c destData at their addresses, and the
+   * corresponding bytes of \c destMask are set to 0x01. S0 header records and S5/S6 count records
+   * are checked but otherwise ignored. Reading stops at the S7, S8 or S9 record.
+   *
+   * @param destData The buffer to read data bytes into.
+   * @param destMask The buffer to read mask bytes into (may be \c NULL).
+   * @param fileName The S-record file to read.
+   * @param error A pointer to a <code>char*</code> which will be set on exit to an allocated
+   *            error message if something goes wrong. Responsibility for this allocated memory
+   *            passes to the caller and must be freed with \c bufFreeError(). If \c error is
+   *            \c NULL, no allocation is done and no message is returned, but the return code
+   *            will still be valid.
+   * @returns
+   *     - \c BUF_SUCCESS if the operation completed successfully.
+   *     - \c BUF_NO_MEM if an allocation error occurred.
+   *     - \c BUF_FOPEN if the file could not be opened for reading.
+   *     - \c BUF_FERROR if the file could not be read.
+   *     - \c HEX_EMPTY_FILE if the file was empty.
+   *     - \c SREC_BAD_RECORD if a line is malformed, or has an unknown type.
+   *     - \c SREC_BAD_CHECKSUM if a line's checksum is wrong.
+   *     - \c SREC_MISSING_END if the file has no S7, S8 or S9 record.
+   */
+  DLLEXPORT(BufferStatus) bufReadFromSRecordFile(
+    struct Buffer *destData, struct Buffer *destMask, const char *fileName, const char **error
+  ) WARN_UNUSED_RESULT;
+
+  /**
+   * @brief Write a buffer to a Motorola S-record file.
+   *
+   * Writes the data as S1 records if every address fits in 16 bits, S2 records if every address
+   * fits in 24 bits, and S3 records otherwise, with the matching S9, S8 or S7 end record. An empty
+   * S0 header and an S5 or S6 count record are written too. The mask is handled exactly as by
+   * \c bufWriteToIntelHexFile().
+   *
+   * @param sourceData The buffer to read data bytes from.
+   * @param sourceMask The buffer to read mask bytes from (may be \c NULL).
+   * @param fileName The S-record file to write.
+   * @param lineLength The most data bytes per record (usually 16 or 32); zero or anything too
+   *            large for the record type means as many as will fit.
+   * @param compress If sourceMask is \c NULL, whether the derived mask should be compressed.
+   * @param error A pointer to a <code>char*</code> which will be set on exit to an allocated
+   *            error message if something goes wrong. Responsibility for this allocated memory
+   *            passes to the caller and must be freed with \c bufFreeError(). If \c error is
+   *            \c NULL, no allocation is done and no message is returned, but the return code
+   *            will still be valid.
+   * @returns
+   *     - All the return codes of \c bufWriteToIntelHexFile().
+   */
+  DLLEXPORT(BufferStatus) bufWriteToSRecordFile(
+    const struct Buffer *sourceData, const struct Buffer *sourceMask, const char *fileName,
+    uint8 lineLength, bool compress, const char **error
+  ) WARN_UNUSED_RESULT;
+
+  /**
+   * @brief Write a buffer as Motorola S-records to an output sink.
+   *
+   * Behaves exactly like \c bufWriteToSRecordFile(), but the text goes to the sink.
+   *
+   * @param sourceData The buffer to read data bytes from.
+   * @param sourceMask The buffer to read mask bytes from (may be \c NULL).
+   * @param sink The sink to write to.
+   * @param lineLength The most data bytes per record.
+   * @param compress If sourceMask is \c NULL, whether the derived mask should be compressed.
+   * @param error A pointer to a <code>char*</code> which will be set on exit to an allocated
+   *            error message if something goes wrong. Responsibility for this allocated memory
+   *            passes to the caller and must be freed with \c bufFreeError(). If \c error is
+   *            \c NULL, no allocation is done and no message is returned, but the return code
+   *            will still be valid.
+   * @returns
+   *     - All the return codes of \c bufWriteToIntelHexSink().
+   */
+  DLLEXPORT(BufferStatus) bufWriteToSRecordSink(
+    const struct Buffer *sourceData, const struct Buffer *sourceMask,
+    const struct BufferSink *sink, uint8 lineLength, bool compress, const char **error
+  ) WARN_UNUSED_RESULT;
+  //@}
+
+  // ---------------------------------------------------------------------------------------------
+  // Memory Initialisation Files
+  // ---------------------------------------------------------------------------------------------
+  /**
+   * @name Memory Initialisation Files
+   * @{
+   */
+  /**
+   * @brief Write a buffer as a memory initialisation file for an FPGA block RAM.
+   *
+   * The buffer is divided into words of \c wordSize bytes, and each word is written on its own
+   * line as upper-case hex digits, most significant first. If the buffer is not a whole number of
+   * words long, the last word is padded with the buffer's fill byte. MIF files get a header giving
+   * the width and depth, and every word is prefixed with its address; COE files get a header
+   * giving the radix, and the words are separated by commas.
+   *
+   * @param self The buffer to write.
+   * @param fileName The file to write.
+   * @param format The format to write.
+   * @param wordSize The number of bytes in each word of the RAM, from 1 to 32.
+   * @param bigEndian If \c true, the first byte of each word in the buffer is its most
+   *            significant byte; otherwise it is the least significant.
+   * @param error A pointer to a <code>char*</code> which will be set on exit to an allocated
+   *            error message if something goes wrong. Responsibility for this allocated memory
+   *            passes to the caller and must be freed with \c bufFreeError(). If \c error is
+   *            \c NULL, no allocation is done and no message is returned, but the return code
+   *            will still be valid.
+   * @returns
+   *     - \c BUF_SUCCESS if the operation completed successfully.
+   *     - \c BUF_NO_MEM if an allocation error occurred.
+   *     - \c BUF_FOPEN if the file could not be opened for writing.
+   *     - \c BUF_FERROR if the file could not be written.
+   *     - \c BUF_BAD_MEMINIT if the format or word size is invalid.
+   */
+  DLLEXPORT(BufferStatus) bufWriteMemInitFile(
+    const struct Buffer *self, const char *fileName, MemInitFormat format, uint32 wordSize,
+    bool bigEndian, const char **error
+  ) WARN_UNUSED_RESULT;
+
+  /**
+   * @brief Write a buffer as a memory initialisation file to an output sink.
+   *
+   * Behaves exactly like \c bufWriteMemInitFile(), but the text goes to the sink.
+   *
+   * @param self The buffer to write.
+   * @param sink The sink to write to.
+   * @param format The format to write.
+   * @param wordSize The number of bytes in each word of the RAM, from 1 to 32.
+   * @param bigEndian Whether the first byte of each word is its most significant byte.
+   * @param error A pointer to a <code>char*</code> which will be set on exit to an allocated
+   *            error message if something goes wrong. Responsibility for this allocated memory
+   *            passes to the caller and must be freed with \c bufFreeError(). If \c error is
+   *            \c NULL, no allocation is done and no message is returned, but the return code
+   *            will still be valid.
+   * @returns
+   *     - \c BUF_SUCCESS if the operation completed successfully.
+   *     - \c BUF_NO_MEM if an allocation error occurred.
+   *     - \c BUF_BAD_MEMINIT if the format or word size is invalid.
+   *     - Any code returned by the sink.
+   */
+  DLLEXPORT(BufferStatus) bufWriteMemInitSink(
+    const struct Buffer *self, const struct BufferSink *sink, MemInitFormat format,
+    uint32 wordSize, bool bigEndian, const char **error
+  ) WARN_UNUSED_RESULT;
+  //@}
+
+  // ---------------------------------------------------------------------------------------------
+  // Native Images
+  // ---------------------------------------------------------------------------------------------
+  /**
+   * @name Native Images
+   * @{
+   */
+  /**
+   * @brief Write a buffer and its mask to a native image file.
+   *
+   * The image holds a header, a table of extents sorted by address, and the data bytes of each
+   * extent. An extent is a run of nonzero mask bytes, or several runs separated by holes of up to
+   * 32 bytes, in which case a bitmap of the masked bytes follows its data. Extents of 4KiB or more
+   * start on a 4KiB boundary; smaller ones are packed together. So the image costs at most the
+   * data it carries, an eighth of a byte per byte for bitmaps, 32 bytes per extent and under 4KiB
+   * of padding per large extent, however the mask is fragmented, and loading it needs no
+   * parsing.
+   *
+   * @param sourceData The buffer to read data bytes from.
+   * @param sourceMask The buffer to read mask bytes from (may be \c NULL, in which case the
+   *            whole buffer is one extent).
+   * @param fileName The image file to write.
+   * @param checksum If \c true, store a CRC-32 for each extent, to be checked on loading.
+   * @param error A pointer to a <code>char*</code> which will be set on exit to an allocated
+   *            error message if something goes wrong. Responsibility for this allocated memory
+   *            passes to the caller and must be freed with \c bufFreeError(). If \c error is
+   *            \c NULL, no allocation is done and no message is returned, but the return code
+   *            will still be valid.
+   * @returns
+   *     - \c BUF_SUCCESS if the operation completed successfully.
+   *     - \c BUF_NO_MEM if an allocation error occurred.
+   *     - \c BUF_FOPEN if the file could not be opened for writing.
+   *     - \c BUF_FERROR if the file could not be written.
+   */
+  DLLEXPORT(BufferStatus) bufSaveImage(
+    const struct Buffer *sourceData, const struct Buffer *sourceMask, const char *fileName,
+    bool checksum, const char **error
+  ) WARN_UNUSED_RESULT;
+
+  /**
+   * @brief Read a native image file into a pair of buffers.
+   *
+   * The file is mapped, its extent table checked, and the masked bytes of each extent copied into
+   * \c destData at their addresses, with the corresponding bytes of \c destMask set to 0x01.
+   * Images written by earlier versions of \c bufSaveImage() load too. The buffers are then
+   * extended to the length of the saved buffer; bytes not masked in the image are left at the fill
+   * value and unmasked. An image saved by \c bufSaveImage() from a buffer and a 0x00/0x01 mask
+   * therefore loads back exactly, provided the unmasked data bytes were fill.
+   *
+   * @param destData The buffer to read data bytes into.
+   * @param destMask The buffer to read mask bytes into (may be \c NULL).
+   * @param fileName The image file to read.
+   * @param error A pointer to a <code>char*</code> which will be set on exit to an allocated
+   *            error message if something goes wrong. Responsibility for this allocated memory
+   *            passes to the caller and must be freed with \c bufFreeError(). If \c error is
+   *            \c NULL, no allocation is done and no message is returned, but the return code
+   *            will still be valid.
+   * @returns
+   *     - \c BUF_SUCCESS if the operation completed successfully.
+   *     - \c BUF_NO_MEM if an allocation error occurred, or the image is too large to load.
+   *     - \c BUF_FOPEN if the file could not be opened for reading.
+   *     - \c BUF_FERROR if the file could not be read.
+   *     - \c BUF_BAD_IMAGE if the file is not an image, has an unsupported version, or has an
+   *       extent table which is out of order or points outside the file.
+   *     - \c BUF_BAD_CRC if the image has CRCs and an extent does not match its CRC.
+   */
+  DLLEXPORT(BufferStatus) bufLoadImage(
+    struct Buffer *destData, struct Buffer *destMask, const char *fileName, const char **error
+  ) WARN_UNUSED_RESULT;
+  //@}
+
+  // ---------------------------------------------------------------------------------------------
+  // Hex Strings
+  // ---------------------------------------------------------------------------------------------
+  /**
+   * @name Hex Strings
+   * @{
+   */
+  /**
+   * @brief Encode a block of bytes as a string of hex digits.
+   *
+   * Replaces the contents of \c destText with two upper-case hex digits for each byte, most
+   * significant first. The text is not NUL-terminated; its length is \c 2*count.
+   *
+   * @param data The bytes to encode.
+   * @param count The number of bytes to encode.
+   * @param destText The buffer to write the hex digits into.
+   * @param error A pointer to a <code>char*</code> which will be set on exit to an allocated
+   *            error message if something goes wrong. Responsibility for this allocated memory
+   *            passes to the caller and must be freed with \c bufFreeError(). If \c error is
+   *            \c NULL, no allocation is done and no message is returned, but the return code
+   *            will still be valid.
+   * @returns
+   *     - \c BUF_SUCCESS if the operation completed successfully.
+   *     - \c BUF_NO_MEM if an allocation error occurred.
+   */
+  DLLEXPORT(BufferStatus) bufToHexString(
+    const uint8 *data, size_t count, struct Buffer *destText, const char **error
+  ) WARN_UNUSED_RESULT;
+
+  /**
+   * @brief Decode a string of hex digits into a block of bytes.
+   *
+   * Replaces the contents of \c destData with the bytes represented by \c text, which must be
+   * an even number of hex digits of either case, with nothing between them. If \c text is bad,
+   * \c destData is left empty.
+   *
+   * @param destData The buffer to write the decoded bytes into.
+   * @param text The hex digits to decode.
+   * @param length The number of hex digits.
+   * @param error A pointer to a <code>char*</code> which will be set on exit to an allocated
+   *            error message if something goes wrong. Responsibility for this allocated memory
+   *            passes to the caller and must be freed with \c bufFreeError(). If \c error is
+   *            \c NULL, no allocation is done and no message is returned, but the return code
+   *            will still be valid.
+   * @returns
+   *     - \c BUF_SUCCESS if the operation completed successfully.
+   *     - \c BUF_NO_MEM if an allocation error occurred.
+   *     - \c BUF_BAD_HEX if \c length is odd, or \c text has a char which is not a hex digit.
+   */
+  DLLEXPORT(BufferStatus) bufFromHexString(
+    struct Buffer *destData, const char *text, size_t length, const char **error
+  ) WARN_UNUSED_RESULT;
+  //@}
+
+  // ---------------------------------------------------------------------------------------------
+  // Delta Encoding
+  // ---------------------------------------------------------------------------------------------
+  /**
+   * @name Delta Encoding
+   * @{
+   */
+  /**
+   * @brief Encode the differences between two buffer images as a compact delta.
+   *
+   * Writes a stream of copy, insert and fill operations into \c delta which will reconstruct
+   * \c newData from \c oldData. Matches are found by indexing \c oldData in 32-byte blocks and
+   * rolling a hash over \c newData, so generation time is roughly linear in the image size. If
+   * a mask is supplied, bytes of \c newData whose mask byte is zero are "don't care": they may
+   * be matched against anything in \c oldData, and runs of them are encoded as the fill byte of
+   * \c newData rather than as literal data.
+   *
+   * @param oldData The base image, which the receiver already has.
+   * @param newData The new image.
+   * @param newMask The mask for the new image (may be \c NULL).
+   * @param delta The buffer to write the delta into. Any existing content is discarded.
+   * @param error A pointer to a <code>char*</code> which will be set on exit to an allocated
+   *            error message if something goes wrong. Responsibility for this allocated memory
+   *            passes to the caller and must be freed with \c bufFreeError(). If \c error is
+   *            \c NULL, no allocation is done and no message is returned, but the return code
+   *            will still be valid.
+   * @returns
+   *     - \c BUF_SUCCESS if the operation completed successfully.
+   *     - \c BUF_NO_MEM if an allocation error occurred.
+   */
+  DLLEXPORT(BufferStatus) bufMakeDelta(
+    const struct Buffer *oldData, const struct Buffer *newData, const struct Buffer *newMask,
+    struct Buffer *delta, const char **error
+  ) WARN_UNUSED_RESULT;
+
+  /**
+   * @brief Reconstruct an image from a base image and a delta.
+   *
+   * Applies a delta produced by \c bufMakeDelta() to \c base, writing the result into \c out.
+   * The delta is validated against the bounds of both images before any data is touched, so the
+   * operations themselves are plain block copies. If \c out and \c base are the same buffer,
+   * the delta is applied in place when no copy reads from a region that an earlier operation has
+   * already overwritten; otherwise a temporary buffer is used and swapped in at the end.
+   *
+   * @param base The base image the delta was made against.
+   * @param delta The delta to apply.
+   * @param out The buffer to write the new image into (may be \c base).
+   * @param error A pointer to a <code>char*</code> which will be set on exit to an allocated
+   *            error message if something goes wrong. Responsibility for this allocated memory
+   *            passes to the caller and must be freed with \c bufFreeError(). If \c error is
+   *            \c NULL, no allocation is done and no message is returned, but the return code
+   *            will still be valid.
+   * @returns
+   *     - \c BUF_SUCCESS if the operation completed successfully.
+   *     - \c BUF_NO_MEM if an allocation error occurred.
+   *     - \c BUF_BAD_DELTA if the delta is malformed, or was made against a different base.
+   */
+  DLLEXPORT(BufferStatus) bufApplyDelta(
+    struct Buffer *base, const struct Buffer *delta, struct Buffer *out, const char **error
+  ) WARN_UNUSED_RESULT;
   //@}
 
   // ---------------------------------------------------------------------------------------------
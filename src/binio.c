@@ -14,57 +14,287 @@
  * You should have received a copy of the GNU Lesser General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#ifndef WIN32
+  #define _FILE_OFFSET_BITS 64
+#endif
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
 #include <makestuff/liberror.h>
 #include <makestuff/libbuffer.h>
+#include "private.h"
+#ifdef WIN32
+  #include <io.h>
+#else
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+#endif
 
-DLLEXPORT(BufferStatus) bufAppendFromBinaryFile(
-  struct Buffer *self, const char *fileName, const char **error)
+#define READ_CHUNK (4 * 1024 * 1024)
+
+// Append everything read from a descriptor until EOF. Each read goes straight into the spare
+// capacity at the end of the buffer, which grows whenever it fills up. The room made by growing
+// is not filled, so on exit whatever was not read into it is set to the fill byte.
+//
+DLLEXPORT(BufferStatus) bufAppendFromDescriptor(
+  struct Buffer *self, int fd, const char **error)
 {
-  BufferStatus retVal = BUF_SUCCESS;
-  BufferStatus bStatus;
-  size_t length;
-  size_t actualLength;
-  long ftellResult;
+  BufferStatus retVal = BUF_SUCCESS, status;
   const size_t currentLength = self->length;
-  FILE *file = fopen(fileName, "rb");
-  if (!file) {
-    errRenderStd(error);
-    errPrefix(error, "bufAppendFromBinaryFile()");
-    FAIL_RET(BUF_FOPEN, cleanup);
+  size_t dirtyEnd = self->length;  // bytes from the length up to here may not be fill
+  size_t room;
+  #ifdef WIN32
+    int bytesRead;
+  #else
+    ssize_t bytesRead;
+  #endif
+  for (;;) {
+    if (self->length == self->capacity) {
+      status = bufMakeRoom(self, 1, error);
+      CHECK_STATUS(status, status, cleanup, "bufAppendFromDescriptor()");
+      dirtyEnd = self->capacity;
+    }
+    room = self->capacity - self->length;
+    if (room > READ_CHUNK) {
+      room = READ_CHUNK;
+    }
+    #ifdef WIN32
+      bytesRead = _read(fd, self->data + self->length, (unsigned int)room);
+    #else
+      bytesRead = read(fd, self->data + self->length, room);
+    #endif
+    if (bytesRead == 0) {
+      break;
+    }
+    if (bytesRead < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      errRenderStd(error);
+      FAIL_RET(BUF_FERROR, cleanup, "bufAppendFromDescriptor()");
+    }
+    self->length += (size_t)bytesRead;
+    if (self->length > dirtyEnd) {
+      dirtyEnd = self->length;
+    }
   }
-  if (fseek(file, 0, SEEK_END)) {
-    errRenderStd(error);
-    errPrefix(error, "bufAppendFromBinaryFile()");
-    FAIL_RET(BUF_FSEEK, cleanup);
+cleanup:
+  if (retVal) {
+    self->length = currentLength;
   }
-  ftellResult = ftell(file);
-  if (ftellResult < 0) {
-    errRenderStd(error);
-    errPrefix(error, "bufAppendFromBinaryFile()");
-    FAIL_RET(BUF_FTELL, cleanup);
+  if (dirtyEnd > self->length) {
+    memset(self->data + self->length, self->fill, dirtyEnd - self->length);
   }
-  length = (size_t)ftellResult;
-  bStatus = bufAppendConst(self, 0x00, length, error);
-  CHECK_STATUS(bStatus, bStatus, cleanup, "bufAppendFromBinaryFile()");
-  rewind(file);
-  actualLength = fread(self->data + currentLength, 1, length, file);
-  if (actualLength != length) {
-    CHECK_STATUS(
-      feof(file), BUF_FEOF, cleanup,
-      "bufAppendFromBinaryFile(): Unexpectedly hit EOF after reading %lu bytes!", actualLength);
-    if (ferror(file)) {
+  return retVal;
+}
+
+#ifdef WIN32
+  DLLEXPORT(BufferStatus) bufAppendFromBinaryFile(
+    struct Buffer *self, const char *fileName, const char **error)
+  {
+    BufferStatus retVal = BUF_SUCCESS;
+    BufferStatus bStatus;
+    size_t length;
+    size_t actualLength;
+    long ftellResult;
+    const size_t currentLength = self->length;
+    FILE *file = fopen(fileName, "rb");
+    if (!file) {
       errRenderStd(error);
       errPrefix(error, "bufAppendFromBinaryFile()");
-      FAIL_RET(BUF_FERROR, cleanup);
+      FAIL_RET(BUF_FOPEN, cleanup);
     }
+    if (fseek(file, 0, SEEK_END)) {
+      errRenderStd(error);
+      errPrefix(error, "bufAppendFromBinaryFile()");
+      FAIL_RET(BUF_FSEEK, cleanup);
+    }
+    ftellResult = ftell(file);
+    if (ftellResult < 0) {
+      errRenderStd(error);
+      errPrefix(error, "bufAppendFromBinaryFile()");
+      FAIL_RET(BUF_FTELL, cleanup);
+    }
+    length = (size_t)ftellResult;
+
+    // Read straight into the room at the end of the buffer; only what is not read needs filling
+    //
+    bStatus = bufMakeRoom(self, length, error);
+    CHECK_STATUS(bStatus, bStatus, cleanup, "bufAppendFromBinaryFile()");
+    rewind(file);
+    actualLength = fread(self->data + currentLength, 1, length, file);
+    self->length = currentLength + length;
+    if (actualLength != length) {
+      memset(self->data + currentLength + actualLength, 0x00, length - actualLength);
+      CHECK_STATUS(
+        feof(file), BUF_FEOF, cleanup,
+        "bufAppendFromBinaryFile(): Unexpectedly hit EOF after reading %lu bytes!", actualLength);
+      if (ferror(file)) {
+        errRenderStd(error);
+        errPrefix(error, "bufAppendFromBinaryFile()");
+        FAIL_RET(BUF_FERROR, cleanup);
+      }
+    }
+  cleanup:
+    if (file) {
+      fclose(file);
+    }
+    return retVal;
   }
-cleanup:
-  if (file) {
-    fclose(file);
+
+  DLLEXPORT(BufferStatus) bufAppendFromBinaryFileRange(
+    struct Buffer *self, const char *fileName, uint64 offset, size_t count, const char **error)
+  {
+    BufferStatus retVal = BUF_SUCCESS, status;
+    size_t actualLength;
+    FILE *file = fopen(fileName, "rb");
+    if (!file) {
+      errRenderStd(error);
+      FAIL_RET(BUF_FOPEN, cleanup, "bufAppendFromBinaryFileRange()");
+    }
+    if (_fseeki64(file, (__int64)offset, SEEK_SET)) {
+      errRenderStd(error);
+      FAIL_RET(BUF_FSEEK, cleanup, "bufAppendFromBinaryFileRange()");
+    }
+    status = bufMakeRoom(self, count, error);
+    CHECK_STATUS(status, status, cleanup, "bufAppendFromBinaryFileRange()");
+    actualLength = fread(self->data + self->length, 1, count, file);
+    if (actualLength != count) {
+      // The room made for the range is not filled, so put back the fill byte on all of it
+      memset(self->data + self->length, self->fill, count);
+      if (ferror(file)) {
+        errRenderStd(error);
+        FAIL_RET(BUF_FERROR, cleanup, "bufAppendFromBinaryFileRange()");
+      }
+      FAIL_RET(
+        BUF_FEOF, cleanup,
+        "bufAppendFromBinaryFileRange(): Unexpectedly hit EOF after reading %lu bytes!",
+        (unsigned long)actualLength);
+    }
+    self->length += count;
+  cleanup:
+    if (file) {
+      fclose(file);
+    }
+    return retVal;
+  }
+#else
+  // Open a file for reading, and find out whether it is a regular file, and if so its size.
+  //
+  static BufferStatus openFile(
+    const char *fileName, int *fd, bool *regular, uint64 *size, const char **error)
+  {
+    BufferStatus retVal = BUF_SUCCESS;
+    struct stat st;
+    *fd = open(fileName, O_RDONLY);
+    if (*fd < 0) {
+      errRenderStd(error);
+      FAIL_RET(BUF_FOPEN, exit, "openFile()");
+    }
+    if (fstat(*fd, &st)) {
+      errRenderStd(error);
+      close(*fd);
+      *fd = -1;
+      FAIL_RET(BUF_FERROR, exit, "openFile()");
+    }
+    *regular = S_ISREG(st.st_mode);
+    *size = (uint64)st.st_size;
+  exit:
+    return retVal;
   }
-  return retVal;
-}
+
+  // Append count bytes from the given offset of a file, reading straight into the room at the
+  // end of the buffer in large chunks. If the read fails the buffer is left as it was, with the
+  // whole of the room made for the range set back to the fill byte.
+  //
+  static BufferStatus readRange(
+    struct Buffer *self, int fd, uint64 offset, size_t count, const char **error)
+  {
+    BufferStatus retVal = BUF_SUCCESS, status;
+    size_t done = 0, chunk;
+    ssize_t bytesRead;
+    status = bufMakeRoom(self, count, error);
+    CHECK_STATUS(status, status, exit, "readRange()");
+    #ifdef POSIX_FADV_SEQUENTIAL
+      (void)posix_fadvise(fd, (off_t)offset, (off_t)count, POSIX_FADV_SEQUENTIAL);
+    #endif
+    while (done < count) {
+      chunk = (count - done < READ_CHUNK) ? count - done : READ_CHUNK;
+      bytesRead = pread(fd, self->data + self->length + done, chunk, (off_t)(offset + done));
+      if (bytesRead < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        errRenderStd(error);
+        FAIL_RET(BUF_FERROR, cleanup, "readRange()");
+      }
+      CHECK_STATUS(
+        bytesRead == 0, BUF_FEOF, cleanup,
+        "readRange(): Unexpectedly hit EOF after reading %lu bytes!", (unsigned long)done);
+      done += (size_t)bytesRead;
+    }
+    self->length += count;
+  cleanup:
+    if (retVal) {
+      memset(self->data + self->length, self->fill, count);
+    }
+  exit:
+    return retVal;
+  }
+
+  DLLEXPORT(BufferStatus) bufAppendFromBinaryFile(
+    struct Buffer *self, const char *fileName, const char **error)
+  {
+    BufferStatus retVal = BUF_SUCCESS, status;
+    uint64 size;
+    bool regular;
+    int fd;
+    status = openFile(fileName, &fd, &regular, &size, error);
+    CHECK_STATUS(status, status, exit, "bufAppendFromBinaryFile()");
+
+    // Pipes, FIFOs and the like cannot be sized up front, so are just read until EOF
+    //
+    if (!regular) {
+      status = bufAppendFromDescriptor(self, fd, error);
+      CHECK_STATUS(status, status, cleanup, "bufAppendFromBinaryFile()");
+      goto cleanup;
+    }
+    CHECK_STATUS(
+      size > (size_t)-1, BUF_NO_MEM, cleanup,
+      "bufAppendFromBinaryFile(): File is too large to load");
+    status = readRange(self, fd, 0, (size_t)size, error);
+    CHECK_STATUS(status, status, cleanup, "bufAppendFromBinaryFile()");
+  cleanup:
+    close(fd);
+  exit:
+    return retVal;
+  }
+
+  DLLEXPORT(BufferStatus) bufAppendFromBinaryFileRange(
+    struct Buffer *self, const char *fileName, uint64 offset, size_t count, const char **error)
+  {
+    BufferStatus retVal = BUF_SUCCESS, status;
+    uint64 size;
+    bool regular;
+    int fd;
+    status = openFile(fileName, &fd, &regular, &size, error);
+    CHECK_STATUS(status, status, exit, "bufAppendFromBinaryFileRange()");
+    CHECK_STATUS(
+      !regular, BUF_FSEEK, cleanup,
+      "bufAppendFromBinaryFileRange(): %s is not a regular file", fileName);
+    CHECK_STATUS(
+      offset > size || count > size - offset, BUF_FEOF, cleanup,
+      "bufAppendFromBinaryFileRange(): Range extends beyond the end of the file");
+    status = readRange(self, fd, offset, count, error);
+    CHECK_STATUS(status, status, cleanup, "bufAppendFromBinaryFileRange()");
+  cleanup:
+    close(fd);
+  exit:
+    return retVal;
+  }
+#endif
 
 DLLEXPORT(BufferStatus) bufWriteBinaryFile(
   const struct Buffer *self, const char *fileName, size_t bufAddress, size_t count,
@@ -90,3 +320,59 @@ cleanup:
   }
   return retVal;
 }
+
+DLLEXPORT(BufferStatus) bufWriteBinarySink(
+  const struct Buffer *self, const struct BufferSink *sink, size_t bufAddress, size_t count,
+  const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS;
+  BufferStatus bStatus = sink->write(sink->context, self->data + bufAddress, count, error);
+  CHECK_STATUS(bStatus, bStatus, cleanup, "bufWriteBinarySink()");
+cleanup:
+  return retVal;
+}
+
+// Construct a buffer which uses a private mapping of a binary file as its data.
+//
+DLLEXPORT(BufferStatus) bufMapBinaryFile(
+  struct Buffer *self, const char *fileName, uint8 fill, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  #ifndef WIN32
+    struct stat st;
+    void *ptr;
+    const int fd = open(fileName, O_RDONLY);
+    if (fd < 0) {
+      errRenderStd(error);
+      FAIL_RET(BUF_FOPEN, exit, "bufMapBinaryFile()");
+    }
+    if (!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0 &&
+        (uint64)st.st_size <= (size_t)-1)
+    {
+      ptr = mmap(
+        NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+      if (ptr != MAP_FAILED) {
+        self->data = (uint8 *)ptr;
+        self->length = (size_t)st.st_size;
+        self->capacity = (size_t)st.st_size;
+        self->fill = fill;
+        self->mapped = true;
+        close(fd);
+        goto exit;
+      }
+    }
+    close(fd);
+  #endif
+
+  // Not mappable, so just read it
+  //
+  status = bufInitialise(self, 1024, fill, error);
+  CHECK_STATUS(status, status, exit, "bufMapBinaryFile()");
+  status = bufAppendFromBinaryFile(self, fileName, error);
+  if (status) {
+    bufDestroy(self);
+    FAIL_RET(status, exit, "bufMapBinaryFile()");
+  }
+exit:
+  return retVal;
+}
@@ -14,38 +14,186 @@
  * You should have received a copy of the GNU Lesser General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <string.h>
 #include "conv.h"
 
+// Value of each ascii char as a hex digit, or 0xFF if it is not one.
+//
+static const uint8 hexDigitValue[256] = {
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
 // Updates *outputNibble with the nibble represented by the supplied ascii hex digit.
 // Return false on success or true for illegal char.
 //
 bool getHexNibble(char hexDigit, uint8 *outputNibble) {
-  if (hexDigit >= '0' && hexDigit <= '9') {
-    *outputNibble = (uint8)(hexDigit - '0');
-    return false;
-  } else if (hexDigit >= 'a' && hexDigit <= 'f') {
-    *outputNibble = (uint8)(hexDigit - 'a' + 10);
-    return false;
-  } else if (hexDigit >= 'A' && hexDigit <= 'F') {
-    *outputNibble = (uint8)(hexDigit - 'A' + 10);
-    return false;
-  } else {
+  const uint8 value = hexDigitValue[(uint8)hexDigit];
+  if (value & 0x80) {
     return true;
   }
+  *outputNibble = value;
+  return false;
 }
 
 // Updates *outputByte with the byte represented by the two ascii hex digits pointed to by hexDigitPair.
 // Return false on success or true for illegal char.
 //
 bool getHexByte(const char *hexDigitPair, uint8 *outputByte) {
-  uint8 upperNibble;
-  uint8 lowerNibble;
-  if (!getHexNibble(hexDigitPair[0], &upperNibble) && !getHexNibble(hexDigitPair[1], &lowerNibble)) {
-    *outputByte = (uint8)((upperNibble << 4) | lowerNibble);
-    return false;
-  } else {
+  const uint8 upperNibble = hexDigitValue[(uint8)hexDigitPair[0]];
+  const uint8 lowerNibble = hexDigitValue[(uint8)hexDigitPair[1]];
+  if ((upperNibble | lowerNibble) & 0x80) {
     return true;
   }
+  *outputByte = (uint8)((upperNibble << 4) | lowerNibble);
+  return false;
+}
+
+#if BYTE_ORDER == 1234
+  #define ONES 0x0101010101010101ULL
+  #define HIGH 0x8080808080808080ULL
+
+  // Decode eight ascii hex digits (loaded little-endian into a uint64) into four bytes, without
+  // branching on the individual digits. Each lane's top bit is used as a flag: adding (0x80 - lo)
+  // to a lane sets its top bit iff the lane is >= lo, and no lane carries into the next because
+  // everything is below 0x80 once non-ascii lanes have been ruled out.
+  // If any of the digits is lower-case, *lowerCase is set.
+  // Return false on success or true if any of the eight chars is not a hex digit.
+  //
+  static inline bool decodeEight(uint64 v, uint32 *outputBytes, bool *lowerCase) {
+    const uint64 lower = v | (ONES * 0x20);  // fold 'A'-'F' onto 'a'-'f'
+    const uint64 isDigit = (v + ONES * (0x80 - '0')) & ~(v + ONES * (0x7F - '9'));
+    const uint64 isAlpha = (lower + ONES * (0x80 - 'a')) & ~(lower + ONES * (0x7F - 'f')) & HIGH;
+    const uint64 valid = (isDigit | isAlpha) & ~v & HIGH;
+    uint64 nibbles;
+    if (valid != HIGH) {
+      return true;
+    }
+    if (isAlpha & (v << 2)) {
+      *lowerCase = true;  // 'a'-'f' have bit 5 set, 'A'-'F' do not
+    }
+
+    // '0'-'9' have low nibbles 0-9, and 'A'-'F' & 'a'-'f' have low nibbles 1-6
+    //
+    nibbles = (v & (ONES * 0x0F)) + (isAlpha >> 7) * 9;
+
+    // Each 16-bit lane holds an upper nibble in its low byte and a lower nibble in its high byte;
+    // combine them, then squeeze the four resulting bytes together.
+    //
+    nibbles = ((nibbles & 0x000F000F000F000FULL) << 4) | ((nibbles >> 8) & 0x000F000F000F000FULL);
+    nibbles = (nibbles | (nibbles >> 8)) & 0x0000FFFF0000FFFFULL;
+    nibbles = (nibbles | (nibbles >> 16)) & 0x00000000FFFFFFFFULL;
+    *outputBytes = (uint32)nibbles;
+    return false;
+  }
+#endif
+
+// Decode byteCount bytes from the 2*byteCount ascii hex digits pointed to by hexDigits. The
+// digits are validated eight at a time; only a group containing an illegal char is rescanned one
+// char at a time to find it. If any of the decoded digits is lower-case, *lowerCase is set.
+// Return false on success or true for illegal char, in which case *badIndex is set to the offset
+// of the first illegal char.
+//
+bool getHexBytes(
+  const char *hexDigits, size_t byteCount, uint8 *outputBytes, size_t *badIndex,
+  bool *lowerCase)
+{
+  size_t i = 0;
+  #if BYTE_ORDER == 1234
+    uint64 v;
+    uint32 four;
+    while (i + 4 <= byteCount) {
+      memcpy(&v, hexDigits + 2*i, 8);
+      if (decodeEight(v, &four, lowerCase)) {
+        break;
+      }
+      memcpy(outputBytes + i, &four, 4);
+      i += 4;
+    }
+  #endif
+  for (; i < byteCount; i++) {
+    const uint8 upperNibble = hexDigitValue[(uint8)hexDigits[2*i]];
+    const uint8 lowerNibble = hexDigitValue[(uint8)hexDigits[2*i + 1]];
+    if ((upperNibble | lowerNibble) & 0x80) {
+      *badIndex = (upperNibble & 0x80) ? 2*i : 2*i + 1;
+      return true;
+    }
+    if (hexDigits[2*i] >= 'a' || hexDigits[2*i + 1] >= 'a') {
+      *lowerCase = true;
+    }
+    outputBytes[i] = (uint8)((upperNibble << 4) | lowerNibble);
+  }
+  return false;
+}
+
+// The two ascii hex digits for each byte value, upper-case, most significant first.
+//
+const char hexDigitPairs[513] =
+  "000102030405060708090A0B0C0D0E0F"
+  "101112131415161718191A1B1C1D1E1F"
+  "202122232425262728292A2B2C2D2E2F"
+  "303132333435363738393A3B3C3D3E3F"
+  "404142434445464748494A4B4C4D4E4F"
+  "505152535455565758595A5B5C5D5E5F"
+  "606162636465666768696A6B6C6D6E6F"
+  "707172737475767778797A7B7C7D7E7F"
+  "808182838485868788898A8B8C8D8E8F"
+  "909192939495969798999A9B9C9D9E9F"
+  "A0A1A2A3A4A5A6A7A8A9AAABACADAEAF"
+  "B0B1B2B3B4B5B6B7B8B9BABBBCBDBEBF"
+  "C0C1C2C3C4C5C6C7C8C9CACBCCCDCECF"
+  "D0D1D2D3D4D5D6D7D8D9DADBDCDDDEDF"
+  "E0E1E2E3E4E5E6E7E8E9EAEBECEDEEEF"
+  "F0F1F2F3F4F5F6F7F8F9FAFBFCFDFEFF";
+
+#if BYTE_ORDER == 1234
+  // Encode four bytes (loaded little-endian into a uint32) as eight upper-case ascii hex digits,
+  // returned little-endian in a uint64. Each byte is spread into a 16-bit lane, its upper nibble
+  // in the low byte and its lower nibble in the high byte. Adding 6 to a lane sets bit 4 iff its
+  // nibble is 10 or more, and those lanes get the extra 7 which takes '9' + 1 to 'A'.
+  //
+  static inline uint64 encodeFour(uint32 v) {
+    uint64 x = v;
+    uint64 nibbles;
+    x = (x | (x << 16)) & 0x0000FFFF0000FFFFULL;
+    x = (x | (x << 8)) & 0x00FF00FF00FF00FFULL;
+    nibbles = ((x >> 4) & 0x000F000F000F000FULL) | ((x & 0x000F000F000F000FULL) << 8);
+    return nibbles + ONES * '0' + (((nibbles + ONES * 0x06) >> 4) & ONES) * 7;
+  }
+#endif
+
+// Encode byteCount bytes as 2*byteCount upper-case ascii hex digits at hexDigits, four bytes at a
+// time where possible. No terminator is written.
+//
+void putHexBytes(const uint8 *bytes, size_t byteCount, char *hexDigits) {
+  size_t i = 0;
+  #if BYTE_ORDER == 1234
+    uint32 v;
+    uint64 eight;
+    for (; i + 4 <= byteCount; i += 4) {
+      memcpy(&v, bytes + i, 4);
+      eight = encodeFour(v);
+      memcpy(hexDigits + 2*i, &eight, 8);
+    }
+  #endif
+  for (; i < byteCount; i++) {
+    hexDigits[2*i] = hexDigitPairs[2*bytes[i]];
+    hexDigits[2*i + 1] = hexDigitPairs[2*bytes[i] + 1];
+  }
 }
 
 // Return the ascii hex digit representing the most significant nibble of the supplied byte.
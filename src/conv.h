@@ -33,6 +33,24 @@ extern "C" {
   //
   bool getHexByte(const char *hexDigitPair, uint8 *outputByte);
 
+  // Decode byteCount bytes from the 2*byteCount ascii hex digits pointed to by hexDigits. If any
+  // of the digits is lower-case, *lowerCase is set.
+  // Return false on success or true for illegal char, in which case *badIndex is set to the offset
+  // of the first illegal char.
+  //
+  bool getHexBytes(
+    const char *hexDigits, size_t byteCount, uint8 *outputBytes, size_t *badIndex,
+    bool *lowerCase);
+
+  // The two ascii hex digits for byte b are at hexDigitPairs[2*b] and hexDigitPairs[2*b+1].
+  //
+  extern const char hexDigitPairs[513];
+
+  // Encode byteCount bytes as 2*byteCount upper-case ascii hex digits at hexDigits. No terminator
+  // is written.
+  //
+  void putHexBytes(const uint8 *bytes, size_t byteCount, char *hexDigits);
+
   // Return the ascii hex digit representing the most significant nibble of the supplied byte.
   //
   char getHexUpperNibble(uint8 byte);
@@ -19,6 +19,10 @@
 #include <string.h>
 #include <makestuff/liberror.h>
 #include <makestuff/libbuffer.h>
+#include "private.h"
+#ifndef WIN32
+  #include <sys/mman.h>
+#endif
 
 // Initialise the promRecords structure.
 // Returns BUF_SUCCESS or BUF_NO_MEM.
@@ -41,6 +45,7 @@ DLLEXPORT(BufferStatus) bufInitialise(
   }
   self->capacity = initialSize;
   self->length = 0;
+  self->mapped = false;
 cleanup:
   return retVal;
 }
@@ -48,8 +53,14 @@ cleanup:
 // Free up any memory associated with the buffer structure.
 //
 DLLEXPORT(void) bufDestroy(struct Buffer *self) {
+  #ifndef WIN32
+    if (self->mapped) {
+      munmap(self->data, self->capacity);
+    } else
+  #endif
   free(self->data);
   self->data = NULL;
+  self->mapped = false;
   self->capacity = 0;
   self->length = 0;
   self->fill = 0;
@@ -71,6 +82,7 @@ DLLEXPORT(BufferStatus) bufDeepCopy(
   if (!dst->data) {
     // The dst needs to be allocated.
     dst->capacity = src->capacity;
+    dst->mapped = false;
     dst->data = (uint8 *)malloc(dst->capacity);
     CHECK_STATUS(
       !dst->data, BUF_NO_MEM, cleanup,
@@ -97,16 +109,19 @@ DLLEXPORT(void) bufSwap(
   const size_t tmpLength = x->length;
   const size_t tmpCapacity = x->capacity;
   const uint8 tmpFill = x->fill;
+  const bool tmpMapped = x->mapped;
 
   x->data = y->data;
   x->length = y->length;
   x->capacity = y->capacity;
   x->fill = y->fill;
+  x->mapped = y->mapped;
 
   y->data = tmpData;
   y->length = tmpLength;
   y->capacity = tmpCapacity;
   y->fill = tmpFill;
+  y->mapped = tmpMapped;
 }
 
 // Clean the buffer structure so it can be reused.
@@ -119,6 +134,48 @@ DLLEXPORT(void) bufZeroLength(struct Buffer *self) {
   }
 }
 
+// Move the buffer's data to a new block of the given capacity, returning NULL if it cannot be
+// allocated. A mapped buffer is copied into the heap here, the first time it has to grow; until
+// then it can be written in place, since the mapping is private.
+//
+static uint8 *resize(struct Buffer *self, size_t newCapacity) {
+  uint8 *ptr;
+  #ifndef WIN32
+    if (self->mapped) {
+      ptr = (uint8 *)malloc(newCapacity);
+      if (ptr) {
+        memcpy(ptr, self->data, self->capacity);
+        munmap(self->data, self->capacity);
+        self->mapped = false;
+      }
+      return ptr;
+    }
+  #endif
+  return (uint8 *)realloc(self->data, newCapacity);
+}
+
+// Make sure the buffer can hold at least the given number of bytes without reallocating. The
+// extra storage is filled, just as if the buffer had grown to that size.
+//
+DLLEXPORT(BufferStatus) bufReserve(struct Buffer *self, size_t capacity, const char **error) {
+  BufferStatus retVal = BUF_SUCCESS;
+  uint8 *ptr;
+  const uint8 *endPtr;
+  if (capacity > self->capacity) {
+    ptr = resize(self, capacity);
+    CHECK_STATUS(!ptr, BUF_NO_MEM, cleanup, "bufReserve(): Cannot reallocate memory for buffer");
+    self->data = ptr;
+    ptr = self->data + self->capacity;
+    endPtr = self->data + capacity;
+    while (ptr < endPtr) {
+      *ptr++ = self->fill;
+    }
+    self->capacity = capacity;
+  }
+cleanup:
+  return retVal;
+}
+
 // Reallocate the memory for the buffer by doubling the capacity and zeroing the extra storage.
 //
 static BufferStatus reallocate(
@@ -130,7 +187,7 @@ static BufferStatus reallocate(
   do {
     newCapacity *= 2;
   } while (blockEnd > newCapacity);
-  ptr = (uint8 *)realloc(self->data, newCapacity);
+  ptr = resize(self, newCapacity);
   CHECK_STATUS(!ptr, BUF_NO_MEM, cleanup, "Cannot reallocate memory for buffer");
   self->data = ptr;
   self->capacity = newCapacity;
@@ -286,6 +343,18 @@ cleanup:
   return retVal;
 }
 
+// Make room for count more bytes at the end of the buffer without filling them, for a caller
+// which is about to overwrite them anyway. The length is unchanged; the caller sets it once the
+// bytes are in place, and must put back the fill in any it does not overwrite.
+//
+BufferStatus bufMakeRoom(struct Buffer *self, size_t count, const char **error) {
+  BufferStatus retVal = BUF_SUCCESS;
+  const size_t blockEnd = self->length + count;
+  ENSURE_CAPACITY("bufMakeRoom()");
+cleanup:
+  return retVal;
+}
+
 // Used by bufWriteXXX() to ensure sufficient capacity for the operation.
 //
 static BufferStatus maybeReallocate(
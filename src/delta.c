@@ -0,0 +1,529 @@
+/*
+ * Copyright (C) 2009-2012 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Binary deltas between two buffer images. A delta is itself stored in a Buffer, and looks like:
+//
+//   "BUFD" baseLength newLength fill op op ... DELTA_END
+//
+// The lengths are unsigned LEB128 varints, and fill is a single byte. Each op writes the next run
+// of bytes of the new image:
+//
+//   DELTA_COPY   zigzag(baseOffset - prevCopyEnd) count   Copy count bytes from the base image
+//   DELTA_INSERT count bytes...                           Copy count literal bytes from the delta
+//   DELTA_FILL   count value                              Write count copies of value
+//
+// Copy sources are encoded relative to the end of the previous copy, because most edits to a
+// firmware image leave the surrounding code where it was, so the offset is usually zero.
+//
+#include <stdlib.h>
+#include <string.h>
+#include <makestuff/liberror.h>
+#include <makestuff/libbuffer.h>
+#include "private.h"
+
+// Granularity of the base image index. Matches shorter than this are not found.
+//
+#define BLOCK_SIZE 32
+
+// Runs of a single byte value at least this long are encoded as DELTA_FILL.
+//
+#define MIN_FILL 8
+
+// Multiplier for the polynomial rolling hash.
+//
+#define HASH_MULT 0x01000193U
+
+const uint8 bufDeltaMagic[4] = {'B', 'U', 'F', 'D'};
+
+// Append an unsigned LEB128 varint to the delta.
+//
+static BufferStatus appendVarint(struct Buffer *delta, size_t value, const char **error) {
+  uint8 bytes[10];
+  size_t i = 0;
+  while (value >= 0x80) {
+    bytes[i++] = (uint8)(value | 0x80);
+    value >>= 7;
+  }
+  bytes[i++] = (uint8)value;
+  return bufAppendBlock(delta, bytes, i, error);
+}
+
+// Append a DELTA_COPY op.
+//
+static BufferStatus appendCopy(
+  struct Buffer *delta, size_t offset, size_t count, size_t *prevCopyEnd, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS;
+  const size_t zigzag = (offset >= *prevCopyEnd)
+    ? (offset - *prevCopyEnd) << 1
+    : ((*prevCopyEnd - offset) << 1) - 1;
+  BufferStatus status = bufAppendByte(delta, DELTA_COPY, error);
+  CHECK_STATUS(status, status, cleanup, "appendCopy()");
+  status = appendVarint(delta, zigzag, error);
+  CHECK_STATUS(status, status, cleanup, "appendCopy()");
+  status = appendVarint(delta, count, error);
+  CHECK_STATUS(status, status, cleanup, "appendCopy()");
+  *prevCopyEnd = offset + count;
+cleanup:
+  return retVal;
+}
+
+// Append a DELTA_FILL op.
+//
+static BufferStatus appendFill(
+  struct Buffer *delta, uint8 value, size_t count, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS;
+  BufferStatus status = bufAppendByte(delta, DELTA_FILL, error);
+  CHECK_STATUS(status, status, cleanup, "appendFill()");
+  status = appendVarint(delta, count, error);
+  CHECK_STATUS(status, status, cleanup, "appendFill()");
+  status = bufAppendByte(delta, value, error);
+  CHECK_STATUS(status, status, cleanup, "appendFill()");
+cleanup:
+  return retVal;
+}
+
+// Append a DELTA_INSERT op.
+//
+static BufferStatus appendInsert(
+  struct Buffer *delta, const uint8 *ptr, size_t count, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS;
+  BufferStatus status = bufAppendByte(delta, DELTA_INSERT, error);
+  CHECK_STATUS(status, status, cleanup, "appendInsert()");
+  status = appendVarint(delta, count, error);
+  CHECK_STATUS(status, status, cleanup, "appendInsert()");
+  status = bufAppendBlock(delta, ptr, count, error);
+  CHECK_STATUS(status, status, cleanup, "appendInsert()");
+cleanup:
+  return retVal;
+}
+
+// Is the byte at the given offset of the new image masked out (i.e it does not matter what value
+// it ends up with)?
+//
+static inline bool isDontCare(const struct Buffer *newMask, size_t offset) {
+  return newMask && offset < newMask->length && !newMask->data[offset];
+}
+
+// Emit the bytes of the new image in [begin, end) that could not be copied from the base. Masked
+// out runs and runs of a single value become DELTA_FILL; everything else is a DELTA_INSERT.
+//
+static BufferStatus emitLiteral(
+  const struct Buffer *newData, const struct Buffer *newMask, size_t begin, size_t end,
+  struct Buffer *delta, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  const uint8 *const data = newData->data;
+  size_t insertStart = begin;
+  size_t runEnd;
+  while (begin < end) {
+    runEnd = begin;
+    if (isDontCare(newMask, begin)) {
+      while (runEnd < end && isDontCare(newMask, runEnd)) {
+        runEnd++;
+      }
+    } else {
+      while (runEnd < end && data[runEnd] == data[begin]) {
+        runEnd++;
+      }
+      if (runEnd - begin < MIN_FILL) {
+        begin = runEnd;
+        continue;
+      }
+    }
+    if (insertStart < begin) {
+      status = appendInsert(delta, data + insertStart, begin - insertStart, error);
+      CHECK_STATUS(status, status, cleanup, "emitLiteral()");
+    }
+    status = appendFill(
+      delta, isDontCare(newMask, begin) ? newData->fill : data[begin], runEnd - begin, error);
+    CHECK_STATUS(status, status, cleanup, "emitLiteral()");
+    begin = insertStart = runEnd;
+  }
+  if (insertStart < end) {
+    status = appendInsert(delta, data + insertStart, end - insertStart, error);
+    CHECK_STATUS(status, status, cleanup, "emitLiteral()");
+  }
+cleanup:
+  return retVal;
+}
+
+// Hash BLOCK_SIZE bytes from scratch.
+//
+static inline uint32 hashBlock(const uint8 *ptr) {
+  uint32 h = 0;
+  size_t i;
+  for (i = 0; i < BLOCK_SIZE; i++) {
+    h = h * HASH_MULT + ptr[i];
+  }
+  return h;
+}
+
+// Spread the hash bits before masking them down to a table index.
+//
+static inline size_t hashSlot(uint32 h, size_t tableMask) {
+  return (size_t)((h * 0x9E3779B1U) >> 7) & tableMask;
+}
+
+// Return the number of bytes starting at newData[newOffset] which match the base image starting
+// at oldData[oldOffset], treating masked-out bytes of the new image as matching anything.
+//
+static size_t matchForwards(
+  const struct Buffer *oldData, size_t oldOffset, const struct Buffer *newData,
+  const struct Buffer *newMask, size_t newOffset)
+{
+  const size_t oldAvail = oldData->length - oldOffset;
+  const size_t newAvail = newData->length - newOffset;
+  const size_t max = oldAvail < newAvail ? oldAvail : newAvail;
+  const uint8 *const o = oldData->data + oldOffset;
+  const uint8 *const n = newData->data + newOffset;
+  size_t i = 0;
+  while (i < max && (o[i] == n[i] || isDontCare(newMask, newOffset + i))) {
+    i++;
+  }
+  return i;
+}
+
+// Return the length of the run of identical bytes starting at offset, stopping at end.
+//
+static inline size_t constRun(const uint8 *data, size_t offset, size_t end) {
+  const uint8 value = data[offset];
+  size_t i = offset + 1;
+  while (i < end && data[i] == value) {
+    i++;
+  }
+  return i - offset;
+}
+
+// Encode the differences between two images as a delta. See the top of this file for the format.
+//
+DLLEXPORT(BufferStatus) bufMakeDelta(
+  const struct Buffer *oldData, const struct Buffer *newData, const struct Buffer *newMask,
+  struct Buffer *delta, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  const uint8 *const oldPtr = oldData->data;
+  const uint8 *const newPtr = newData->data;
+  const size_t oldLength = oldData->length;
+  const size_t newLength = newData->length;
+  const size_t numBlocks = oldLength / BLOCK_SIZE;
+  size_t tableSize = 1024;
+  size_t tableMask;
+  uint32 *table = NULL;
+  uint32 powHigh = 1;  // HASH_MULT^(BLOCK_SIZE-1), to roll the leading byte out of the hash
+  uint32 h = 0;
+  bool hashValid = false;
+  size_t i, pos, litStart, prevCopyEnd, cand, count;
+
+  bufZeroLength(delta);
+  status = bufAppendBlock(delta, bufDeltaMagic, sizeof(bufDeltaMagic), error);
+  CHECK_STATUS(status, status, cleanup, "bufMakeDelta()");
+  status = appendVarint(delta, oldLength, error);
+  CHECK_STATUS(status, status, cleanup, "bufMakeDelta()");
+  status = appendVarint(delta, newLength, error);
+  CHECK_STATUS(status, status, cleanup, "bufMakeDelta()");
+  status = bufAppendByte(delta, newData->fill, error);
+  CHECK_STATUS(status, status, cleanup, "bufMakeDelta()");
+
+  // Index the base image, one entry per aligned block. Entries store blockIndex + 1 so that zero
+  // means "empty". Collisions simply keep the first block.
+  //
+  while (tableSize < 2 * numBlocks) {
+    tableSize *= 2;
+  }
+  tableMask = tableSize - 1;
+  table = (uint32 *)calloc(tableSize, sizeof(uint32));
+  CHECK_STATUS(!table, BUF_NO_MEM, cleanup, "bufMakeDelta(): Cannot allocate hash table");
+  for (i = 0; i < numBlocks && i < 0xFFFFFFFFU; i++) {
+    uint32 *const slot = table + hashSlot(hashBlock(oldPtr + i * BLOCK_SIZE), tableMask);
+    if (!*slot) {
+      *slot = (uint32)(i + 1);
+    }
+  }
+  for (i = 1; i < BLOCK_SIZE; i++) {
+    powHigh *= HASH_MULT;
+  }
+
+  // Scan the new image, looking for somewhere to copy each position from
+  //
+  pos = litStart = prevCopyEnd = 0;
+  while (pos + BLOCK_SIZE <= newLength) {
+    // Long masked-out or constant runs are cheaper as fills than as copies, and skipping them
+    // here saves rolling the hash through megabytes of padding.
+    //
+    count = 0;
+    if (isDontCare(newMask, pos)) {
+      while (pos + count < newLength && isDontCare(newMask, pos + count)) {
+        count++;
+      }
+    } else if (newPtr[pos] == newPtr[pos + BLOCK_SIZE - 1]) {
+      count = constRun(newPtr, pos, newLength);
+    }
+    if (count >= BLOCK_SIZE) {
+      status = emitLiteral(newData, newMask, litStart, pos + count, delta, error);
+      CHECK_STATUS(status, status, cleanup, "bufMakeDelta()");
+      pos = litStart = pos + count;
+      hashValid = false;
+      continue;
+    }
+
+    // First see whether the bytes replaced by the pending literal were the same size as it, in
+    // which case the base probably continues where the last copy left off. Failing that, consult
+    // the index.
+    //
+    cand = prevCopyEnd + (pos - litStart);
+    count = (cand < oldLength) ? matchForwards(oldData, cand, newData, newMask, pos) : 0;
+    if (count < BLOCK_SIZE) {
+      if (!hashValid) {
+        h = hashBlock(newPtr + pos);
+        hashValid = true;
+      }
+      i = table[hashSlot(h, tableMask)];
+      if (i) {
+        cand = (i - 1) * BLOCK_SIZE;
+        if (!memcmp(oldPtr + cand, newPtr + pos, BLOCK_SIZE)) {
+          count = matchForwards(oldData, cand, newData, newMask, pos);
+        }
+      }
+    }
+    if (count >= BLOCK_SIZE) {
+      // Got a match; see how far back into the pending literal it reaches
+      //
+      while (
+        pos > litStart && cand > 0 &&
+        (oldPtr[cand - 1] == newPtr[pos - 1] || isDontCare(newMask, pos - 1)))
+      {
+        pos--;
+        cand--;
+        count++;
+      }
+      status = emitLiteral(newData, newMask, litStart, pos, delta, error);
+      CHECK_STATUS(status, status, cleanup, "bufMakeDelta()");
+      status = appendCopy(delta, cand, count, &prevCopyEnd, error);
+      CHECK_STATUS(status, status, cleanup, "bufMakeDelta()");
+      pos = litStart = pos + count;
+      hashValid = false;
+      continue;
+    }
+
+    // No match here; roll the hash on by one byte
+    //
+    if (pos + BLOCK_SIZE < newLength) {
+      h = (h - newPtr[pos] * powHigh) * HASH_MULT + newPtr[pos + BLOCK_SIZE];
+    }
+    pos++;
+  }
+  status = emitLiteral(newData, newMask, litStart, newLength, delta, error);
+  CHECK_STATUS(status, status, cleanup, "bufMakeDelta()");
+  status = bufAppendByte(delta, DELTA_END, error);
+  CHECK_STATUS(status, status, cleanup, "bufMakeDelta()");
+cleanup:
+  free(table);
+  return retVal;
+}
+
+// Read an unsigned LEB128 varint, advancing *ptr.
+// Return false on success or true if the varint is truncated or too long.
+//
+static bool readVarint(const uint8 **ptr, const uint8 *end, size_t *value) {
+  const uint8 *p = *ptr;
+  size_t result = 0;
+  uint32 shift = 0;
+  uint8 byte;
+  do {
+    if (p == end || shift >= 8 * sizeof(size_t)) {
+      return true;
+    }
+    byte = *p++;
+    result |= (size_t)(byte & 0x7F) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+  *ptr = p;
+  *value = result;
+  return false;
+}
+
+// The parsed header of a delta.
+//
+struct DeltaHeader {
+  size_t baseLength;
+  size_t newLength;
+  uint8 fill;
+  const uint8 *ops;
+};
+
+// Check every op in the delta against the bounds of the base and new images, so that the apply
+// loop can use unchecked block copies. Also work out whether the delta can be safely applied in
+// place: it can if no copy reads from a region of the base that an earlier op has overwritten,
+// i.e if every copy source is at or after its destination.
+//
+static BufferStatus validateDelta(
+  const struct Buffer *base, const struct Buffer *delta, struct DeltaHeader *hdr, bool *inPlace,
+  const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS;
+  const uint8 *p = delta->data;
+  const uint8 *const end = delta->data + delta->length;
+  size_t dst = 0, prevCopyEnd = 0, offset, count;
+  uint8 op;
+  *inPlace = true;
+  CHECK_STATUS(
+    delta->length < sizeof(bufDeltaMagic) || memcmp(p, bufDeltaMagic, sizeof(bufDeltaMagic)),
+    BUF_BAD_DELTA, cleanup,
+    "validateDelta(): Bad magic number");
+  p += sizeof(bufDeltaMagic);
+  CHECK_STATUS(
+    readVarint(&p, end, &hdr->baseLength) || readVarint(&p, end, &hdr->newLength) || p == end,
+    BUF_BAD_DELTA, cleanup,
+    "validateDelta(): Truncated header");
+  hdr->fill = *p++;
+  hdr->ops = p;
+  CHECK_STATUS(
+    hdr->baseLength != base->length, BUF_BAD_DELTA, cleanup,
+    "validateDelta(): Delta was made against a base of %lu bytes, not %lu bytes",
+    hdr->baseLength, base->length);
+  for (;;) {
+    CHECK_STATUS(
+      p == end, BUF_BAD_DELTA, cleanup,
+      "validateDelta(): Missing DELTA_END");
+    op = *p++;
+    if (op == DELTA_END) {
+      break;
+    }
+    if (op == DELTA_COPY) {
+      CHECK_STATUS(
+        readVarint(&p, end, &offset) || readVarint(&p, end, &count), BUF_BAD_DELTA, cleanup,
+        "validateDelta(): Truncated DELTA_COPY");
+      offset = (offset & 1) ? prevCopyEnd - (offset >> 1) - 1 : prevCopyEnd + (offset >> 1);
+      CHECK_STATUS(
+        offset > hdr->baseLength || count > hdr->baseLength - offset, BUF_BAD_DELTA, cleanup,
+        "validateDelta(): DELTA_COPY source out of range");
+      if (offset < dst) {
+        *inPlace = false;
+      }
+      prevCopyEnd = offset + count;
+    } else if (op == DELTA_INSERT) {
+      CHECK_STATUS(
+        readVarint(&p, end, &count) || count > (size_t)(end - p), BUF_BAD_DELTA, cleanup,
+        "validateDelta(): Truncated DELTA_INSERT");
+      p += count;
+    } else if (op == DELTA_FILL) {
+      CHECK_STATUS(
+        readVarint(&p, end, &count) || p == end, BUF_BAD_DELTA, cleanup,
+        "validateDelta(): Truncated DELTA_FILL");
+      p++;
+    } else {
+      FAIL_RET(BUF_BAD_DELTA, cleanup, "validateDelta(): Unknown op 0x%02X", op);
+    }
+    CHECK_STATUS(
+      count > hdr->newLength - dst, BUF_BAD_DELTA, cleanup,
+      "validateDelta(): Op writes beyond the end of the new image");
+    dst += count;
+  }
+  CHECK_STATUS(
+    dst != hdr->newLength, BUF_BAD_DELTA, cleanup,
+    "validateDelta(): Ops cover %lu bytes of a %lu-byte image", dst, hdr->newLength);
+cleanup:
+  return retVal;
+}
+
+// Apply the already-validated ops to dst->data, reading copies from src (which may be dst->data).
+// The caller has ensured dst has room for the whole new image.
+//
+static void applyOps(const struct DeltaHeader *hdr, const uint8 *src, uint8 *dst) {
+  const uint8 *p = hdr->ops;
+  size_t prevCopyEnd = 0, offset = 0, count = 0;
+  uint8 op;
+  while ((op = *p++) != DELTA_END) {
+    if (op == DELTA_COPY) {
+      readVarint(&p, p + 10, &offset);
+      readVarint(&p, p + 10, &count);
+      offset = (offset & 1) ? prevCopyEnd - (offset >> 1) - 1 : prevCopyEnd + (offset >> 1);
+      if (src + offset != dst) {
+        memmove(dst, src + offset, count);
+      }
+      prevCopyEnd = offset + count;
+    } else if (op == DELTA_INSERT) {
+      readVarint(&p, p + 10, &count);
+      memcpy(dst, p, count);
+      p += count;
+    } else {
+      readVarint(&p, p + 10, &count);
+      memset(dst, *p++, count);
+    }
+    dst += count;
+  }
+}
+
+// Reconstruct the new image from a base image and a delta.
+//
+DLLEXPORT(BufferStatus) bufApplyDelta(
+  struct Buffer *base, const struct Buffer *delta, struct Buffer *out, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  struct DeltaHeader hdr;
+  struct Buffer tmp = {NULL, 0, 0, 0, false};
+  bool inPlace;
+  status = validateDelta(base, delta, &hdr, &inPlace, error);
+  CHECK_STATUS(status, status, cleanup, "bufApplyDelta()");
+  if (out == base && inPlace) {
+    // Grow the buffer first if necessary, then overwrite it front-to-back
+    //
+    // The result takes the new image's fill byte, just as it would out of place; if that differs
+    // from the old one, everything past the new length must be refilled to keep the invariant.
+    // The fill is only changed once the growth has succeeded, so a failure leaves the base whole.
+    //
+    const size_t oldLength = base->length;
+    const uint8 oldFill = base->fill;
+    if (hdr.newLength > oldLength) {
+      status = bufWriteConst(base, oldLength, hdr.fill, hdr.newLength - oldLength, error);
+      CHECK_STATUS(status, status, cleanup, "bufApplyDelta()");
+    }
+    base->fill = hdr.fill;
+    applyOps(&hdr, base->data, base->data);
+    if (base->fill != oldFill) {
+      memset(base->data + hdr.newLength, base->fill, base->capacity - hdr.newLength);
+    } else if (hdr.newLength < oldLength) {
+      memset(base->data + hdr.newLength, base->fill, oldLength - hdr.newLength);
+    }
+    base->length = hdr.newLength;
+  } else {
+    // Write into a fresh buffer; if the caller wants the result in the base, swap it in at the end
+    //
+    struct Buffer *const dst = (out == base) ? &tmp : out;
+    if (dst == &tmp) {
+      status = bufInitialise(&tmp, hdr.newLength ? hdr.newLength : 1, hdr.fill, error);
+      CHECK_STATUS(status, status, cleanup, "bufApplyDelta()");
+    } else {
+      dst->fill = hdr.fill;
+      bufZeroLength(dst);
+    }
+    if (hdr.newLength) {
+      status = bufWriteConst(dst, hdr.newLength - 1, hdr.fill, 1, error);
+      CHECK_STATUS(status, status, cleanup, "bufApplyDelta()");
+    }
+    applyOps(&hdr, base->data, dst->data);
+    if (dst == &tmp) {
+      bufSwap(base, &tmp);
+    }
+  }
+cleanup:
+  bufDestroy(&tmp);
+  return retVal;
+}
@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2009-2012 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Loading the PT_LOAD segments of an ELF file. The headers are decoded by hand rather than with
+// <elf.h>, so 32- and 64-bit files of either byte order load the same way on any host.
+//
+#include <string.h>
+#include <makestuff/liberror.h>
+#include <makestuff/libbuffer.h>
+#include "private.h"
+
+#define PT_LOAD 1
+
+// Sizes of the ELF and program headers, for 32- and 64-bit files.
+//
+#define EHDR_SIZE_32 52
+#define EHDR_SIZE_64 64
+#define PHDR_SIZE_32 32
+#define PHDR_SIZE_64 56
+
+struct ElfReader {
+  const uint8 *base;
+  bool bigEndian;
+};
+
+static uint64 readField(const struct ElfReader *elf, size_t offset, uint32 size) {
+  const uint8 *const p = elf->base + offset;
+  uint64 value = 0;
+  uint32 i;
+  for (i = 0; i < size; i++) {
+    value |= (uint64)p[elf->bigEndian ? i : size - 1 - i] << (8 * (size - 1 - i));
+  }
+  return value;
+}
+
+// Read the PT_LOAD segments of an ELF file into a pair of buffers.
+//
+DLLEXPORT(BufferStatus) bufReadFromElfFile(
+  struct Buffer *destData, struct Buffer *destMask, const char *fileName, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  struct MappedFile file;
+  struct ElfReader elf;
+  bool is64;
+  uint32 word, phentsize, phnum, i;
+  uint64 phoff, ph, type, offset, paddr, filesz, memsz, end;
+
+  status = bufMapFile(&file, fileName, error);
+  CHECK_STATUS(status, status, exit, "bufReadFromElfFile()");
+  bufZeroLength(destData);
+  if (destMask) {
+    bufZeroLength(destMask);
+  }
+  CHECK_STATUS(
+    file.length < EHDR_SIZE_32 || memcmp(file.data, "\177ELF", 4) ||
+    (file.data[4] != 1 && file.data[4] != 2) || (file.data[5] != 1 && file.data[5] != 2),
+    BUF_BAD_ELF, cleanup,
+    "bufReadFromElfFile(): Not an ELF file"
+  );
+  is64 = file.data[4] == 2;
+  elf.base = file.data;
+  elf.bigEndian = file.data[5] == 2;
+  word = is64 ? 8 : 4;
+  CHECK_STATUS(
+    is64 && file.length < EHDR_SIZE_64, BUF_BAD_ELF, cleanup,
+    "bufReadFromElfFile(): Truncated ELF header"
+  );
+
+  // The program header table
+  //
+  phoff = readField(&elf, 28 + (is64 ? 4 : 0), word);
+  phentsize = (uint32)readField(&elf, is64 ? 54 : 42, 2);
+  phnum = (uint32)readField(&elf, is64 ? 56 : 44, 2);
+  CHECK_STATUS(
+    phnum && phentsize < (is64 ? PHDR_SIZE_64 : PHDR_SIZE_32), BUF_BAD_ELF, cleanup,
+    "bufReadFromElfFile(): Program headers of %lu bytes are too small", phentsize
+  );
+  CHECK_STATUS(
+    phoff > file.length || (uint64)phnum * phentsize > file.length - phoff, BUF_BAD_ELF, cleanup,
+    "bufReadFromElfFile(): Program header table is outside the file"
+  );
+
+  for (i = 0; i < phnum; i++) {
+    ph = phoff + (uint64)i * phentsize;
+    type = readField(&elf, (size_t)ph, 4);
+    if (type != PT_LOAD) {
+      continue;
+    }
+    if (is64) {
+      offset = readField(&elf, (size_t)ph + 8, 8);
+      paddr = readField(&elf, (size_t)ph + 24, 8);
+      filesz = readField(&elf, (size_t)ph + 32, 8);
+      memsz = readField(&elf, (size_t)ph + 40, 8);
+    } else {
+      offset = readField(&elf, (size_t)ph + 4, 4);
+      paddr = readField(&elf, (size_t)ph + 12, 4);
+      filesz = readField(&elf, (size_t)ph + 16, 4);
+      memsz = readField(&elf, (size_t)ph + 20, 4);
+    }
+    if (memsz < filesz) {
+      memsz = filesz;
+    }
+    CHECK_STATUS(
+      offset > file.length || filesz > file.length - offset, BUF_BAD_ELF, cleanup,
+      "bufReadFromElfFile(): Segment %lu is outside the file", i
+    );
+    CHECK_STATUS(
+      paddr > 0x100000000ULL || memsz > 0x100000000ULL - paddr, BUF_BAD_ELF, cleanup,
+      "bufReadFromElfFile(): Segment %lu extends beyond 4GiB", i
+    );
+
+    // The file bytes are data; the rest of memsz (typically .bss) is left as fill, unmasked,
+    // extending the buffers if need be
+    //
+    if (filesz) {
+      status = bufWriteBlock(
+        destData, (size_t)paddr, file.data + offset, (size_t)filesz, error);
+      CHECK_STATUS(status, status, cleanup, "bufReadFromElfFile()");
+      if (destMask) {
+        status = bufWriteConst(destMask, (size_t)paddr, 0x01, (size_t)filesz, error);
+        CHECK_STATUS(status, status, cleanup, "bufReadFromElfFile()");
+      }
+    }
+    end = paddr + memsz;
+    if (end > destData->length) {
+      status = bufWriteConst(
+        destData, destData->length, destData->fill, (size_t)(end - destData->length), error);
+      CHECK_STATUS(status, status, cleanup, "bufReadFromElfFile()");
+    }
+    if (destMask && end > destMask->length) {
+      status = bufWriteConst(
+        destMask, destMask->length, 0x00, (size_t)(end - destMask->length), error);
+      CHECK_STATUS(status, status, cleanup, "bufReadFromElfFile()");
+    }
+  }
+cleanup:
+  bufUnmapFile(&file);
+exit:
+  return retVal;
+}
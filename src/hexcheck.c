@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2009-2012 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Validation of Intel Hex files without reading their data. Every line is decoded exactly as the
+// reader decodes it, but only the addresses of the data records are kept: consecutive records are
+// gathered into runs as they go by, and the runs are sorted and merged at the end.
+//
+#include <stdlib.h>
+#include <string.h>
+#include <makestuff/liberror.h>
+#include <makestuff/libbuffer.h>
+#include "private.h"
+
+static int compareIntervals(const void *x, const void *y) {
+  const struct HexInterval *const a = (const struct HexInterval *)x;
+  const struct HexInterval *const b = (const struct HexInterval *)y;
+  return (a->address > b->address) - (a->address < b->address);
+}
+
+// Sort the runs, and merge any which overlap or touch.
+//
+static void mergeIntervals(struct Buffer *intervals) {
+  struct HexInterval *const first = (struct HexInterval *)intervals->data;
+  const size_t count = intervals->length / sizeof(struct HexInterval);
+  struct HexInterval *out = first;
+  size_t i;
+  uint64 end, outEnd;
+  if (!count) {
+    return;
+  }
+  qsort(first, count, sizeof(struct HexInterval), compareIntervals);
+  for (i = 1; i < count; i++) {
+    outEnd = (uint64)out->address + out->length;
+    if (first[i].address <= outEnd) {
+      end = (uint64)first[i].address + first[i].length;
+      if (end > outEnd) {
+        out->length = (uint32)(end - out->address);
+      }
+    } else {
+      *++out = first[i];
+    }
+  }
+  intervals->length = (size_t)(out + 1 - first) * sizeof(struct HexInterval);
+}
+
+// Check an Intel Hex file without reading its data into a buffer.
+//
+DLLEXPORT(BufferStatus) bufValidateIntelHex(
+  const char *fileName, struct Buffer *intervals, uint64 *payloadSize, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  struct MappedFile file;
+  struct HexRecord record;
+  struct HexInterval run = {0, 0};
+  uint32 lineNumber = 1;
+  uint32 segment = 0x00000000;
+  uint32 address;
+  uint64 payload = 0;
+  const char *p, *end, *eol;
+
+  status = bufMapFile(&file, fileName, error);
+  CHECK_STATUS(status, status, exit, "bufValidateIntelHex()");
+  if (intervals) {
+    bufZeroLength(intervals);
+  }
+  CHECK_STATUS(
+    !file.length, HEX_EMPTY_FILE, cleanup,
+    "bufValidateIntelHex(): Empty file!"
+  );
+  p = (const char *)file.data;
+  end = p + file.length;
+  do {
+    eol = (const char *)memchr(p, '\n', (size_t)(end - p));
+    if (!eol) {
+      eol = end;
+    }
+    status = bufDecodeRecord(p, (size_t)(eol - p), lineNumber, &segment, &record, error);
+    CHECK_STATUS(status, status, cleanup, "bufValidateIntelHex()");
+    if (record.recordType == DATA_RECORD && record.byteCount) {
+      payload += record.byteCount;
+      address = segment + record.address;
+      // Compare in 64 bits, so a run ending at 4GiB does not wrap round to meet address zero
+      if (run.length && address == (uint64)run.address + run.length) {
+        run.length += record.byteCount;
+      } else {
+        if (run.length && intervals) {
+          status = bufAppendBlock(intervals, (const uint8 *)&run, sizeof(run), error);
+          CHECK_STATUS(status, status, cleanup, "bufValidateIntelHex()");
+        }
+        run.address = address;
+        run.length = record.byteCount;
+      }
+    }
+    lineNumber++;
+    p = (eol < end) ? eol + 1 : end;
+  } while (record.recordType != EOF_RECORD && p < end);
+  CHECK_STATUS(
+    record.recordType != EOF_RECORD, HEX_MISSING_EOF, cleanup,
+    "bufValidateIntelHex(): Premature end of file - no EOF_RECORD found!"
+  );
+  if (intervals) {
+    if (run.length) {
+      status = bufAppendBlock(intervals, (const uint8 *)&run, sizeof(run), error);
+      CHECK_STATUS(status, status, cleanup, "bufValidateIntelHex()");
+    }
+    mergeIntervals(intervals);
+  }
+  if (payloadSize) {
+    *payloadSize = payload;
+  }
+cleanup:
+  bufUnmapFile(&file);
+exit:
+  return retVal;
+}
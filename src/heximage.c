@@ -0,0 +1,261 @@
+/*
+ * Copyright (C) 2009-2012 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Lazily-decoded Intel Hex images. Opening an image maps the file and builds an index of it in
+// quick mode, so only the headers of the data records are decoded up front. The address range
+// the file covers is split into PAGE_SIZE pages, and each page is decoded (using the index) the
+// first time something in it is read. A page which fails to decode is not kept, so reading it
+// again reports the same error. Which index entries touch each page is worked out once, when the
+// image is opened, so decoding a page only looks at the runs it needs.
+//
+#include <stdlib.h>
+#include <string.h>
+#include <makestuff/liberror.h>
+#include <makestuff/libbuffer.h>
+#include "private.h"
+
+#define PAGE_SIZE 4096
+
+struct HexImage {
+  struct MappedFile file;
+  struct Buffer index;
+  uint32 count;
+  uint32 baseAddress;
+  size_t numPages;
+  uint8 **pages;  // each page is PAGE_SIZE data bytes followed by PAGE_SIZE mask bytes
+  size_t *pageFirst;     // page i's entries are pageEntries[pageFirst[i] .. pageFirst[i + 1])
+  uint32 *pageEntries;   // index entries touching each page, in file order
+  uint8 fill;
+};
+
+// Work out which pages the data in the index covers.
+//
+static void findRange(struct HexImage *self) {
+  uint64 lowest = 0, highest = 0;
+  uint32 i, address, length;
+  for (i = 0; i < self->count; i++) {
+    bufHexIndexEntry(&self->index, i, &address, &length);
+    if (!i || address < lowest) {
+      lowest = address;
+    }
+    if ((uint64)address + length > highest) {
+      highest = (uint64)address + length;
+    }
+  }
+  self->baseAddress = (uint32)(lowest & ~(uint64)(PAGE_SIZE - 1));
+  self->numPages =
+    self->count ? (size_t)((highest - self->baseAddress + PAGE_SIZE - 1) / PAGE_SIZE) : 0;
+}
+
+// The first and last pages touched by index entry i, or false if it is empty.
+//
+static bool entryPages(const struct HexImage *self, uint32 i, size_t *first, size_t *last) {
+  uint32 address, length;
+  bufHexIndexEntry(&self->index, i, &address, &length);
+  if (!length) {
+    return false;
+  }
+  *first = (address - self->baseAddress) / PAGE_SIZE;
+  *last = (size_t)(((uint64)address + length - 1 - self->baseAddress) / PAGE_SIZE);
+  return true;
+}
+
+// List the entries which touch each page: count them per page, turn the counts into offsets,
+// then place each entry, going through the entries in order so each page's list stays in file
+// order.
+//
+static BufferStatus bucketEntries(struct HexImage *self, const char **error) {
+  BufferStatus retVal = BUF_SUCCESS;
+  size_t first, last, p, total = 0;
+  uint32 i;
+  self->pageFirst = (size_t *)calloc(self->numPages + 1, sizeof(size_t));
+  CHECK_STATUS(
+    !self->pageFirst, BUF_NO_MEM, cleanup,
+    "bucketEntries(): Cannot allocate page lists");
+  for (i = 0; i < self->count; i++) {
+    if (entryPages(self, i, &first, &last)) {
+      for (p = first; p <= last; p++) {
+        self->pageFirst[p + 1]++;
+      }
+    }
+  }
+  for (p = 0; p < self->numPages; p++) {
+    total += self->pageFirst[p + 1];
+    self->pageFirst[p + 1] = total;
+  }
+  self->pageEntries = (uint32 *)malloc((total ? total : 1) * sizeof(uint32));
+  CHECK_STATUS(
+    !self->pageEntries, BUF_NO_MEM, cleanup,
+    "bucketEntries(): Cannot allocate page lists");
+
+  // Use pageFirst[p] as page p's insertion point; afterwards each has moved up by one page
+  //
+  for (i = 0; i < self->count; i++) {
+    if (entryPages(self, i, &first, &last)) {
+      for (p = first; p <= last; p++) {
+        self->pageEntries[self->pageFirst[p]++] = i;
+      }
+    }
+  }
+  for (p = self->numPages; p > 0; p--) {
+    self->pageFirst[p] = self->pageFirst[p - 1];
+  }
+  self->pageFirst[0] = 0;
+cleanup:
+  return retVal;
+}
+
+// Decode page i, if that has not already been done.
+//
+static BufferStatus loadPage(struct HexImage *self, size_t i, const char **error) {
+  BufferStatus retVal = BUF_SUCCESS, status;
+  uint8 *page;
+  if (self->pages[i]) {
+    return BUF_SUCCESS;
+  }
+  page = (uint8 *)malloc(2 * PAGE_SIZE);
+  CHECK_STATUS(!page, BUF_NO_MEM, cleanup, "loadPage(): Cannot allocate page");
+  memset(page, self->fill, PAGE_SIZE);
+  memset(page + PAGE_SIZE, 0x00, PAGE_SIZE);
+  status = bufHexIndexReadEntries(
+    &self->index, self->pageEntries + self->pageFirst[i],
+    self->pageFirst[i + 1] - self->pageFirst[i], (const char *)self->file.data,
+    (const char *)self->file.data + self->file.length,
+    self->baseAddress + (uint32)(i * PAGE_SIZE), PAGE_SIZE, page, page + PAGE_SIZE, error);
+  CHECK_STATUS(status, status, cleanup, "loadPage()");
+  self->pages[i] = page;
+  page = NULL;
+cleanup:
+  free(page);
+  return retVal;
+}
+
+// Open an Intel Hex file for lazy decoding.
+//
+DLLEXPORT(BufferStatus) bufHexImageOpen(
+  struct HexImage **image, const char *fileName, uint8 fill, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  struct HexImage *self = (struct HexImage *)calloc(1, sizeof(struct HexImage));
+  *image = NULL;
+  CHECK_STATUS(!self, BUF_NO_MEM, exit, "bufHexImageOpen(): Cannot allocate image");
+  self->fill = fill;
+  status = bufInitialise(&self->index, 4096, 0x00, error);
+  CHECK_STATUS(status, status, cleanup, "bufHexImageOpen()");
+  status = bufMapFile(&self->file, fileName, error);
+  CHECK_STATUS(status, status, cleanup, "bufHexImageOpen()");
+  status = bufHexIndexBuildMapped(
+    (const char *)self->file.data, (const char *)self->file.data + self->file.length, true,
+    &self->index, error);
+  CHECK_STATUS(status, status, cleanup, "bufHexImageOpen()");
+  status = bufHexIndexCheck(&self->index, self->file.length, &self->count, error);
+  CHECK_STATUS(status, status, cleanup, "bufHexImageOpen()");
+  findRange(self);
+  if (self->numPages) {
+    self->pages = (uint8 **)calloc(self->numPages, sizeof(uint8 *));
+    CHECK_STATUS(
+      !self->pages, BUF_NO_MEM, cleanup,
+      "bufHexImageOpen(): Cannot allocate page table");
+    status = bucketEntries(self, error);
+    CHECK_STATUS(status, status, cleanup, "bufHexImageOpen()");
+  }
+  *image = self;
+  self = NULL;
+cleanup:
+  bufHexImageClose(self);
+exit:
+  return retVal;
+}
+
+// Get the range of addresses an image holds data in, to the nearest page.
+//
+DLLEXPORT(void) bufHexImageRange(
+  const struct HexImage *self, uint32 *baseAddress, uint64 *length)
+{
+  *baseAddress = self->baseAddress;
+  *length = (uint64)self->numPages * PAGE_SIZE;
+}
+
+// Read a range of addresses from an image, decoding any pages not already decoded.
+//
+DLLEXPORT(BufferStatus) bufHexImageRead(
+  struct HexImage *self, uint32 address, size_t length, uint8 *data, uint8 *mask,
+  const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  const uint64 imageEnd = self->baseAddress + (uint64)self->numPages * PAGE_SIZE;
+  uint64 current = address;
+  const uint64 readEnd = current + length;
+  uint64 next;
+  size_t i, offset, count;
+  while (current < readEnd) {
+    offset = (size_t)(current - address);
+    if (current < self->baseAddress || current >= imageEnd) {
+      // Outside the image there is no data
+      next = (current < self->baseAddress) ? self->baseAddress : readEnd;
+      if (next > readEnd) {
+        next = readEnd;
+      }
+      count = (size_t)(next - current);
+      memset(data + offset, self->fill, count);
+      if (mask) {
+        memset(mask + offset, 0x00, count);
+      }
+    } else {
+      i = (size_t)((current - self->baseAddress) / PAGE_SIZE);
+      status = loadPage(self, i, error);
+      CHECK_STATUS(status, status, cleanup, "bufHexImageRead()");
+      next = self->baseAddress + (uint64)(i + 1) * PAGE_SIZE;
+      if (next > readEnd) {
+        next = readEnd;
+      }
+      count = (size_t)(next - current);
+      memcpy(
+        data + offset, self->pages[i] + (current - self->baseAddress) % PAGE_SIZE, count);
+      if (mask) {
+        memcpy(
+          mask + offset, self->pages[i] + PAGE_SIZE + (current - self->baseAddress) % PAGE_SIZE,
+          count);
+      }
+    }
+    current = next;
+  }
+cleanup:
+  return retVal;
+}
+
+// Release an image, and everything it decoded.
+//
+DLLEXPORT(void) bufHexImageClose(struct HexImage *self) {
+  size_t i;
+  if (!self) {
+    return;
+  }
+  if (self->pages) {
+    for (i = 0; i < self->numPages; i++) {
+      free(self->pages[i]);
+    }
+    free(self->pages);
+  }
+  free(self->pageFirst);
+  free(self->pageEntries);
+  bufUnmapFile(&self->file);
+  if (self->index.data) {
+    bufDestroy(&self->index);
+  }
+  free(self);
+}
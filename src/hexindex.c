@@ -0,0 +1,384 @@
+/*
+ * Copyright (C) 2009-2012 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Random access into large Intel Hex files. An index is stored in a Buffer, and looks like:
+//
+//   "BUFX" fileSize count entry entry ...
+//
+// Each entry describes a run of data records whose addresses follow on from one another, and
+// says where in the file the run starts:
+//
+//   address length offset lineNumber segment
+//
+// All fields are little-endian; fileSize and offset are 64 bits, the rest 32 bits. Runs are cut
+// at RUN_MAX bytes, so reading a few bytes never means decoding more than a few hundred lines.
+// The entries are in file order, so where records overlap, later entries win, as in the reader.
+//
+#include <string.h>
+#include <makestuff/liberror.h>
+#include <makestuff/libbuffer.h>
+#include "conv.h"
+#include "private.h"
+
+// The most data bytes one index entry may cover.
+//
+#define RUN_MAX 4096
+
+#define HEADER_SIZE 16
+#define ENTRY_SIZE 24
+
+static const uint8 indexMagic[4] = {'B', 'U', 'F', 'X'};
+
+struct IndexEntry {
+  uint32 address;
+  uint32 length;
+  uint64 offset;
+  uint32 lineNumber;
+  uint32 segment;
+};
+
+static uint32 readLongLE(const uint8 *p) {
+  return (uint32)p[0] | ((uint32)p[1] << 8) | ((uint32)p[2] << 16) | ((uint32)p[3] << 24);
+}
+
+static uint64 readQuadLE(const uint8 *p) {
+  return readLongLE(p) | ((uint64)readLongLE(p + 4) << 32);
+}
+
+static BufferStatus appendEntry(
+  struct Buffer *index, const struct IndexEntry *entry, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  status = bufAppendLongLE(index, entry->address, error);
+  CHECK_STATUS(status, status, cleanup, "appendEntry()");
+  status = bufAppendLongLE(index, entry->length, error);
+  CHECK_STATUS(status, status, cleanup, "appendEntry()");
+  status = bufAppendLongLE(index, (uint32)entry->offset, error);
+  CHECK_STATUS(status, status, cleanup, "appendEntry()");
+  status = bufAppendLongLE(index, (uint32)(entry->offset >> 32), error);
+  CHECK_STATUS(status, status, cleanup, "appendEntry()");
+  status = bufAppendLongLE(index, entry->lineNumber, error);
+  CHECK_STATUS(status, status, cleanup, "appendEntry()");
+  status = bufAppendLongLE(index, entry->segment, error);
+  CHECK_STATUS(status, status, cleanup, "appendEntry()");
+cleanup:
+  return retVal;
+}
+
+// Build an index of the Intel Hex text in [start, end), after the header has been written. In
+// quick mode only the header of each data record is decoded, leaving its data and checksum to be
+// checked when it is read; every other record is checked in full.
+//
+static BufferStatus buildIndex(
+  const char *start, const char *end, bool quick, struct Buffer *index, uint32 *count,
+  const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  struct HexRecord record;
+  struct IndexEntry run = {0, 0, 0, 0, 0};
+  uint32 lineNumber = 1;
+  uint32 segment = 0x00000000;
+  uint32 address;
+  uint8 header[4];
+  size_t badIndex;
+  bool lowerCase;
+  const char *p = start;
+  const char *eol;
+  *count = 0;
+  do {
+    eol = (const char *)memchr(p, '\n', (size_t)(end - p));
+    if (!eol) {
+      eol = end;
+    }
+    if (
+      quick && eol - p >= 11 && *p == ':' &&
+      !getHexBytes(p + 1, 4, header, &badIndex, &lowerCase) && header[3] == DATA_RECORD)
+    {
+      record.recordType = DATA_RECORD;
+      record.byteCount = header[0];
+      record.address = (uint16)((header[1] << 8) | header[2]);
+    } else {
+      status = bufDecodeRecord(p, (size_t)(eol - p), lineNumber, &segment, &record, error);
+      CHECK_STATUS(status, status, cleanup, "buildIndex()");
+    }
+    if (record.recordType == DATA_RECORD && record.byteCount) {
+      address = segment + record.address;
+      if (run.length && address == run.address + run.length && run.length < RUN_MAX) {
+        run.length += record.byteCount;
+      } else {
+        if (run.length) {
+          status = appendEntry(index, &run, error);
+          CHECK_STATUS(status, status, cleanup, "buildIndex()");
+          (*count)++;
+        }
+        run.address = address;
+        run.length = record.byteCount;
+        run.offset = (uint64)(p - start);
+        run.lineNumber = lineNumber;
+        run.segment = segment;
+      }
+    }
+    lineNumber++;
+    p = (eol < end) ? eol + 1 : end;
+  } while (record.recordType != EOF_RECORD && p < end);
+  CHECK_STATUS(
+    record.recordType != EOF_RECORD, HEX_MISSING_EOF, cleanup,
+    "buildIndex(): Premature end of file - no EOF_RECORD found!"
+  );
+  if (run.length) {
+    status = appendEntry(index, &run, error);
+    CHECK_STATUS(status, status, cleanup, "buildIndex()");
+    (*count)++;
+  }
+cleanup:
+  return retVal;
+}
+
+// Build an index of Intel Hex text already in memory.
+//
+BufferStatus bufHexIndexBuildMapped(
+  const char *start, const char *end, bool quick, struct Buffer *index, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  uint32 count;
+  bufZeroLength(index);
+  CHECK_STATUS(
+    start == end, HEX_EMPTY_FILE, cleanup,
+    "bufHexIndexBuildMapped(): Empty file!"
+  );
+
+  // The header, with the entry count filled in at the end
+  //
+  status = bufAppendBlock(index, indexMagic, 4, error);
+  CHECK_STATUS(status, status, cleanup, "bufHexIndexBuildMapped()");
+  status = bufAppendLongLE(index, (uint32)(end - start), error);
+  CHECK_STATUS(status, status, cleanup, "bufHexIndexBuildMapped()");
+  status = bufAppendLongLE(index, (uint32)((uint64)(end - start) >> 32), error);
+  CHECK_STATUS(status, status, cleanup, "bufHexIndexBuildMapped()");
+  status = bufAppendLongLE(index, 0, error);
+  CHECK_STATUS(status, status, cleanup, "bufHexIndexBuildMapped()");
+  status = buildIndex(start, end, quick, index, &count, error);
+  CHECK_STATUS(status, status, cleanup, "bufHexIndexBuildMapped()");
+  status = bufWriteLongLE(index, 12, count, error);
+  CHECK_STATUS(status, status, cleanup, "bufHexIndexBuildMapped()");
+cleanup:
+  return retVal;
+}
+
+// Build an index of an Intel Hex file.
+//
+DLLEXPORT(BufferStatus) bufHexIndexBuild(
+  const char *fileName, struct Buffer *index, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  struct MappedFile file;
+  status = bufMapFile(&file, fileName, error);
+  CHECK_STATUS(status, status, exit, "bufHexIndexBuild()");
+  status = bufHexIndexBuildMapped(
+    (const char *)file.data, (const char *)file.data + file.length, false, index, error);
+  CHECK_STATUS(status, status, cleanup, "bufHexIndexBuild()");
+cleanup:
+  bufUnmapFile(&file);
+exit:
+  return retVal;
+}
+
+// Decode the lines of one run, copying whatever falls in [address, address + length) into the
+// data and mask arrays.
+//
+static BufferStatus readRun(
+  const struct IndexEntry *run, const char *start, const char *end, uint32 address,
+  size_t length, uint8 *data, uint8 *mask, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  struct HexRecord record;
+  uint32 lineNumber = run->lineNumber;
+  uint32 segment = run->segment;
+  uint32 remaining = run->length;
+  const uint64 readEnd = (uint64)address + length;
+  uint64 recordStart, recordEnd, from, to;
+  const char *p = start + run->offset;
+  const char *eol;
+  while (remaining) {
+    CHECK_STATUS(
+      p >= end, HEX_BAD_INDEX, cleanup,
+      "readRun(): The index does not match the file at line %lu", lineNumber
+    );
+    eol = (const char *)memchr(p, '\n', (size_t)(end - p));
+    if (!eol) {
+      eol = end;
+    }
+    status = bufDecodeRecord(p, (size_t)(eol - p), lineNumber, &segment, &record, error);
+    CHECK_STATUS(status, status, cleanup, "readRun()");
+    if (record.recordType == DATA_RECORD && record.byteCount) {
+      CHECK_STATUS(
+        record.byteCount > remaining, HEX_BAD_INDEX, cleanup,
+        "readRun(): The index does not match the file at line %lu", lineNumber
+      );
+      recordStart = (uint64)segment + record.address;
+      recordEnd = recordStart + record.byteCount;
+      if (recordStart >= readEnd) {
+        break;  // runs ascend, so nothing further on can be wanted
+      }
+      from = (recordStart > address) ? recordStart : address;
+      to = (recordEnd < readEnd) ? recordEnd : readEnd;
+      if (from < to) {
+        memcpy(data + (from - address), record.data + (from - recordStart), (size_t)(to - from));
+        if (mask) {
+          memset(mask + (from - address), 0x01, (size_t)(to - from));
+        }
+      }
+      remaining -= record.byteCount;
+    }
+    lineNumber++;
+    p = (eol < end) ? eol + 1 : end;
+  }
+cleanup:
+  return retVal;
+}
+
+// Check that an index is well-formed and belongs to text of the given length, returning the
+// number of entries.
+//
+BufferStatus bufHexIndexCheck(
+  const struct Buffer *index, size_t textLength, uint32 *count, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS;
+  CHECK_STATUS(
+    index->length < HEADER_SIZE || memcmp(index->data, indexMagic, 4), HEX_BAD_INDEX, cleanup,
+    "bufHexIndexCheck(): Not an index"
+  );
+  *count = readLongLE(index->data + 12);
+  CHECK_STATUS(
+    index->length != HEADER_SIZE + (uint64)*count * ENTRY_SIZE, HEX_BAD_INDEX, cleanup,
+    "bufHexIndexCheck(): The index is truncated"
+  );
+  CHECK_STATUS(
+    readQuadLE(index->data + 4) != (uint64)textLength, HEX_BAD_INDEX, cleanup,
+    "bufHexIndexCheck(): The index was built from a different file"
+  );
+cleanup:
+  return retVal;
+}
+
+// Get the address range covered by entry i of a checked index.
+//
+void bufHexIndexEntry(
+  const struct Buffer *index, uint32 i, uint32 *address, uint32 *length)
+{
+  const uint8 *const entry = index->data + HEADER_SIZE + (size_t)i * ENTRY_SIZE;
+  *address = readLongLE(entry);
+  *length = readLongLE(entry + 4);
+}
+
+// Decode whatever entry i of a checked index holds in [address, address + length).
+//
+static BufferStatus readEntry(
+  const struct Buffer *index, uint32 i, const char *start, const char *end, uint32 address,
+  size_t length, uint8 *data, uint8 *mask, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  struct IndexEntry run;
+  const uint8 *const entry = index->data + HEADER_SIZE + (size_t)i * ENTRY_SIZE;
+  const uint64 readEnd = (uint64)address + length;
+  run.address = readLongLE(entry);
+  run.length = readLongLE(entry + 4);
+  if (run.address >= readEnd || (uint64)run.address + run.length <= address) {
+    goto cleanup;
+  }
+  run.offset = readQuadLE(entry + 8);
+  run.lineNumber = readLongLE(entry + 16);
+  run.segment = readLongLE(entry + 20);
+  CHECK_STATUS(
+    run.offset >= (uint64)(end - start), HEX_BAD_INDEX, cleanup,
+    "readEntry(): The index does not match the file"
+  );
+  status = readRun(&run, start, end, address, length, data, mask, error);
+  CHECK_STATUS(status, status, cleanup, "readEntry()");
+cleanup:
+  return retVal;
+}
+
+// Decode the data in [address, address + length) from Intel Hex text already in memory, using a
+// checked index of it. Bytes with data are written to the data array and marked in the mask
+// array; the rest are left alone.
+//
+BufferStatus bufHexIndexReadMapped(
+  const struct Buffer *index, uint32 count, const char *start, const char *end, uint32 address,
+  size_t length, uint8 *data, uint8 *mask, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  uint32 i;
+  for (i = 0; i < count; i++) {
+    status = readEntry(index, i, start, end, address, length, data, mask, error);
+    CHECK_STATUS(status, status, cleanup, "bufHexIndexReadMapped()");
+  }
+cleanup:
+  return retVal;
+}
+
+// As bufHexIndexReadMapped(), but only the listed entries (which must be in ascending order, so
+// later runs overwrite earlier ones as they do in the file) are considered.
+//
+BufferStatus bufHexIndexReadEntries(
+  const struct Buffer *index, const uint32 *entries, size_t numEntries, const char *start,
+  const char *end, uint32 address, size_t length, uint8 *data, uint8 *mask, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  size_t i;
+  for (i = 0; i < numEntries; i++) {
+    status = readEntry(index, entries[i], start, end, address, length, data, mask, error);
+    CHECK_STATUS(status, status, cleanup, "bufHexIndexReadEntries()");
+  }
+cleanup:
+  return retVal;
+}
+
+// Read a range of addresses from an Intel Hex file, using its index.
+//
+DLLEXPORT(BufferStatus) bufHexIndexRead(
+  const struct Buffer *index, const char *fileName, uint32 address, size_t length,
+  struct Buffer *destData, struct Buffer *destMask, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  struct MappedFile file;
+  uint32 count;
+
+  status = bufMapFile(&file, fileName, error);
+  CHECK_STATUS(status, status, exit, "bufHexIndexRead()");
+  status = bufHexIndexCheck(index, file.length, &count, error);
+  CHECK_STATUS(status, status, cleanup, "bufHexIndexRead()");
+
+  // Start with nothing, then decode each run which overlaps the range
+  //
+  bufZeroLength(destData);
+  status = bufWriteConst(destData, 0, destData->fill, length, error);
+  CHECK_STATUS(status, status, cleanup, "bufHexIndexRead()");
+  if (destMask) {
+    bufZeroLength(destMask);
+    status = bufWriteConst(destMask, 0, 0x00, length, error);
+    CHECK_STATUS(status, status, cleanup, "bufHexIndexRead()");
+  }
+  status = bufHexIndexReadMapped(
+    index, count, (const char *)file.data, (const char *)file.data + file.length, address,
+    length, destData->data, destMask ? destMask->data : NULL, error);
+  CHECK_STATUS(status, status, cleanup, "bufHexIndexRead()");
+cleanup:
+  bufUnmapFile(&file);
+exit:
+  return retVal;
+}
@@ -23,194 +23,346 @@
 // file, there's no way to tell which runs of zeros must be zero, and which are "don't care".
 //
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <makestuff/liberror.h>
 #include <makestuff/libbuffer.h>
 #include "conv.h"
 #include "private.h"
 
-#define LINE_MAX 512
-
-typedef enum {
-  DATA_RECORD = 0x00,
-  EOF_RECORD,
-  EXT_SEG_RECORD,
-  START_SEG_RECORD,
-  EXT_LIN_RECORD,
-  START_LIN_RECORD
-} RecordType;
+// Decode up to byteCount bytes of hex digits from the available chars, stopping early at the
+// first junk digit or the end of the line. If any digit is lower-case, *lowerCase is set.
+// Returns the number of bytes successfully decoded.
+//
+static size_t decodeDigits(
+  const char *p, size_t available, size_t byteCount, uint8 *outputBytes, bool *lowerCase)
+{
+  size_t count = (available / 2 < byteCount) ? available / 2 : byteCount;
+  size_t badIndex;
+  if (getHexBytes(p, count, outputBytes, &badIndex, lowerCase)) {
+    count = badIndex / 2;
+  }
+  return count;
+}
 
-// Process a single Intel hex record.
-//   Data record:   ":CCAAAA00DD..SS"
-//   EOF record:    ":00000001FF"
-//   ExtSeg record: ":02000002AAAASS"
+// Decode and validate a single Intel hex record, given as a line of lineLength chars (not
+// necessarily NUL-terminated).
+//   Data record:     ":CCAAAA00DD..SS"
+//   EOF record:      ":00000001FF"
+//   ExtSeg record:   ":02000002SSSSCC"
+//   StartSeg record: ":04000003CCCCIIIICC"
+//   ExtLin record:   ":02000004UUUUCC"
+//   StartLin record: ":04000005EEEEEEEECC"
 //
-BufferStatus bufProcessLine(
-  const char *sourceLine, uint32 lineNumber, struct Buffer *destData, struct Buffer *destMask,
-  uint32 *segment, uint8 *recordType, const char **error)
+// The ExtSeg and ExtLin records both set *segment, the linear address which subsequent data
+// record addresses are relative to. The start address records are checked and then ignored.
+//
+// The line is validated as it is decoded. The digits must be upper-case and the checksum must be
+// followed by the end of the line; anything else is HEX_CORRUPT_LINE.
+//
+BufferStatus bufDecodeRecord(
+  const char *sourceLine, size_t lineLength, uint32 lineNumber, uint32 *segment,
+  struct HexRecord *record, const char **error)
 {
+  static const BufferStatus headerJunk[] = {
+    HEX_JUNK_BYTE_COUNT, HEX_JUNK_ADDR_MSB, HEX_JUNK_ADDR_LSB, HEX_JUNK_REC_TYPE
+  };
+  static const char *const headerName[] = {
+    "byte count", "address MSB", "address LSB", "record type"
+  };
   BufferStatus retVal = BUF_SUCCESS;
-  char reconstructedLine[LINE_MAX];
-  uint8 thisByte;
+  uint8 header[4];  // byte count, address MSB, address LSB, record type
   uint8 i, byteCount;
   uint16 address;
-  uint8 dataBytes[LINE_MAX/2];
+  uint8 *const dataBytes = record->data;  // data bytes, then checksum
   uint8 readChecksum;
   uint8 calculatedChecksum;
+  bool lowerCase = false;
+  size_t count;
   const char *p;
-  BufferStatus status;
+  const char *const end = sourceLine + lineLength;
 
   p = sourceLine;
   // Read the start code - must be ':'
   //
   CHECK_STATUS(
-    *p++ != ':', HEX_JUNK_START_CODE, cleanup,
-    "bufProcessLine(): Junk start code at line %lu", lineNumber
+    p == end || *p++ != ':', HEX_JUNK_START_CODE, cleanup,
+    "bufDecodeRecord(): Junk start code at line %lu", lineNumber
   );
 
-  // Read the byte count
+  // Read the byte count, address and record type
   //
+  count = decodeDigits(p, (size_t)(end - p), 4, header, &lowerCase);
   CHECK_STATUS(
-    getHexByte(p, &byteCount), HEX_JUNK_BYTE_COUNT, cleanup,
-    "bufProcessLine(): Junk byte count at line %lu", lineNumber
+    count < 4, headerJunk[count], cleanup,
+    "bufDecodeRecord(): Junk %s at line %lu", headerName[count], lineNumber
   );
-  p += 2;
-  calculatedChecksum = byteCount;
+  p += 8;
+  record->byteCount = byteCount = header[0];
+  record->address = address = (uint16)((header[1] << 8) | header[2]);
+  record->recordType = header[3];
 
-  // Read the MSB of the address
+  // Read the data and the checksum
   //
+  count = decodeDigits(p, (size_t)(end - p), (size_t)byteCount + 1, dataBytes, &lowerCase);
   CHECK_STATUS(
-    getHexByte(p, &thisByte), HEX_JUNK_ADDR_MSB, cleanup,
-    "bufProcessLine(): Junk address MSB at line %lu", lineNumber
+    count < byteCount, HEX_JUNK_DATA_BYTE, cleanup,
+    "bufDecodeRecord(): Junk data byte %d at line %lu", (int)count, lineNumber
   );
-  p += 2;
-  address = (uint16)(thisByte << 8);
-  calculatedChecksum = (uint8)(calculatedChecksum + thisByte);
-
-  // Read the LSB of the address
-  //
   CHECK_STATUS(
-    getHexByte(p, &thisByte), HEX_JUNK_ADDR_LSB, cleanup,
-    "bufProcessLine(): Junk address LSB at line %lu", lineNumber
+    count == byteCount, HEX_JUNK_CHECKSUM, cleanup,
+    "bufDecodeRecord(): Junk checksum at line %lu", lineNumber
   );
-  p += 2;
-  address = (uint16)(address | thisByte);
-  calculatedChecksum = (uint8)(calculatedChecksum + thisByte);
+  p += 2 * ((size_t)byteCount + 1);
+  readChecksum = dataBytes[byteCount];
 
-  // Read the record type
-  //
-  CHECK_STATUS(
-    getHexByte(p, recordType), HEX_JUNK_REC_TYPE, cleanup,
-    "bufProcessLine(): Junk record type at line %lu", lineNumber
-  );
-  p += 2;
-  calculatedChecksum = (uint8)(calculatedChecksum + *recordType);
-
-  // Read the data
+  // Calculate the two's complement of the checksum
   //
+  calculatedChecksum = (uint8)(header[0] + header[1] + header[2] + header[3]);
   for (i = 0; i < byteCount; i++) {
-    CHECK_STATUS(
-      getHexByte(p, &thisByte), HEX_JUNK_DATA_BYTE, cleanup,
-      "bufProcessLine(): Junk data byte %d at line %lu", i, lineNumber
-    );
-    p += 2;
-    dataBytes[i] = thisByte;
-    calculatedChecksum = (uint8)(calculatedChecksum + thisByte);
+    calculatedChecksum = (uint8)(calculatedChecksum + dataBytes[i]);
   }
-
-  // Read the checksum
-  //
-  CHECK_STATUS(
-    getHexByte(p, &readChecksum), HEX_JUNK_CHECKSUM, cleanup,
-    "bufProcessLine(): Junk checksum at line %lu", lineNumber
-  );
-
-  // Calculate the two's complement of the checksum
-  //
   calculatedChecksum = (uint8)(256 - calculatedChecksum);
   CHECK_STATUS(
     readChecksum != calculatedChecksum, HEX_BAD_CHECKSUM, cleanup,
-    "bufProcessLine(): Read checksum 0x%02X differs from calculated checksum 0x%02X at line %lu",
+    "bufDecodeRecord(): Read checksum 0x%02X differs from calculated checksum 0x%02X at line %lu",
     readChecksum, calculatedChecksum, lineNumber
   );
 
-  // Recreate the input data
+  // Only upper-case digits and a line terminator are acceptable
   //
-  sprintf(reconstructedLine, ":%02X%04X%02X", byteCount, address, *recordType);
-  for (i = 0; i < byteCount; i++) {
-    sprintf(reconstructedLine + 9 + 2*i, "%02X", dataBytes[i]);
-  }
-  sprintf(reconstructedLine + 9 + byteCount*2, "%02X", readChecksum);
-  while (*p && *p != 0x0D && *p != 0x0A) {
-    p++;
-  }
   CHECK_STATUS(
-    strncmp(sourceLine, reconstructedLine, (size_t)(p - sourceLine)), HEX_CORRUPT_LINE, cleanup,
-    "bufProcessLine(): Some corruption detected at line %lu - some junk at the end of the line perhaps?",
+    lowerCase || (p < end && *p && *p != 0x0D && *p != 0x0A), HEX_CORRUPT_LINE, cleanup,
+    "bufDecodeRecord(): Some corruption detected at line %lu - some junk at the end of the line perhaps?",
     lineNumber
   );
-  CHECK_STATUS(
-    *recordType == START_SEG_RECORD, HEX_BAD_REC_TYPE, cleanup,
-    "bufProcessLine(): Record type START_SEG_RECORD not supported at line %lu", lineNumber
-  );
-  CHECK_STATUS(
-    *recordType == EXT_LIN_RECORD, HEX_BAD_REC_TYPE, cleanup,
-    "bufProcessLine(): Record type EXT_LIN_RECORD, not supported at line %lu", lineNumber
-  );
-  CHECK_STATUS(
-    *recordType == START_LIN_RECORD, HEX_BAD_REC_TYPE, cleanup,
-    "bufProcessLine(): Record type START_LIN_RECORD, not supported at line %lu", lineNumber
-  );
-  if (*recordType == DATA_RECORD) {
-    // Write into the binary buffer
-    //
-    status = bufWriteBlock(destData, *segment + address, dataBytes, byteCount, error);
-    CHECK_STATUS(status, status, cleanup, "bufProcessLine()");
-    if (destMask) {
-      status = bufWriteConst(destMask, *segment + address, 0x01, byteCount, error);
-      CHECK_STATUS(status, status, cleanup, "bufProcessLine()");
-    }
-    retVal = BUF_SUCCESS;
-  } else if (*recordType == EOF_RECORD) {
+  if (record->recordType == DATA_RECORD || record->recordType == EOF_RECORD) {
     retVal = BUF_SUCCESS;
-  } else if (*recordType == EXT_SEG_RECORD) {
+  } else if (record->recordType == EXT_SEG_RECORD) {
     CHECK_STATUS(
       address != 0x0000 || byteCount != 2, HEX_BAD_EXT_SEG, cleanup,
-      "bufProcessLine(): For record type EXT_SEG_RECORD, address must be 0x0000 and byteCount must be 0x02 at line %lu",
+      "bufDecodeRecord(): For record type EXT_SEG_RECORD, address must be 0x0000 and byteCount must be 0x02 at line %lu",
       lineNumber
     );
     *segment = (uint32)(((dataBytes[0] << 8) + dataBytes[1]) << 4);
     retVal = BUF_SUCCESS;
+  } else if (record->recordType == EXT_LIN_RECORD) {
+    CHECK_STATUS(
+      address != 0x0000 || byteCount != 2, HEX_BAD_EXT_LIN, cleanup,
+      "bufDecodeRecord(): For record type EXT_LIN_RECORD, address must be 0x0000 and byteCount must be 0x02 at line %lu",
+      lineNumber
+    );
+    *segment = (uint32)((dataBytes[0] << 24) | (dataBytes[1] << 16));
+    retVal = BUF_SUCCESS;
+  } else if (record->recordType == START_SEG_RECORD || record->recordType == START_LIN_RECORD) {
+    CHECK_STATUS(
+      address != 0x0000 || byteCount != 4, HEX_BAD_REC_TYPE, cleanup,
+      "bufDecodeRecord(): For start address records, address must be 0x0000 and byteCount must be 0x04 at line %lu",
+      lineNumber
+    );
+    retVal = BUF_SUCCESS;
   } else {
     FAIL_RET(
       HEX_BAD_REC_TYPE, cleanup,
-      "bufProcessLine(): Record type 0x%02X not supported at line %lu", *recordType, lineNumber
+      "bufDecodeRecord(): Record type 0x%02X not supported at line %lu", record->recordType,
+      lineNumber
     );
   }
 cleanup:
   return retVal;
 }
 
-// Read Intel Hex records from a file.
-// TODO: Handle read errors
+// Write the data from a decoded data record into the buffers, at its linear address less
+// baseAddress. If run is not NULL, the mask bytes of consecutive records are gathered into it,
+// to be written with one call to bufFlushMaskRun().
 //
-DLLEXPORT(BufferStatus) bufReadFromIntelHexFile(
-  struct Buffer *destData, struct Buffer *destMask, const char *fileName, const char **error)
+BufferStatus bufStoreRecord(
+  const struct HexRecord *record, uint32 lineNumber, struct Buffer *destData,
+  struct Buffer *destMask, uint32 segment, uint32 baseAddress, struct MaskRun *run,
+  const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  size_t offset = (size_t)segment + record->address;
+  CHECK_STATUS(
+    offset < baseAddress, HEX_BAD_EXT_LIN, cleanup,
+    "bufStoreRecord(): Data record below base address 0x%08X at line %lu",
+    baseAddress, lineNumber
+  );
+  offset -= baseAddress;
+  status = bufWriteBlock(destData, offset, record->data, record->byteCount, error);
+  CHECK_STATUS(status, status, cleanup, "bufStoreRecord()");
+  if (!destMask) {
+    goto cleanup;
+  }
+  if (run && record->byteCount) {
+    if (run->length && run->start + run->length == offset) {
+      run->length += record->byteCount;
+      goto cleanup;
+    }
+    status = bufFlushMaskRun(destMask, run, error);
+    CHECK_STATUS(status, status, cleanup, "bufStoreRecord()");
+    run->start = offset;
+    run->length = record->byteCount;
+  } else {
+    // An empty record sets no mask bytes, but still extends the mask to its address, just as it
+    // extends the data
+    status = bufWriteConst(destMask, offset, 0x01, record->byteCount, error);
+    CHECK_STATUS(status, status, cleanup, "bufStoreRecord()");
+  }
+cleanup:
+  return retVal;
+}
+
+// Write the mask bytes gathered by bufStoreRecord().
+//
+BufferStatus bufFlushMaskRun(struct Buffer *destMask, struct MaskRun *run, const char **error) {
+  BufferStatus retVal = BUF_SUCCESS, status;
+  if (destMask && run->length) {
+    status = bufWriteConst(destMask, run->start, 0x01, run->length, error);
+    CHECK_STATUS(status, status, cleanup, "bufFlushMaskRun()");
+  }
+  run->length = 0;
+cleanup:
+  return retVal;
+}
+
+// Give the buffers room for the given extent of decoded data, so they are not repeatedly
+// reallocated as it is read. The extent comes from bufScanRecords(), which does not check the
+// data, so a corrupt file may claim a much larger one than it really has; it is only trusted as
+// far as textLength chars of text could plausibly fill it, and failure is not an error.
+//
+void bufReserveExtent(
+  struct Buffer *destData, struct Buffer *destMask, size_t extent, size_t textLength)
+{
+  if (extent / 16 <= textLength) {
+    if (!bufReserve(destData, extent, NULL) && destMask) {
+      if (bufReserve(destMask, extent, NULL)) {
+        // Not an error; the mask will grow as usual
+      }
+    }
+  }
+}
+
+// Process a single Intel hex record, given as a line of lineLength chars (not necessarily
+// NUL-terminated), writing any data it carries into the buffers.
+//
+BufferStatus bufProcessRecord(
+  const char *sourceLine, size_t lineLength, uint32 lineNumber, struct Buffer *destData,
+  struct Buffer *destMask, uint32 *segment, uint32 baseAddress, uint8 *recordType,
+  const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  struct HexRecord record;
+  status = bufDecodeRecord(sourceLine, lineLength, lineNumber, segment, &record, error);
+  CHECK_STATUS(status, status, cleanup, "bufProcessRecord()");
+  *recordType = record.recordType;
+  if (record.recordType == DATA_RECORD) {
+    status = bufStoreRecord(
+      &record, lineNumber, destData, destMask, *segment, baseAddress, NULL, error);
+    CHECK_STATUS(status, status, cleanup, "bufProcessRecord()");
+  }
+cleanup:
+  return retVal;
+}
+
+// Scan the Intel hex lines in [p, end) without decoding or checking their data, to find out which
+// addresses they cover and which segment is in effect at the end. The scan stops after an EOF
+// record, or after any line it cannot make sense of; such a line is left for bufProcessRecord() to
+// diagnose properly.
+//
+void bufScanRecords(const char *p, const char *end, struct HexScan *scan) {
+  const char *eol;
+  uint8 header[4], payload[2];
+  size_t badIndex, recordStart, recordEnd;
+  bool lowerCase;
+  uint32 segment = 0x00000000;
+  scan->lineCount = 0;
+  scan->stopped = false;
+  scan->stopEnd = end;
+  scan->sawSegment = false;
+  scan->segment = 0x00000000;
+  scan->lowestBeforeSegment = SCAN_NO_DATA;
+  scan->extentBeforeSegment = 0;
+  scan->lowest = SCAN_NO_DATA;
+  scan->extent = 0;
+  while (p < end) {
+    eol = (const char *)memchr(p, '\n', (size_t)(end - p));
+    eol = eol ? eol + 1 : end;
+    scan->lineCount++;
+    if (eol - p < 11 || *p != ':' || getHexBytes(p + 1, 4, header, &badIndex, &lowerCase)) {
+      break;
+    }
+    if (header[3] == DATA_RECORD) {
+      recordStart = (size_t)((header[1] << 8) | header[2]);
+      recordEnd = recordStart + header[0];
+      if (!scan->sawSegment) {
+        if (recordStart < scan->lowestBeforeSegment) {
+          scan->lowestBeforeSegment = recordStart;
+        }
+        if (recordEnd > scan->extentBeforeSegment) {
+          scan->extentBeforeSegment = recordEnd;
+        }
+      } else {
+        if (segment + recordStart < scan->lowest) {
+          scan->lowest = segment + recordStart;
+        }
+        if (segment + recordEnd > scan->extent) {
+          scan->extent = segment + recordEnd;
+        }
+      }
+    } else if (header[3] == EXT_SEG_RECORD || header[3] == EXT_LIN_RECORD) {
+      if (
+        header[0] != 2 || header[1] || header[2] || eol - p < 15 ||
+        getHexBytes(p + 9, 2, payload, &badIndex, &lowerCase))
+      {
+        break;
+      }
+      segment = (header[3] == EXT_SEG_RECORD) ?
+        (uint32)(((payload[0] << 8) + payload[1]) << 4) :
+        (uint32)((payload[0] << 24) | (payload[1] << 16));
+      scan->sawSegment = true;
+      scan->segment = segment;
+    } else if (header[3] != START_SEG_RECORD && header[3] != START_LIN_RECORD) {
+      break;
+    }
+    p = eol;
+  }
+  if (p < end) {
+    scan->stopped = true;
+    scan->stopEnd = eol;
+  }
+}
+
+// Process a single NUL-terminated Intel hex record.
+//
+BufferStatus bufProcessLine(
+  const char *sourceLine, uint32 lineNumber, struct Buffer *destData, struct Buffer *destMask,
+  uint32 *segment, uint8 *recordType, const char **error)
+{
+  return bufProcessRecord(
+    sourceLine, strlen(sourceLine), lineNumber, destData, destMask, segment, 0x00000000,
+    recordType, error);
+}
+
+// Read the Intel Hex records in [p, end) into buffers whose first byte corresponds to the linear
+// address baseAddress. If rebase is set, baseAddress is chosen to be the lowest data address in
+// the text, rounded down to a multiple of 64KiB. A quick scan of the record headers finds the
+// extent of the data first, so the buffers can be sized once, and the mask is written once for
+// each run of consecutive records rather than once per record.
+//
+static BufferStatus readRecords(
+  const char *p, const char *end, struct Buffer *destData, struct Buffer *destMask, bool rebase,
+  uint32 *baseAddress, const char **error)
 {
   BufferStatus retVal = BUF_SUCCESS;
   uint32 lineNumber;
   uint32 segment = 0x00000000;
-  char readLine[LINE_MAX];
+  struct HexScan scan;
+  struct HexRecord record;
+  struct MaskRun run = {0, 0};
+  size_t lowest, extent;
+  const char *eol;
   BufferStatus status;
-  uint8 recordType;
-
-  // Open the file...
-  //
-  FILE *file = fopen(fileName, "rb");
-  if (!file) {
-    errRenderStd(error);
-    FAIL_RET(BUF_FOPEN, exit, "bufReadFromIntelHexFile()");
-  }
 
   // Clear the existing data in the buffer, if any.
   //
@@ -223,47 +375,182 @@ DLLEXPORT(BufferStatus) bufReadFromIntelHexFile(
   //
   lineNumber = 1;
   CHECK_STATUS(
-    !fgets(readLine, LINE_MAX, file), HEX_EMPTY_FILE, cleanup,
-    "bufReadFromIntelHexFile(): Empty file!"
+    p == end, HEX_EMPTY_FILE, cleanup,
+    "readRecords(): Empty file!"
   );
+
+  // Find the extent of the data without decoding anything
+  //
+  bufScanRecords(p, end, &scan);
+  if (rebase) {
+    lowest = (scan.lowest < scan.lowestBeforeSegment) ? scan.lowest : scan.lowestBeforeSegment;
+    *baseAddress = (lowest == SCAN_NO_DATA) ? 0x00000000 : (uint32)(lowest & ~(size_t)0xFFFF);
+  }
+  extent = (scan.extent > scan.extentBeforeSegment) ? scan.extent : scan.extentBeforeSegment;
+  if (extent > *baseAddress) {
+    bufReserveExtent(destData, destMask, extent - *baseAddress, (size_t)(end - p));
+  }
   do {
-    status = bufProcessLine(
-      readLine, lineNumber, destData, destMask, &segment, &recordType, error);
-    CHECK_STATUS(status, status, cleanup, "bufReadFromIntelHexFile()");
+    eol = (const char *)memchr(p, '\n', (size_t)(end - p));
+    if (!eol) {
+      eol = end;
+    }
+    status = bufDecodeRecord(p, (size_t)(eol - p), lineNumber, &segment, &record, error);
+    CHECK_STATUS(status, status, cleanup, "readRecords()");
+    if (record.recordType == DATA_RECORD) {
+      status = bufStoreRecord(
+        &record, lineNumber, destData, destMask, segment, *baseAddress, &run, error);
+      CHECK_STATUS(status, status, cleanup, "readRecords()");
+    }
     lineNumber++;
-  } while ((recordType == DATA_RECORD || recordType == EXT_SEG_RECORD) && fgets(readLine, LINE_MAX, file));
+    p = (eol < end) ? eol + 1 : end;
+  } while (record.recordType != EOF_RECORD && p < end);
+  status = bufFlushMaskRun(destMask, &run, error);
+  CHECK_STATUS(status, status, cleanup, "readRecords()");
 
-  // Make sure the file terminated correctly
+  // Make sure the text terminated correctly
   //
   CHECK_STATUS(
-    recordType != EOF_RECORD, HEX_MISSING_EOF, cleanup,
-    "bufReadFromIntelHexFile(): Premature end of file - no EOF_RECORD found!"
+    record.recordType != EOF_RECORD, HEX_MISSING_EOF, cleanup,
+    "readRecords(): Premature end of file - no EOF_RECORD found!"
   );
+cleanup:
+  return retVal;
+}
 
+// Read the Intel Hex records in [p, end) serially, for a reader which cannot safely do better.
+//
+BufferStatus bufReadMappedIntelHex(
+  const char *p, const char *end, struct Buffer *destData, struct Buffer *destMask,
+  const char **error)
+{
+  uint32 baseAddress = 0x00000000;
+  return readRecords(p, end, destData, destMask, false, &baseAddress, error);
+}
+
+// Read Intel Hex records from a file. The whole file is mapped into memory, and the lines are
+// processed in place.
+//
+DLLEXPORT(BufferStatus) bufReadFromIntelHexFile(
+  struct Buffer *destData, struct Buffer *destMask, const char *fileName, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  uint32 baseAddress = 0x00000000;
+  struct MappedFile file;
+  status = bufMapFile(&file, fileName, error);
+  CHECK_STATUS(status, status, exit, "bufReadFromIntelHexFile()");
+  status = readRecords(
+    (const char *)file.data, (const char *)file.data + file.length, destData, destMask, false,
+    &baseAddress, error);
+  CHECK_STATUS(status, status, cleanup, "bufReadFromIntelHexFile()");
 cleanup:
-  // Close the file and exit
-  //
-  fclose(file);
+  bufUnmapFile(&file);
 exit:
   return retVal;
 }
 
-// Write the supplied byte as two hex digits
-// TODO: Handle write errors
+// Read Intel Hex records from a file, storing only the address range actually used.
+//
+DLLEXPORT(BufferStatus) bufReadFromIntelHexFileRebased(
+  struct Buffer *destData, struct Buffer *destMask, const char *fileName, uint32 *baseAddress,
+  const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  struct MappedFile file;
+  status = bufMapFile(&file, fileName, error);
+  CHECK_STATUS(status, status, exit, "bufReadFromIntelHexFileRebased()");
+  status = readRecords(
+    (const char *)file.data, (const char *)file.data + file.length, destData, destMask, true,
+    baseAddress, error);
+  CHECK_STATUS(status, status, cleanup, "bufReadFromIntelHexFileRebased()");
+cleanup:
+  bufUnmapFile(&file);
+exit:
+  return retVal;
+}
+
+// Read Intel Hex records from a buffer of text.
+//
+DLLEXPORT(BufferStatus) bufReadFromIntelHexBuffer(
+  struct Buffer *destData, struct Buffer *destMask, const struct Buffer *text,
+  const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  uint32 baseAddress = 0x00000000;
+  status = readRecords(
+    (const char *)text->data, (const char *)text->data + text->length, destData, destMask,
+    false, &baseAddress, error);
+  CHECK_STATUS(status, status, cleanup, "bufReadFromIntelHexBuffer()");
+cleanup:
+  return retVal;
+}
+
+// Allocate an empty output block for the given sink, or return NULL.
+//
+struct HexOutput *bufNewOutput(const struct BufferSink *sink, const char **error) {
+  struct HexOutput *const out = (struct HexOutput *)malloc(sizeof(struct HexOutput));
+  if (out) {
+    out->sink = sink;
+    out->status = BUF_SUCCESS;
+    out->error = error;
+    out->used = 0;
+  }
+  return out;
+}
+
+// Hand the formatted text on to the sink, and empty the block.
+//
+BufferStatus bufFlushOutput(struct HexOutput *out) {
+  BufferStatus retVal = BUF_SUCCESS, status;
+  const char **const error = out->error;
+  status = out->sink->write(out->sink->context, (const uint8 *)out->block, out->used, error);
+  CHECK_STATUS(status, status, cleanup, "bufFlushOutput()");
+  out->used = 0;
+cleanup:
+  return retVal;
+}
+
+// Return where the next line (of at most OUT_LINE_MAX chars) should be formatted, handing the
+// block on first if there is not room for it; or NULL if the output has failed. The caller moves
+// out->used past the line.
 //
-static void writeHexByte(uint8 byte, FILE *file) {
-  fputc(getHexUpperNibble(byte), file);
-  fputc(getHexLowerNibble(byte), file);
+char *bufOutputLine(struct HexOutput *out) {
+  if (out->status) {
+    return NULL;
+  }
+  if (out->used + OUT_LINE_MAX > OUT_BLOCK) {
+    out->status = bufFlushOutput(out);
+    if (out->status) {
+      return NULL;
+    }
+  }
+  return out->block + out->used;
 }
 
-// Write the supplied word as four hex digits, in big-endian format (most significant byte first).
-// TODO: Handle write errors
+// Write one Intel hex record, ending with a newline.
 //
-static void writeHexWordBE(uint16 word, FILE *file) {
-  fputc(getHexUpperNibble((uint8)(word >> 8)), file);
-  fputc(getHexLowerNibble((uint8)(word >> 8)), file);
-  fputc(getHexUpperNibble((uint8)(word & 0xFF)), file);
-  fputc(getHexLowerNibble((uint8)(word & 0xFF)), file);
+static void writeRecord(
+  struct HexOutput *out, uint8 recordType, uint16 address, const uint8 *data, uint8 byteCount)
+{
+  char *p;
+  uint8 i, checksum;
+  const uint8 header[] = {byteCount, (uint8)(address >> 8), (uint8)(address & 0xFF), recordType};
+  p = bufOutputLine(out);
+  if (!p) {
+    return;
+  }
+  *p++ = ':';
+  putHexBytes(header, 4, p);
+  putHexBytes(data, byteCount, p + 8);
+  p += 8 + 2*byteCount;
+  checksum = (uint8)(header[0] + header[1] + header[2] + header[3]);
+  for (i = 0; i < byteCount; i++) {
+    checksum = (uint8)(checksum + data[i]);
+  }
+  checksum = (uint8)(256 - checksum);
+  putHexBytes(&checksum, 1, p);
+  p[2] = '\n';
+  out->used = (size_t)(p + 3 - out->block);
 }
 
 BufferStatus bufDeriveMask(
@@ -298,55 +585,126 @@ cleanup:
   return retVal;
 }
 
-// Write the supplied buffer as Intel hex records with the stated line length to a file, using the
-// supplied mask. If the mask is null, one is derived from the data, either compressed or
-// uncompressed.
-// TODO: Handle write errors
+// Write an extended address record, making addr (a multiple of 64KiB) the linear address which
+// subsequent data record addresses are relative to. Below 1MiB an EXT_SEG record is written, so
+// I8HEX and I16HEX consumers can still read the file; above that, an EXT_LIN record is written.
 //
-DLLEXPORT(BufferStatus) bufWriteToIntelHexFile(
-  const struct Buffer *sourceData, const struct Buffer *sourceMask, const char *fileName,
-  uint8 lineLength, bool compress, const char **error)
+static void writeExtRecord(struct HexOutput *out, size_t addr) {
+  uint8 value[2];
+  uint8 recordType;
+  if (addr < 0x100000) {
+    recordType = EXT_SEG_RECORD;
+    addr >>= 4;
+  } else {
+    recordType = EXT_LIN_RECORD;
+    addr >>= 16;
+  }
+  value[0] = (uint8)(addr >> 8);
+  value[1] = (uint8)(addr & 0xFF);
+  writeRecord(out, recordType, 0x0000, value, 2);
+}
+
+// Make the mask the writer uses when none is supplied: either every byte of the data, or (if
+// compress is set) every byte outside sizeable runs of the fill byte.
+//
+BufferStatus bufDefaultMask(
+  const struct Buffer *sourceData, bool compress, struct Buffer *destMask, const char **error)
 {
-  BufferStatus status, retVal = BUF_SUCCESS;
-  struct Buffer tmpSourceMask;
-  bool usedTmpSourceMask = false;
-  size_t address = 0x00000000;
-  size_t ceiling = 0x00000000;
-  uint32 segment;
-  uint8 i, calculatedChecksum, maxBytesToWrite, bytesToWrite;
-  FILE *file = fopen(fileName, "wb");
-  if (!file) {
-    errRenderStd(error);
-    FAIL_RET(BUF_FOPEN, exit, "bufWriteToIntelHexFile()");
+  BufferStatus retVal = BUF_SUCCESS, status;
+  if (compress) {
+    status = bufDeriveMask(sourceData, destMask, error);
+    CHECK_STATUS(status, status, cleanup, "bufDefaultMask()");
+  } else {
+    bufZeroLength(destMask);
+    status = bufAppendConst(destMask, 0x01, sourceData->length, error);
+    CHECK_STATUS(status, status, cleanup, "bufDefaultMask()");
   }
-  if (!sourceMask) {
-    // No sourceMask was supplied; we can either assume we need to write everything,
-    // or we can try to compress the data, assuming holes where there exist ranges
-    // of the sourceData's fill byte.
-    //
-    status = bufInitialise(&tmpSourceMask, 1024, 0x00, error);
-    CHECK_STATUS(status, status, cleanupFile, "bufWriteToIntelHexFile()");
-    sourceMask = &tmpSourceMask;
-    usedTmpSourceMask = true;
-    if (compress) {
-      status = bufDeriveMask(sourceData, &tmpSourceMask, error);
-      CHECK_STATUS(status, status, cleanupBuffer, "bufWriteToIntelHexFile()");
-    } else {
-      status = bufAppendConst(&tmpSourceMask, 0x01, sourceData->length, error);
-      CHECK_STATUS(status, status, cleanupBuffer, "bufWriteToIntelHexFile()");
+cleanup:
+  return retVal;
+}
+
+#define ONES 0x0101010101010101ULL
+#define HIGH 0x8080808080808080ULL
+
+// Return the offset of the first nonzero mask byte in [from, to), or to if there is none. Holes
+// are skipped eight bytes at a time.
+//
+size_t bufFindSet(const uint8 *mask, size_t from, size_t to) {
+  uint64 word;
+  while (from < to && (from & 7)) {
+    if (mask[from]) {
+      return from;
+    }
+    from++;
+  }
+  while (from + 8 <= to) {
+    memcpy(&word, mask + from, 8);
+    if (word) {
+      break;
+    }
+    from += 8;
+  }
+  while (from < to && !mask[from]) {
+    from++;
+  }
+  return from;
+}
+
+// Return the offset of the first zero mask byte in [from, to), or to if there is none. Runs are
+// checked eight bytes at a time: (w - ONES) & ~w & HIGH is nonzero iff some byte of w is zero.
+//
+size_t bufFindClear(const uint8 *mask, size_t from, size_t to) {
+  uint64 word;
+  while (from < to && (from & 7)) {
+    if (!mask[from]) {
+      return from;
     }
+    from++;
   }
+  while (from + 8 <= to) {
+    memcpy(&word, mask + from, 8);
+    if ((word - ONES) & ~word & HIGH) {
+      break;
+    }
+    from += 8;
+  }
+  while (from < to && mask[from]) {
+    from++;
+  }
+  return from;
+}
 
+// Write the 64KiB windows of the address space which hold buffer offsets [address, end), each
+// introduced by an extended address record (except for the first 64KiB, which needs none). The
+// address must be zero or the start of a window, so that splitting the buffer at window
+// boundaries gives the same records as writing it all at once. If skipEmpty is set, windows
+// with no masked bytes are skipped altogether, extended address record and all.
+//
+static void writeWindows(
+  struct HexOutput *out, const struct Buffer *sourceData, const struct Buffer *sourceMask,
+  uint32 baseAddress, size_t address, size_t end, uint8 lineLength, bool skipEmpty)
+{
+  size_t ceiling, absolute;
+  uint8 maxBytesToWrite, bytesToWrite;
   do {
-    ceiling += 0x10000;
-    if (ceiling > sourceMask->length) {
-      ceiling = sourceMask->length;
+    if (skipEmpty) {
+      // Go straight to the window holding the next masked byte
+      address = bufFindSet(sourceMask->data, address, end);
+      if (address == end) {
+        break;
+      }
+    }
+    absolute = baseAddress + address;
+    if (absolute & ~(size_t)0xFFFF) {
+      writeExtRecord(out, absolute & ~(size_t)0xFFFF);
+    }
+    ceiling = (absolute | 0xFFFF) + 1 - baseAddress;
+    if (ceiling > end) {
+      ceiling = end;
     }
     while (address < ceiling) {
       // Find the next run in the sourceMask
-      while (address < ceiling && !sourceMask->data[address]) {
-        address++;
-      }
+      address = bufFindSet(sourceMask->data, address, ceiling);
       // If we hit the end of the sourceMask, break out of this while loop
       if (address == ceiling) {
         break;
@@ -359,48 +717,185 @@ DLLEXPORT(BufferStatus) bufWriteToIntelHexFile(
         maxBytesToWrite = lineLength;
       }
       // find out how many bytes are in this run
-      bytesToWrite = 0;
-      while (bytesToWrite < maxBytesToWrite && sourceMask->data[address + bytesToWrite]) {
-        bytesToWrite++;
-      }
-      fputc(':', file);
-      writeHexByte(bytesToWrite, file);
-      writeHexWordBE(address & 0xFFFF, file);
-      writeHexByte(DATA_RECORD, file);
-      calculatedChecksum = bytesToWrite;
-      calculatedChecksum = (uint8)(calculatedChecksum + (address >> 8));
-      calculatedChecksum = (uint8)(calculatedChecksum + (address & 0xFF));
-      for (i = 0; i < bytesToWrite; i++) {
-        writeHexByte(sourceData->data[address + i], file);
-        calculatedChecksum = (uint8)(calculatedChecksum + sourceData->data[address + i]);
-      }
-      calculatedChecksum = (uint8)(256 - calculatedChecksum);
-      writeHexByte(calculatedChecksum, file);
-      fputc('\n', file);
+      bytesToWrite = (uint8)(
+        bufFindClear(sourceMask->data, address, address + maxBytesToWrite) - address);
+      writeRecord(
+        out, DATA_RECORD, (uint16)((baseAddress + address) & 0xFFFF),
+        sourceData->data + address, bytesToWrite);
       address += bytesToWrite;
     }
-    if (address < sourceMask->length) {
-      segment = (uint32)(address >> 4);
-      CHECK_STATUS(
-        segment > 0xFFFF, HEX_BAD_EXT_SEG, cleanupBuffer,
-        "bufWriteToIntelHexFile(): Segment addresses > 0xFFFF are not supported"
-      );
-      calculatedChecksum =
-        (uint8)(256 - 2 - EXT_SEG_RECORD - (segment >> 8) - (segment & 0xFF));
-      fwrite(":020000", 1, 7, file);
-      writeHexByte(EXT_SEG_RECORD, file);
-      writeHexWordBE((uint16)segment, file);
-      writeHexByte(calculatedChecksum, file);
-      fputc('\n', file);
-    }
-  } while (address < sourceMask->length);
-  fwrite(":00000001FF\n", 1, 12, file);
-cleanupBuffer:
+  } while (address < end);
+}
+
+// Append to text the records for the windows holding buffer offsets [address, end), as
+// writeWindows() would write them. No EOF record is written.
+//
+BufferStatus bufWriteHexWindows(
+  struct Buffer *text, const struct Buffer *sourceData, const struct Buffer *sourceMask,
+  uint32 baseAddress, size_t address, size_t end, uint8 lineLength, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS;
+  struct BufferSink sink;
+  struct HexOutput *out;
+  bufInitBufferSink(&sink, text);
+  out = bufNewOutput(&sink, error);
+  CHECK_STATUS(!out, BUF_NO_MEM, exit, "bufWriteHexWindows(): Cannot allocate output block");
+  writeWindows(out, sourceData, sourceMask, baseAddress, address, end, lineLength, false);
+  if (!out->status) {
+    out->status = bufFlushOutput(out);
+  }
+  CHECK_STATUS(out->status, out->status, cleanup, "bufWriteHexWindows()");
+cleanup:
+  free(out);
+exit:
+  return retVal;
+}
+
+// Write the supplied buffer as Intel hex records with the stated line length, using the supplied
+// mask. The first byte of the buffer is written at linear address baseAddress. If the mask is
+// null, one is derived from the data, either compressed or uncompressed. If skipEmpty is set, no
+// extended address record is written for a 64KiB window with no data in it.
+//
+static BufferStatus writeRecords(
+  const struct BufferSink *sink, const struct Buffer *sourceData, const struct Buffer *sourceMask,
+  uint32 baseAddress, uint8 lineLength, bool compress, bool skipEmpty, const char **error)
+{
+  BufferStatus status, retVal = BUF_SUCCESS;
+  struct Buffer tmpSourceMask;
+  bool usedTmpSourceMask = false;
+  struct HexOutput *out = NULL;
+  CHECK_STATUS(
+    (uint64)baseAddress + sourceData->length > 0x100000000ULL, HEX_BAD_EXT_LIN, exit,
+    "writeRecords(): Addresses above 4GiB cannot be represented"
+  );
+  if (!sourceMask) {
+    // No sourceMask was supplied; we can either assume we need to write everything,
+    // or we can try to compress the data, assuming holes where there exist ranges
+    // of the sourceData's fill byte.
+    //
+    status = bufInitialise(&tmpSourceMask, 1024, 0x00, error);
+    CHECK_STATUS(status, status, exit, "writeRecords()");
+    sourceMask = &tmpSourceMask;
+    usedTmpSourceMask = true;
+    status = bufDefaultMask(sourceData, compress, &tmpSourceMask, error);
+    CHECK_STATUS(status, status, cleanup, "writeRecords()");
+  }
+  out = bufNewOutput(sink, error);
+  CHECK_STATUS(!out, BUF_NO_MEM, cleanup, "writeRecords(): Cannot allocate output block");
+  writeWindows(
+    out, sourceData, sourceMask, baseAddress, 0, sourceMask->length, lineLength, skipEmpty);
+  writeRecord(out, EOF_RECORD, 0x0000, NULL, 0);
+  if (!out->status) {
+    out->status = bufFlushOutput(out);
+  }
+  CHECK_STATUS(out->status, out->status, cleanup, "writeRecords()");
+cleanup:
+  free(out);
   if (usedTmpSourceMask) {
     bufDestroy(&tmpSourceMask);
   }
-cleanupFile:
-  fclose(file);
 exit:
   return retVal;
 }
+
+// Write the supplied buffer as Intel hex records to a file, starting at the given base address.
+//
+static BufferStatus writeHexFile(
+  const struct Buffer *sourceData, const struct Buffer *sourceMask, uint32 baseAddress,
+  const char *fileName, uint8 lineLength, bool compress, bool skipEmpty, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  struct BufferSink sink;
+  FILE *const file = fopen(fileName, "wb");
+  if (!file) {
+    errRenderStd(error);
+    FAIL_RET(BUF_FOPEN, exit, "writeHexFile()");
+  }
+  bufInitFileSink(&sink, file);
+  status = writeRecords(
+    &sink, sourceData, sourceMask, baseAddress, lineLength, compress, skipEmpty, error);
+  if (status) {
+    fclose(file);
+    FAIL_RET(status, exit, "writeHexFile()");
+  }
+  if (fclose(file)) {
+    errRenderStd(error);
+    FAIL_RET(BUF_FERROR, exit, "writeHexFile()");
+  }
+exit:
+  return retVal;
+}
+
+// Write the supplied buffer as Intel hex records to a file.
+//
+DLLEXPORT(BufferStatus) bufWriteToIntelHexFile(
+  const struct Buffer *sourceData, const struct Buffer *sourceMask, const char *fileName,
+  uint8 lineLength, bool compress, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS;
+  BufferStatus status = writeHexFile(
+    sourceData, sourceMask, 0x00000000, fileName, lineLength, compress, false, error);
+  CHECK_STATUS(status, status, cleanup, "bufWriteToIntelHexFile()");
+cleanup:
+  return retVal;
+}
+
+// Write the supplied buffer as Intel hex records to a file, starting at the given base address.
+//
+DLLEXPORT(BufferStatus) bufWriteToIntelHexFileRebased(
+  const struct Buffer *sourceData, const struct Buffer *sourceMask, uint32 baseAddress,
+  const char *fileName, uint8 lineLength, bool compress, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS;
+  BufferStatus status = writeHexFile(
+    sourceData, sourceMask, baseAddress, fileName, lineLength, compress, false, error);
+  CHECK_STATUS(status, status, cleanup, "bufWriteToIntelHexFileRebased()");
+cleanup:
+  return retVal;
+}
+
+// Write the supplied buffer as Intel hex records to a file, leaving out the extended address
+// records of empty windows.
+//
+DLLEXPORT(BufferStatus) bufWriteToIntelHexFileSparse(
+  const struct Buffer *sourceData, const struct Buffer *sourceMask, const char *fileName,
+  uint8 lineLength, bool compress, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS;
+  BufferStatus status = writeHexFile(
+    sourceData, sourceMask, 0x00000000, fileName, lineLength, compress, true, error);
+  CHECK_STATUS(status, status, cleanup, "bufWriteToIntelHexFileSparse()");
+cleanup:
+  return retVal;
+}
+
+// Write the supplied buffer as Intel hex records to a buffer of text.
+//
+DLLEXPORT(BufferStatus) bufWriteToIntelHexBuffer(
+  const struct Buffer *sourceData, const struct Buffer *sourceMask, struct Buffer *textOut,
+  uint8 lineLength, bool compress, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  struct BufferSink sink;
+  bufInitBufferSink(&sink, textOut);
+  bufZeroLength(textOut);
+  status = writeRecords(
+    &sink, sourceData, sourceMask, 0x00000000, lineLength, compress, false, error);
+  CHECK_STATUS(status, status, cleanup, "bufWriteToIntelHexBuffer()");
+cleanup:
+  return retVal;
+}
+
+// Write the supplied buffer as Intel hex records to a sink.
+//
+DLLEXPORT(BufferStatus) bufWriteToIntelHexSink(
+  const struct Buffer *sourceData, const struct Buffer *sourceMask,
+  const struct BufferSink *sink, uint8 lineLength, bool compress, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  status = writeRecords(
+    sink, sourceData, sourceMask, 0x00000000, lineLength, compress, false, error);
+  CHECK_STATUS(status, status, cleanup, "bufWriteToIntelHexSink()");
+cleanup:
+  return retVal;
+}
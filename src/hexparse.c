@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2009-2012 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Incremental Intel Hex parsing. Complete lines are decoded straight out of the caller's data; only
+// a line split across two pieces is copied, into the parser's carry buffer. The carry buffer is
+// longer than any valid record plus its terminator, so a line too long to fit is still diagnosed
+// exactly as the file reader would diagnose it.
+//
+#include <string.h>
+#include <makestuff/liberror.h>
+#include <makestuff/libbuffer.h>
+#include "private.h"
+
+#define NO_RECORD 0xFF
+
+// Decode one line, and either store its data or pass it to the callback.
+//
+static BufferStatus processLine(
+  struct HexParser *self, const char *line, size_t length, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  struct HexRecord record;
+  status = bufDecodeRecord(line, length, self->lineNumber, &self->segment, &record, error);
+  CHECK_STATUS(status, status, cleanup, "processLine()");
+  self->recordType = record.recordType;
+  if (record.recordType == DATA_RECORD) {
+    if (self->callback) {
+      status = self->callback(
+        self->context, self->segment + record.address, record.data, record.byteCount, error);
+    } else {
+      status = bufStoreRecord(
+        &record, self->lineNumber, self->destData, self->destMask, self->segment, 0x00000000,
+        NULL, error);
+    }
+    CHECK_STATUS(status, status, cleanup, "processLine()");
+  }
+  self->lineNumber++;
+cleanup:
+  return retVal;
+}
+
+// Append to the carry buffer whatever fits; the rest of an overlong line can never matter.
+//
+static void carry(struct HexParser *self, const char *p, size_t length) {
+  const size_t room = sizeof(self->carry) - self->carryLength;
+  if (length > room) {
+    length = room;
+  }
+  memcpy(self->carry + self->carryLength, p, length);
+  self->carryLength += length;
+}
+
+// Prepare an incremental Intel Hex parser.
+//
+DLLEXPORT(void) bufHexParserInit(
+  struct HexParser *self, struct Buffer *destData, struct Buffer *destMask,
+  HexDataCallback callback, void *context)
+{
+  self->destData = destData;
+  self->destMask = destMask;
+  self->callback = callback;
+  self->context = context;
+  self->segment = 0x00000000;
+  self->lineNumber = 1;
+  self->recordType = NO_RECORD;
+  self->started = false;
+  self->status = BUF_SUCCESS;
+  self->carryLength = 0;
+  if (!callback) {
+    bufZeroLength(destData);
+    if (destMask) {
+      bufZeroLength(destMask);
+    }
+  }
+}
+
+// Give the next piece of an Intel Hex file to a parser.
+//
+DLLEXPORT(BufferStatus) bufHexParserFeed(
+  struct HexParser *self, const uint8 *data, size_t length, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  const char *p = (const char *)data;
+  const char *const end = p + length;
+  const char *eol;
+  CHECK_STATUS(
+    self->status, self->status, exit,
+    "bufHexParserFeed(): The parser has already failed"
+  );
+  if (length) {
+    self->started = true;
+  }
+  while (p < end && self->recordType != EOF_RECORD) {
+    eol = (const char *)memchr(p, '\n', (size_t)(end - p));
+    if (!eol) {
+      carry(self, p, (size_t)(end - p));
+      break;
+    }
+    if (self->carryLength) {
+      carry(self, p, (size_t)(eol - p));
+      status = processLine(self, self->carry, self->carryLength, error);
+      self->carryLength = 0;
+    } else {
+      status = processLine(self, p, (size_t)(eol - p), error);
+    }
+    CHECK_STATUS(status, status, cleanup, "bufHexParserFeed()");
+    p = eol + 1;
+  }
+cleanup:
+  self->status = retVal;
+exit:
+  return retVal;
+}
+
+// Tell a parser that the whole Intel Hex file has been given to it.
+//
+DLLEXPORT(BufferStatus) bufHexParserFinish(struct HexParser *self, const char **error) {
+  BufferStatus retVal = BUF_SUCCESS, status;
+  CHECK_STATUS(
+    self->status, self->status, exit,
+    "bufHexParserFinish(): The parser has already failed"
+  );
+  CHECK_STATUS(
+    !self->started, HEX_EMPTY_FILE, cleanup,
+    "bufHexParserFinish(): Empty file!"
+  );
+
+  // The last line need not be terminated
+  //
+  if (self->recordType != EOF_RECORD && self->carryLength) {
+    status = processLine(self, self->carry, self->carryLength, error);
+    self->carryLength = 0;
+    CHECK_STATUS(status, status, cleanup, "bufHexParserFinish()");
+  }
+  CHECK_STATUS(
+    self->recordType != EOF_RECORD, HEX_MISSING_EOF, cleanup,
+    "bufHexParserFinish(): Premature end of file - no EOF_RECORD found!"
+  );
+cleanup:
+  self->status = retVal;
+exit:
+  return retVal;
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2009-2012 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Plain hex strings, for logs and reports. Both directions use the word-at-a-time kernels in
+// conv.c, which the Intel hex reader and writer use too.
+//
+#include <makestuff/liberror.h>
+#include <makestuff/libbuffer.h>
+#include "conv.h"
+
+// Encode a block of bytes as a hex string.
+//
+DLLEXPORT(BufferStatus) bufToHexString(
+  const uint8 *data, size_t count, struct Buffer *destText, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  bufZeroLength(destText);
+  status = bufAppendConst(destText, 0x00, 2*count, error);
+  CHECK_STATUS(status, status, cleanup, "bufToHexString()");
+  putHexBytes(data, count, (char *)destText->data);
+cleanup:
+  return retVal;
+}
+
+// Decode a hex string into a block of bytes.
+//
+DLLEXPORT(BufferStatus) bufFromHexString(
+  struct Buffer *destData, const char *text, size_t length, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  size_t badIndex;
+  bool lowerCase;
+  bufZeroLength(destData);
+  CHECK_STATUS(
+    length & 1, BUF_BAD_HEX, cleanup,
+    "bufFromHexString(): The string has an odd number of digits");
+  status = bufAppendConst(destData, 0x00, length / 2, error);
+  CHECK_STATUS(status, status, cleanup, "bufFromHexString()");
+  if (getHexBytes(text, length / 2, destData->data, &badIndex, &lowerCase)) {
+    bufZeroLength(destData);
+    FAIL_RET(
+      BUF_BAD_HEX, cleanup,
+      "bufFromHexString(): Illegal character 0x%02X at offset %lu",
+      (uint8)text[badIndex], (unsigned long)badIndex);
+  }
+cleanup:
+  return retVal;
+}
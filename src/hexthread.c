@@ -0,0 +1,466 @@
+/*
+ * Copyright (C) 2009-2012 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Multi-threaded Intel Hex reading and writing. The mapped file is split into chunks at line boundaries, and
+// each chunk is handled by its own thread in two passes:
+//
+//   1) Scan: find the chunk's line count, the segment in effect at its end, and the extent of
+//      the data it writes (bufScanRecords()).
+//   2) Decode: with the starting segment and line number of every chunk known, and the buffers
+//      pre-sized to the final extent, decode the chunk's lines straight into the buffers.
+//
+// Because the buffers never need to grow during the decode, the threads can write to them
+// concurrently, provided no two chunks write the same bytes. The scan gives the range of addresses
+// each chunk writes, and if any two ranges overlap the file is read serially instead. If any chunk
+// fails to decode, the file is read serially again too, so that both the error reported and what
+// is left in the buffers are exactly what the serial reader gives.
+//
+// Writing is simpler: each 64KiB window of the address space is written the same way whatever
+// came before it, so each thread formats a contiguous share of the windows into its own Buffer,
+// and the Buffers are written to the file in order, followed by the EOF record, with writev().
+//
+#include <stdlib.h>
+#include <string.h>
+#include <makestuff/liberror.h>
+#include <makestuff/libbuffer.h>
+#include "private.h"
+#ifndef WIN32
+  #include <fcntl.h>
+  #include <pthread.h>
+  #include <unistd.h>
+#endif
+
+// Don't bother giving a thread less than this much of the file.
+//
+#define MIN_CHUNK 65536
+
+#ifndef WIN32
+  struct Chunk {
+    const char *start;
+    const char *end;
+    struct HexScan scan;
+    uint32 firstLine;
+    uint32 segment;
+    size_t low;
+    size_t high;
+    struct Buffer *destData;
+    struct Buffer *destMask;
+    BufferStatus status;
+    uint8 recordType;
+    const char *errorMessage;
+    const char **error;
+  };
+
+  // One thread's share of the parallel writer: the windows holding buffer offsets [start, end).
+  //
+  struct WriteChunk {
+    const struct Buffer *sourceData;
+    const struct Buffer *sourceMask;
+    size_t start;
+    size_t end;
+    uint8 lineLength;
+    struct Buffer text;
+    BufferStatus status;
+    const char *errorMessage;
+    const char **error;
+  };
+
+  static void *scanChunk(void *arg) {
+    struct Chunk *const chunk = (struct Chunk *)arg;
+    bufScanRecords(chunk->start, chunk->end, &chunk->scan);
+    return NULL;
+  }
+
+  static void *decodeChunk(void *arg) {
+    struct Chunk *const chunk = (struct Chunk *)arg;
+    const char *p = chunk->start;
+    const char *eol;
+    struct HexRecord record;
+    struct MaskRun run = {0, 0};
+    uint32 lineNumber = chunk->firstLine;
+    chunk->status = BUF_SUCCESS;
+    while (p < chunk->end) {
+      eol = (const char *)memchr(p, '\n', (size_t)(chunk->end - p));
+      if (!eol) {
+        eol = chunk->end;
+      }
+      chunk->status = bufDecodeRecord(
+        p, (size_t)(eol - p), lineNumber, &chunk->segment, &record, chunk->error);
+      if (chunk->status) {
+        return NULL;
+      }
+      chunk->recordType = record.recordType;
+
+      // An empty data record writes nothing; the buffers were already sized to reach it
+      //
+      if (record.recordType == DATA_RECORD && record.byteCount) {
+        chunk->status = bufStoreRecord(
+          &record, lineNumber, chunk->destData, chunk->destMask, chunk->segment, 0x00000000,
+          &run, chunk->error);
+        if (chunk->status) {
+          return NULL;
+        }
+      }
+      lineNumber++;
+      p = (eol < chunk->end) ? eol + 1 : chunk->end;
+    }
+    chunk->status = bufFlushMaskRun(chunk->destMask, &run, chunk->error);
+    return NULL;
+  }
+
+  static void *encodeChunk(void *arg) {
+    struct WriteChunk *const chunk = (struct WriteChunk *)arg;
+    chunk->status = bufWriteHexWindows(
+      &chunk->text, chunk->sourceData, chunk->sourceMask, 0x00000000, chunk->start,
+      chunk->end, chunk->lineLength, chunk->error);
+    return NULL;
+  }
+
+  // Run func on each of the numItems items of itemSize bytes, each in its own thread.
+  //
+  static BufferStatus runChunks(
+    void *items, size_t itemSize, uint32 numItems, void *(*func)(void *), const char **error)
+  {
+    BufferStatus retVal = BUF_SUCCESS;
+    uint32 i, started;
+    pthread_t *const threads = (pthread_t *)calloc(numItems, sizeof(pthread_t));
+    CHECK_STATUS(!threads, BUF_NO_MEM, exit, "runChunks(): Cannot allocate thread table");
+    for (started = 0; started < numItems; started++) {
+      if (pthread_create(threads + started, NULL, func, (uint8 *)items + started * itemSize)) {
+        break;
+      }
+    }
+    for (i = 0; i < started; i++) {
+      pthread_join(threads[i], NULL);
+    }
+    CHECK_STATUS(
+      started < numItems, BUF_NO_MEM, cleanup,
+      "runChunks(): Cannot create thread");
+  cleanup:
+    free(threads);
+  exit:
+    return retVal;
+  }
+
+  // Widen [*low, *high) to cover [low, high), if that is not empty.
+  //
+  static void widen(size_t *low, size_t *high, size_t lowest, size_t extent) {
+    if (lowest == SCAN_NO_DATA) {
+      return;
+    }
+    if (lowest < *low) {
+      *low = lowest;
+    }
+    if (extent > *high) {
+      *high = extent;
+    }
+  }
+
+  // Check whether any two chunks' address ranges overlap.
+  //
+  static bool chunksOverlap(const struct Chunk *chunks, uint32 numChunks) {
+    uint32 i, j;
+    for (i = 0; i < numChunks; i++) {
+      for (j = i + 1; j < numChunks; j++) {
+        if (
+          chunks[i].low < chunks[i].high && chunks[j].low < chunks[j].high &&
+          chunks[i].low < chunks[j].high && chunks[j].low < chunks[i].high)
+        {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  // Use numThreads, or if that is zero, as many threads as there are processors.
+  //
+  static uint32 threadCount(uint32 numThreads) {
+    if (!numThreads) {
+      const long online = sysconf(_SC_NPROCESSORS_ONLN);
+      numThreads = (online > 0) ? (uint32)online : 1;
+    }
+    return numThreads;
+  }
+#endif
+
+// Read Intel Hex records from a file, using several threads.
+//
+DLLEXPORT(BufferStatus) bufReadFromIntelHexFileParallel(
+  struct Buffer *destData, struct Buffer *destMask, const char *fileName, uint32 numThreads,
+  const char **error)
+{
+  #ifdef WIN32
+    (void)numThreads;
+    return bufReadFromIntelHexFile(destData, destMask, fileName, error);
+  #else
+    BufferStatus retVal = BUF_SUCCESS, status;
+    struct MappedFile file;
+    struct Chunk *chunks = NULL;
+    uint32 numChunks, i, lastChunk;
+    const char *p, *end, *split;
+    size_t extent, chunkEnd;
+    uint32 segment, lineNumber;
+
+    status = bufMapFile(&file, fileName, error);
+    CHECK_STATUS(status, status, exit, "bufReadFromIntelHexFileParallel()");
+    bufZeroLength(destData);
+    if (destMask) {
+      bufZeroLength(destMask);
+    }
+    CHECK_STATUS(
+      !file.length, HEX_EMPTY_FILE, cleanup,
+      "bufReadFromIntelHexFileParallel(): Empty file!"
+    );
+
+    // Split the file into chunks at line boundaries
+    //
+    numThreads = threadCount(numThreads);
+    numChunks = (uint32)(file.length / MIN_CHUNK) + 1;
+    if (numChunks > numThreads) {
+      numChunks = numThreads;
+    }
+    chunks = (struct Chunk *)calloc(numChunks, sizeof(struct Chunk));
+    CHECK_STATUS(
+      !chunks, BUF_NO_MEM, cleanup,
+      "bufReadFromIntelHexFileParallel(): Cannot allocate chunk table");
+    p = (const char *)file.data;
+    end = p + file.length;
+    for (i = 0; i < numChunks; i++) {
+      chunks[i].start = p;
+      split = (const char *)file.data + file.length / numChunks * (i + 1);
+      if (i + 1 == numChunks || split <= p) {
+        split = end;
+      } else {
+        split = (const char *)memchr(split, '\n', (size_t)(end - split));
+        split = split ? split + 1 : end;
+      }
+      chunks[i].end = p = split;
+      chunks[i].destData = destData;
+      chunks[i].destMask = destMask;
+      chunks[i].error = error ? &chunks[i].errorMessage : NULL;
+    }
+
+    // Scan all the chunks, then work out where each one starts and how far the data extends. The
+    // first chunk which stops early (at an EOF record or an incomprehensible line) is the last one
+    // to be decoded.
+    //
+    status = runChunks(chunks, sizeof(struct Chunk), numChunks, scanChunk, error);
+    CHECK_STATUS(status, status, cleanup, "bufReadFromIntelHexFileParallel()");
+    segment = 0x00000000;
+    lineNumber = 1;
+    extent = 0;
+    lastChunk = numChunks - 1;
+    for (i = 0; i < numChunks; i++) {
+      const struct HexScan *const scan = &chunks[i].scan;
+      chunks[i].segment = segment;
+      chunks[i].firstLine = lineNumber;
+      chunks[i].low = SCAN_NO_DATA;
+      chunks[i].high = 0;
+      if (scan->lowestBeforeSegment != SCAN_NO_DATA) {
+        widen(
+          &chunks[i].low, &chunks[i].high, segment + scan->lowestBeforeSegment,
+          segment + scan->extentBeforeSegment);
+      }
+      widen(&chunks[i].low, &chunks[i].high, scan->lowest, scan->extent);
+      chunkEnd = segment + scan->extentBeforeSegment;
+      if (chunkEnd > extent) {
+        extent = chunkEnd;
+      }
+      if (scan->extent > extent) {
+        extent = scan->extent;
+      }
+      if (scan->sawSegment) {
+        segment = scan->segment;
+      }
+      lineNumber += scan->lineCount;
+      if (scan->stopped) {
+        chunks[i].end = scan->stopEnd;
+        lastChunk = i;
+        break;
+      }
+    }
+
+    // Threads must not write the same bytes, so overlapping chunks are read serially
+    //
+    if (chunksOverlap(chunks, lastChunk + 1)) {
+      goto serial;
+    }
+
+    // Size the buffers up front, so the decode threads never need to reallocate them
+    //
+    if (extent) {
+      status = bufWriteConst(destData, 0, destData->fill, extent, error);
+      CHECK_STATUS(status, status, cleanup, "bufReadFromIntelHexFileParallel()");
+      if (destMask) {
+        status = bufWriteConst(destMask, 0, 0x00, extent, error);
+        CHECK_STATUS(status, status, cleanup, "bufReadFromIntelHexFileParallel()");
+      }
+    }
+    status = runChunks(chunks, sizeof(struct Chunk), lastChunk + 1, decodeChunk, error);
+    CHECK_STATUS(status, status, cleanup, "bufReadFromIntelHexFileParallel()");
+
+    // Later chunks may have decoded data the serial reader would never have reached, so if any
+    // chunk failed, start again serially to get the same buffers and the same error
+    //
+    for (i = 0; i <= lastChunk; i++) {
+      if (chunks[i].status) {
+        goto serial;
+      }
+    }
+    CHECK_STATUS(
+      chunks[lastChunk].recordType != EOF_RECORD, HEX_MISSING_EOF, cleanup,
+      "bufReadFromIntelHexFileParallel(): Premature end of file - no EOF_RECORD found!"
+    );
+    goto cleanup;
+  serial:
+    status = bufReadMappedIntelHex(
+      (const char *)file.data, (const char *)file.data + file.length, destData, destMask, error);
+    CHECK_STATUS(status, status, cleanup, "bufReadFromIntelHexFileParallel()");
+  cleanup:
+    if (chunks) {
+      for (i = 0; i < numChunks; i++) {
+        if (chunks[i].errorMessage) {
+          errFree(chunks[i].errorMessage);
+        }
+      }
+      free(chunks);
+    }
+    bufUnmapFile(&file);
+  exit:
+    return retVal;
+  #endif
+}
+
+// Write a buffer as Intel Hex records to a file, using several threads.
+//
+DLLEXPORT(BufferStatus) bufWriteToIntelHexFileParallel(
+  const struct Buffer *sourceData, const struct Buffer *sourceMask, const char *fileName,
+  uint8 lineLength, bool compress, uint32 numThreads, const char **error)
+{
+  #ifdef WIN32
+    (void)numThreads;
+    return bufWriteToIntelHexFile(sourceData, sourceMask, fileName, lineLength, compress, error);
+  #else
+    BufferStatus retVal = BUF_SUCCESS, status;
+    static const char eofRecord[] = ":00000001FF\n";
+    struct Buffer tmpSourceMask = {NULL, 0, 0, 0, false};
+    struct WriteChunk *chunks = NULL;
+    struct SinkBlock *blocks = NULL;
+    struct BufferSink sink;
+    int fd = -1;
+    uint32 numChunks = 0, numWindows, i;
+    size_t windowEnd;
+
+    CHECK_STATUS(
+      (uint64)sourceData->length > 0x100000000ULL, HEX_BAD_EXT_LIN, cleanup,
+      "bufWriteToIntelHexFileParallel(): Addresses above 4GiB cannot be represented"
+    );
+    if (!sourceMask) {
+      status = bufInitialise(&tmpSourceMask, 1024, 0x00, error);
+      CHECK_STATUS(status, status, cleanup, "bufWriteToIntelHexFileParallel()");
+      status = bufDefaultMask(sourceData, compress, &tmpSourceMask, error);
+      CHECK_STATUS(status, status, cleanup, "bufWriteToIntelHexFileParallel()");
+      sourceMask = &tmpSourceMask;
+    }
+
+    // Each thread gets a share of the 64KiB windows of the address space
+    //
+    numWindows = (uint32)((sourceMask->length + 0xFFFF) >> 16);
+    if (!numWindows) {
+      numWindows = 1;
+    }
+    numChunks = threadCount(numThreads);
+    if (numChunks > numWindows) {
+      numChunks = numWindows;
+    }
+    chunks = (struct WriteChunk *)calloc(numChunks, sizeof(struct WriteChunk));
+    CHECK_STATUS(
+      !chunks, BUF_NO_MEM, cleanup,
+      "bufWriteToIntelHexFileParallel(): Cannot allocate chunk table");
+    for (i = 0; i < numChunks; i++) {
+      status = bufInitialise(&chunks[i].text, 1024, 0x00, error);
+      CHECK_STATUS(status, status, cleanup, "bufWriteToIntelHexFileParallel()");
+      chunks[i].sourceData = sourceData;
+      chunks[i].sourceMask = sourceMask;
+      chunks[i].start = (i == 0) ? 0 : chunks[i - 1].end;
+      windowEnd = (size_t)((uint64)numWindows * (i + 1) / numChunks) << 16;
+      chunks[i].end = (i + 1 == numChunks || windowEnd > sourceMask->length) ?
+        sourceMask->length : windowEnd;
+      chunks[i].lineLength = lineLength;
+      chunks[i].error = error ? &chunks[i].errorMessage : NULL;
+    }
+    status = runChunks(chunks, sizeof(struct WriteChunk), numChunks, encodeChunk, error);
+    CHECK_STATUS(status, status, cleanup, "bufWriteToIntelHexFileParallel()");
+    for (i = 0; i < numChunks; i++) {
+      if (chunks[i].status) {
+        if (error) {
+          *error = chunks[i].errorMessage;
+          chunks[i].errorMessage = NULL;
+        }
+        FAIL_RET(chunks[i].status, cleanup, "bufWriteToIntelHexFileParallel()");
+      }
+    }
+
+    // Write the text in order, followed by the EOF record, in as few system calls as possible
+    //
+    blocks = (struct SinkBlock *)calloc(numChunks + 1, sizeof(struct SinkBlock));
+    CHECK_STATUS(
+      !blocks, BUF_NO_MEM, cleanup,
+      "bufWriteToIntelHexFileParallel(): Cannot allocate block table");
+    for (i = 0; i < numChunks; i++) {
+      blocks[i].data = chunks[i].text.data;
+      blocks[i].length = chunks[i].text.length;
+    }
+    blocks[numChunks].data = (const uint8 *)eofRecord;
+    blocks[numChunks].length = sizeof(eofRecord) - 1;
+    fd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+      errRenderStd(error);
+      FAIL_RET(BUF_FOPEN, cleanup, "bufWriteToIntelHexFileParallel()");
+    }
+    bufInitDescriptorSink(&sink, fd);
+    status = bufSinkWriteBlocks(&sink, blocks, numChunks + 1, error);
+    CHECK_STATUS(status, status, cleanup, "bufWriteToIntelHexFileParallel()");
+    status = close(fd) ? BUF_FERROR : BUF_SUCCESS;
+    fd = -1;
+    if (status) {
+      errRenderStd(error);
+      FAIL_RET(status, cleanup, "bufWriteToIntelHexFileParallel()");
+    }
+  cleanup:
+    if (fd >= 0) {
+      close(fd);
+    }
+    free(blocks);
+    if (chunks) {
+      for (i = 0; i < numChunks; i++) {
+        if (chunks[i].errorMessage) {
+          errFree(chunks[i].errorMessage);
+        }
+        if (chunks[i].text.data) {
+          bufDestroy(&chunks[i].text);
+        }
+      }
+      free(chunks);
+    }
+    if (tmpSourceMask.data) {
+      bufDestroy(&tmpSourceMask);
+    }
+    return retVal;
+  #endif
+}
@@ -0,0 +1,362 @@
+/*
+ * Copyright (C) 2009-2012 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// The native image format: a buffer's masked runs stored as extents, with nothing to parse.
+//
+// All fields are little-endian. The file starts with a header:
+//
+//   0: "BUFIMAGE"
+//   8: uint32 version (IMAGE_VERSION, or 1 for files which never use bitmaps)
+//  12: uint32 flags (IMAGE_CRC if the extents carry CRC-32s)
+//  16: uint64 length of the buffer
+//  24: uint64 number of extents
+//
+// which is followed by the extent table, sorted by address:
+//
+//   0: uint64 address
+//   8: uint64 length
+//  16: uint64 file offset of the extent's bytes
+//  24: uint32 CRC-32 of the extent's bytes and bitmap, or zero
+//  28: uint32 extent flags (EXTENT_BITMAP if the extent carries a bitmap)
+//
+// Each extent holds one masked run, or several separated by holes of no more than MERGE_GAP
+// bytes; in the latter case its bytes are followed by a bitmap of (length + 7) / 8 bytes, with
+// bit n % 8 of byte n / 8 set if byte n of the extent is masked. So a finely fragmented mask costs
+// an eighth of a byte per byte rather than a table entry per run.
+//
+// An extent of at least a page starts on a page boundary, so that a mapped file can be used in
+// place; smaller ones are packed straight after the one before, so they cost no padding.
+//
+#include <stdio.h>
+#include <string.h>
+#include <makestuff/liberror.h>
+#include <makestuff/libbuffer.h>
+#include "private.h"
+
+#define IMAGE_VERSION 2
+#define IMAGE_CRC 0x00000001
+#define EXTENT_BITMAP 0x00000001
+#define IMAGE_PAGE 4096
+#define HEADER_SIZE 32
+#define EXTENT_SIZE 32
+#define MERGE_GAP EXTENT_SIZE
+
+static const char magic[8] = {'B', 'U', 'F', 'I', 'M', 'A', 'G', 'E'};
+
+static void putField(uint8 *p, uint64 value, uint32 size) {
+  uint32 i;
+  for (i = 0; i < size; i++) {
+    p[i] = (uint8)(value >> (8 * i));
+  }
+}
+
+static uint64 getField(const uint8 *p, uint32 size) {
+  uint64 value = 0;
+  uint32 i;
+  for (i = 0; i < size; i++) {
+    value |= (uint64)p[i] << (8 * i);
+  }
+  return value;
+}
+
+// The usual reflected CRC-32 (as used by zlib), a nibble at a time. Start with a crc of zero, or
+// pass the CRC of the bytes before to continue it.
+//
+static uint32 crc32(uint32 crc, const uint8 *p, size_t length) {
+  static const uint32 table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+  };
+  crc = ~crc;
+  while (length--) {
+    crc ^= *p++;
+    crc = (crc >> 4) ^ table[crc & 0x0F];
+    crc = (crc >> 4) ^ table[crc & 0x0F];
+  }
+  return ~crc;
+}
+
+static uint64 pageAlign(uint64 offset) {
+  return (offset + IMAGE_PAGE - 1) & ~(uint64)(IMAGE_PAGE - 1);
+}
+
+// The size of the bitmap following an extent of the given length and flags.
+//
+static uint64 bitmapSize(uint64 length, uint32 extentFlags) {
+  return (extentFlags & EXTENT_BITMAP) ? length / 8 + ((length & 7) != 0) : 0;
+}
+
+// Write the supplied buffer to a native image file.
+//
+DLLEXPORT(BufferStatus) bufSaveImage(
+  const struct Buffer *sourceData, const struct Buffer *sourceMask, const char *fileName,
+  bool checksum, const char **error)
+{
+  static const uint8 zeros[IMAGE_PAGE] = {0};
+  BufferStatus retVal = BUF_SUCCESS, status;
+  struct Buffer tmpSourceMask = {NULL, 0, 0, 0, false};
+  struct Buffer table = {NULL, 0, 0, 0, false};
+  struct Buffer bitmaps = {NULL, 0, 0, 0, false};
+  struct BufferSink sink;
+  struct SinkBlock blocks[3];
+  uint8 header[HEADER_SIZE], *entry, *bits;
+  size_t address = 0, extentEnd, next, gapEnd, limit, count, i, j, bitmapOffset = 0;
+  uint64 offset, extentLength, bitmapLength, written;
+  uint32 extentFlags, crc;
+  FILE *file = NULL;
+  if (!sourceMask) {
+    status = bufInitialise(&tmpSourceMask, 1024, 0x00, error);
+    CHECK_STATUS(status, status, cleanup, "bufSaveImage()");
+    status = bufDefaultMask(sourceData, false, &tmpSourceMask, error);
+    CHECK_STATUS(status, status, cleanup, "bufSaveImage()");
+    sourceMask = &tmpSourceMask;
+  }
+
+  // Find the masked runs, gathering those separated by small holes into one extent with a
+  // bitmap; the payload offsets are filled in once the size of the table is known
+  //
+  status = bufInitialise(&table, 1024, 0x00, error);
+  CHECK_STATUS(status, status, cleanup, "bufSaveImage()");
+  status = bufInitialise(&bitmaps, 1024, 0x00, error);
+  CHECK_STATUS(status, status, cleanup, "bufSaveImage()");
+  limit = (sourceMask->length < sourceData->length) ? sourceMask->length : sourceData->length;
+  for (;;) {
+    address = bufFindSet(sourceMask->data, address, limit);
+    if (address == limit) {
+      break;
+    }
+    extentEnd = bufFindClear(sourceMask->data, address, limit);
+    extentFlags = 0;
+    for (;;) {
+      gapEnd = (limit - extentEnd > MERGE_GAP) ? extentEnd + MERGE_GAP + 1 : limit;
+      next = bufFindSet(sourceMask->data, extentEnd, gapEnd);
+      if (next == gapEnd) {
+        break;
+      }
+      extentEnd = bufFindClear(sourceMask->data, next, limit);
+      extentFlags = EXTENT_BITMAP;
+    }
+    extentLength = extentEnd - address;
+    crc = checksum ? crc32(0, sourceData->data + address, (size_t)extentLength) : 0;
+    if (extentFlags & EXTENT_BITMAP) {
+      bitmapLength = bitmapSize(extentLength, extentFlags);
+      status = bufAppendConst(&bitmaps, 0x00, (size_t)bitmapLength, error);
+      CHECK_STATUS(status, status, cleanup, "bufSaveImage()");
+      bits = bitmaps.data + bitmaps.length - bitmapLength;
+      for (j = 0; j < extentLength; j++) {
+        if (sourceMask->data[address + j]) {
+          bits[j / 8] = (uint8)(bits[j / 8] | (1 << (j % 8)));
+        }
+      }
+      crc = checksum ? crc32(crc, bits, (size_t)bitmapLength) : 0;
+    }
+    status = bufAppendConst(&table, 0x00, EXTENT_SIZE, error);
+    CHECK_STATUS(status, status, cleanup, "bufSaveImage()");
+    entry = table.data + table.length - EXTENT_SIZE;
+    putField(entry, address, 8);
+    putField(entry + 8, extentLength, 8);
+    putField(entry + 24, crc, 4);
+    putField(entry + 28, extentFlags, 4);
+    address = extentEnd;
+  }
+  count = table.length / EXTENT_SIZE;
+  offset = HEADER_SIZE + table.length;
+  for (i = 0; i < count; i++) {
+    entry = table.data + i * EXTENT_SIZE;
+    extentLength = getField(entry + 8, 8);
+    if (extentLength >= IMAGE_PAGE) {
+      offset = pageAlign(offset);
+    }
+    putField(entry + 16, offset, 8);
+    offset += extentLength + bitmapSize(extentLength, (uint32)getField(entry + 28, 4));
+  }
+  memcpy(header, magic, sizeof(magic));
+  putField(header + 8, IMAGE_VERSION, 4);
+  putField(header + 12, checksum ? IMAGE_CRC : 0, 4);
+  putField(header + 16, sourceData->length, 8);
+  putField(header + 24, count, 8);
+
+  // Write the header and table, then each extent's padding, bytes and bitmap
+  //
+  file = fopen(fileName, "wb");
+  if (!file) {
+    errRenderStd(error);
+    FAIL_RET(BUF_FOPEN, cleanup, "bufSaveImage()");
+  }
+  bufInitFileSink(&sink, file);
+  blocks[0].data = header;
+  blocks[0].length = HEADER_SIZE;
+  blocks[1].data = table.data;
+  blocks[1].length = table.length;
+  status = bufSinkWriteBlocks(&sink, blocks, 2, error);
+  CHECK_STATUS(status, status, cleanup, "bufSaveImage()");
+  written = HEADER_SIZE + table.length;
+  for (i = 0; i < count; i++) {
+    entry = table.data + i * EXTENT_SIZE;
+    offset = getField(entry + 16, 8);
+    extentLength = getField(entry + 8, 8);
+    bitmapLength = bitmapSize(extentLength, (uint32)getField(entry + 28, 4));
+    blocks[0].data = zeros;
+    blocks[0].length = (size_t)(offset - written);
+    blocks[1].data = sourceData->data + getField(entry, 8);
+    blocks[1].length = (size_t)extentLength;
+    blocks[2].data = bitmaps.data + bitmapOffset;
+    blocks[2].length = (size_t)bitmapLength;
+    status = bufSinkWriteBlocks(&sink, blocks, 3, error);
+    CHECK_STATUS(status, status, cleanup, "bufSaveImage()");
+    bitmapOffset += (size_t)bitmapLength;
+    written = offset + extentLength + bitmapLength;
+  }
+  if (fclose(file)) {
+    file = NULL;
+    errRenderStd(error);
+    FAIL_RET(BUF_FERROR, cleanup, "bufSaveImage()");
+  }
+  file = NULL;
+cleanup:
+  if (file) {
+    fclose(file);
+  }
+  if (bitmaps.data) {
+    bufDestroy(&bitmaps);
+  }
+  if (table.data) {
+    bufDestroy(&table);
+  }
+  if (tmpSourceMask.data) {
+    bufDestroy(&tmpSourceMask);
+  }
+  return retVal;
+}
+
+static bool bitSet(const uint8 *bits, uint64 n) {
+  return (bits[n / 8] >> (n % 8)) & 1;
+}
+
+// Read a native image file into a pair of buffers.
+//
+DLLEXPORT(BufferStatus) bufLoadImage(
+  struct Buffer *destData, struct Buffer *destMask, const char *fileName, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  struct MappedFile file;
+  const uint8 *entry, *bits;
+  uint32 version, flags, extentFlags, crc;
+  uint64 length, count, i, address, extentLength, offset, bitmapLength, j, runEnd;
+  uint64 prevEnd = 0;
+
+  status = bufMapFile(&file, fileName, error);
+  CHECK_STATUS(status, status, exit, "bufLoadImage()");
+  bufZeroLength(destData);
+  if (destMask) {
+    bufZeroLength(destMask);
+  }
+  CHECK_STATUS(
+    file.length < HEADER_SIZE || memcmp(file.data, magic, sizeof(magic)), BUF_BAD_IMAGE, cleanup,
+    "bufLoadImage(): Not an image file");
+  version = (uint32)getField(file.data + 8, 4);
+  CHECK_STATUS(
+    version < 1 || version > IMAGE_VERSION, BUF_BAD_IMAGE, cleanup,
+    "bufLoadImage(): Unsupported image version %lu", (unsigned long)version);
+  flags = (uint32)getField(file.data + 12, 4);
+  length = getField(file.data + 16, 8);
+  count = getField(file.data + 24, 8);
+  CHECK_STATUS(
+    flags & ~(uint32)IMAGE_CRC, BUF_BAD_IMAGE, cleanup,
+    "bufLoadImage(): Unsupported image flags 0x%08lX", (unsigned long)flags);
+  CHECK_STATUS(
+    length > (size_t)-1, BUF_NO_MEM, cleanup,
+    "bufLoadImage(): Image is too large to load");
+  CHECK_STATUS(
+    count > (file.length - HEADER_SIZE) / EXTENT_SIZE, BUF_BAD_IMAGE, cleanup,
+    "bufLoadImage(): Extent table is truncated");
+  for (i = 0; i < count; i++) {
+    entry = file.data + HEADER_SIZE + i * EXTENT_SIZE;
+    address = getField(entry, 8);
+    extentLength = getField(entry + 8, 8);
+    offset = getField(entry + 16, 8);
+    extentFlags = (uint32)getField(entry + 28, 4);
+    CHECK_STATUS(
+      extentFlags & ~(uint32)EXTENT_BITMAP, BUF_BAD_IMAGE, cleanup,
+      "bufLoadImage(): Extent %lu has unsupported flags 0x%08lX",
+      (unsigned long)i, (unsigned long)extentFlags);
+    CHECK_STATUS(
+      address < prevEnd || extentLength > length || address > length - extentLength,
+      BUF_BAD_IMAGE, cleanup,
+      "bufLoadImage(): Extent %lu is out of order or beyond the end of the buffer",
+      (unsigned long)i);
+    bitmapLength = bitmapSize(extentLength, extentFlags);
+    CHECK_STATUS(
+      offset > file.length || extentLength > file.length - offset ||
+        bitmapLength > file.length - offset - extentLength,
+      BUF_BAD_IMAGE, cleanup,
+      "bufLoadImage(): Extent %lu is beyond the end of the file",
+      (unsigned long)i);
+    if (flags & IMAGE_CRC) {
+      crc = crc32(0, file.data + offset, (size_t)extentLength);
+      crc = crc32(crc, file.data + offset + extentLength, (size_t)bitmapLength);
+      CHECK_STATUS(
+        crc != (uint32)getField(entry + 24, 4), BUF_BAD_CRC, cleanup,
+        "bufLoadImage(): Extent %lu has a bad CRC", (unsigned long)i);
+    }
+
+    // Copy each masked run of the extent; without a bitmap, the whole extent is one run
+    //
+    bits = file.data + offset + extentLength;
+    j = 0;
+    while (j < extentLength) {
+      if (!bitmapLength) {
+        runEnd = extentLength;
+      } else if (!bitSet(bits, j)) {
+        j++;
+        continue;
+      } else {
+        runEnd = j + 1;
+        while (runEnd < extentLength && bitSet(bits, runEnd)) {
+          runEnd++;
+        }
+      }
+      status = bufWriteBlock(
+        destData, (size_t)(address + j), file.data + offset + j, (size_t)(runEnd - j), error);
+      CHECK_STATUS(status, status, cleanup, "bufLoadImage()");
+      if (destMask) {
+        status = bufWriteConst(
+          destMask, (size_t)(address + j), 0x01, (size_t)(runEnd - j), error);
+        CHECK_STATUS(status, status, cleanup, "bufLoadImage()");
+      }
+      j = runEnd;
+    }
+    prevEnd = address + extentLength;
+  }
+
+  // Anything after the last extent is fill
+  //
+  if (length > destData->length) {
+    status = bufWriteConst(
+      destData, destData->length, destData->fill, (size_t)(length - destData->length), error);
+    CHECK_STATUS(status, status, cleanup, "bufLoadImage()");
+  }
+  if (destMask && length > destMask->length) {
+    status = bufWriteConst(
+      destMask, destMask->length, 0x00, (size_t)(length - destMask->length), error);
+    CHECK_STATUS(status, status, cleanup, "bufLoadImage()");
+  }
+cleanup:
+  bufUnmapFile(&file);
+exit:
+  return retVal;
+}
@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2009-2012 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Read-only access to the whole of a file as one block of memory. Regular files are mmap()'d;
+// anything else (pipes, FIFOs, platforms without mmap()) is read into a Buffer instead.
+//
+#ifndef WIN32
+  #define _FILE_OFFSET_BITS 64
+#endif
+#include <stdio.h>
+#include <makestuff/liberror.h>
+#include <makestuff/libbuffer.h>
+#include "private.h"
+#ifndef WIN32
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+#endif
+
+#define CHUNK_SIZE 65536
+
+#ifdef WIN32
+  // Read the whole of a file into self->copy.
+  //
+  static BufferStatus readWhole(struct MappedFile *self, const char *fileName, const char **error) {
+    BufferStatus retVal = BUF_SUCCESS, status;
+    uint8 chunk[CHUNK_SIZE];
+    size_t bytesRead;
+    FILE *file = fopen(fileName, "rb");
+    if (!file) {
+      errRenderStd(error);
+      FAIL_RET(BUF_FOPEN, cleanup, "readWhole()");
+    }
+    do {
+      bytesRead = fread(chunk, 1, CHUNK_SIZE, file);
+      status = bufAppendBlock(&self->copy, chunk, bytesRead, error);
+      CHECK_STATUS(status, status, cleanup, "readWhole()");
+    } while (bytesRead == CHUNK_SIZE);
+    if (ferror(file)) {
+      errRenderStd(error);
+      FAIL_RET(BUF_FERROR, cleanup, "readWhole()");
+    }
+  cleanup:
+    if (file) {
+      fclose(file);
+    }
+    return retVal;
+  }
+#else
+  // Read from a descriptor until EOF into self->copy.
+  //
+  static BufferStatus readWhole(struct MappedFile *self, int fd, const char **error) {
+    BufferStatus retVal = BUF_SUCCESS, status;
+    uint8 chunk[CHUNK_SIZE];
+    ssize_t bytesRead;
+    for (;;) {
+      bytesRead = read(fd, chunk, CHUNK_SIZE);
+      if (bytesRead == 0) {
+        break;
+      }
+      if (bytesRead < 0) {
+        errRenderStd(error);
+        FAIL_RET(BUF_FERROR, cleanup, "readWhole()");
+      }
+      status = bufAppendBlock(&self->copy, chunk, (size_t)bytesRead, error);
+      CHECK_STATUS(status, status, cleanup, "readWhole()");
+    }
+  cleanup:
+    return retVal;
+  }
+#endif
+
+// Make the whole of the named file available at self->data.
+//
+BufferStatus bufMapFile(struct MappedFile *self, const char *fileName, const char **error) {
+  BufferStatus retVal = BUF_SUCCESS, status;
+  #ifndef WIN32
+    struct stat st;
+    void *ptr;
+    const int fd = open(fileName, O_RDONLY);
+  #endif
+  self->data = NULL;
+  self->length = 0;
+  self->mapped = false;
+  self->copy.data = NULL;
+  #ifdef WIN32
+    status = bufInitialise(&self->copy, CHUNK_SIZE, 0x00, error);
+    CHECK_STATUS(status, status, cleanup, "bufMapFile()");
+    status = readWhole(self, fileName, error);
+    CHECK_STATUS(status, status, cleanup, "bufMapFile()");
+  #else
+    if (fd < 0) {
+      errRenderStd(error);
+      FAIL_RET(BUF_FOPEN, cleanup, "bufMapFile()");
+    }
+    if (fstat(fd, &st)) {
+      errRenderStd(error);
+      FAIL_RET(BUF_FERROR, cleanup, "bufMapFile()");
+    }
+    if (S_ISREG(st.st_mode)) {
+      if (st.st_size == 0) {
+        goto cleanup;
+      }
+      CHECK_STATUS(
+        (uint64)st.st_size > (size_t)-1, BUF_NO_MEM, cleanup,
+        "bufMapFile(): File is too large to map");
+      ptr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (ptr != MAP_FAILED) {
+        self->data = (const uint8 *)ptr;
+        self->length = (size_t)st.st_size;
+        self->mapped = true;
+        goto cleanup;
+      }
+    }
+    status = bufInitialise(&self->copy, CHUNK_SIZE, 0x00, error);
+    CHECK_STATUS(status, status, cleanup, "bufMapFile()");
+    status = readWhole(self, fd, error);
+    CHECK_STATUS(status, status, cleanup, "bufMapFile()");
+  #endif
+  self->data = self->copy.data;
+  self->length = self->copy.length;
+cleanup:
+  #ifndef WIN32
+    if (fd >= 0) {
+      close(fd);
+    }
+  #endif
+  if (retVal) {
+    bufUnmapFile(self);
+  }
+  return retVal;
+}
+
+// Release the memory made available by bufMapFile().
+//
+void bufUnmapFile(struct MappedFile *self) {
+  #ifndef WIN32
+    if (self->mapped) {
+      munmap((void *)self->data, self->length);
+    }
+  #endif
+  if (self->copy.data) {
+    bufDestroy(&self->copy);
+  }
+  self->data = NULL;
+  self->length = 0;
+  self->mapped = false;
+}
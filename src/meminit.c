@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2009-2012 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Memory initialisation files for FPGA block RAMs: one word per line, as hex digits, wrapped in
+// whatever each vendor's format needs. Lines go through the same output block as the Intel hex
+// writer.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <makestuff/liberror.h>
+#include <makestuff/libbuffer.h>
+#include "conv.h"
+#include "private.h"
+
+// The widest word supported, in bytes.
+//
+#define MAX_WORD 32
+
+// Append some text (shorter than OUT_LINE_MAX) to the output.
+//
+static void writeText(struct HexOutput *out, const char *text) {
+  const size_t length = strlen(text);
+  char *const p = bufOutputLine(out);
+  if (p) {
+    memcpy(p, text, length);
+    out->used += length;
+  }
+}
+
+// Write one line holding the word at data (wordSize bytes), most significant digit first, with
+// an optional address before it and the given text after it.
+//
+static void writeWord(
+  struct HexOutput *out, const uint8 *data, uint32 wordSize, bool bigEndian, bool withAddress,
+  uint32 address, uint8 addressDigits, const char *suffix)
+{
+  uint8 word[MAX_WORD];
+  const size_t suffixLength = strlen(suffix);
+  uint32 i;
+  char *p = bufOutputLine(out);
+  if (!p) {
+    return;
+  }
+  if (withAddress) {
+    *p++ = ' ';
+    *p++ = ' ';
+    for (i = addressDigits; i; i--) {
+      *p++ = getHexLowerNibble((uint8)(address >> (4 * (i - 1))));
+    }
+    *p++ = ' ';
+    *p++ = ':';
+    *p++ = ' ';
+  }
+  if (bigEndian) {
+    putHexBytes(data, wordSize, p);
+  } else {
+    for (i = 0; i < wordSize; i++) {
+      word[i] = data[wordSize - 1 - i];
+    }
+    putHexBytes(word, wordSize, p);
+  }
+  p += 2 * wordSize;
+  memcpy(p, suffix, suffixLength);
+  out->used = (size_t)(p + suffixLength - out->block);
+}
+
+// Write the buffer as a memory initialisation file in the given format.
+//
+static BufferStatus writeMemInit(
+  const struct BufferSink *sink, const struct Buffer *self, MemInitFormat format,
+  uint32 wordSize, bool bigEndian, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS;
+  struct HexOutput *out = NULL;
+  uint8 last[MAX_WORD];
+  char header[128];
+  size_t numWords, i;
+  uint8 addressDigits = 1;
+  const uint8 *word;
+  CHECK_STATUS(
+    wordSize < 1 || wordSize > MAX_WORD, BUF_BAD_MEMINIT, cleanup,
+    "writeMemInit(): Word size must be from 1 to %d bytes", MAX_WORD
+  );
+  CHECK_STATUS(
+    format != MEMINIT_READMEMH && format != MEMINIT_MIF && format != MEMINIT_COE,
+    BUF_BAD_MEMINIT, cleanup,
+    "writeMemInit(): Unknown format %d", (int)format
+  );
+  numWords = (self->length + wordSize - 1) / wordSize;
+  CHECK_STATUS(
+    (uint64)numWords > 0xFFFFFFFFULL, BUF_BAD_MEMINIT, cleanup,
+    "writeMemInit(): Too many words"
+  );
+  while (numWords && addressDigits < 8 && (numWords - 1) >> (4 * addressDigits)) {
+    addressDigits++;
+  }
+  out = bufNewOutput(sink, error);
+  CHECK_STATUS(!out, BUF_NO_MEM, cleanup, "writeMemInit(): Cannot allocate output block");
+
+  if (format == MEMINIT_MIF) {
+    sprintf(
+      header,
+      "WIDTH=%lu;\nDEPTH=%lu;\n\nADDRESS_RADIX=HEX;\nDATA_RADIX=HEX;\n\nCONTENT BEGIN\n",
+      (unsigned long)(8 * wordSize), (unsigned long)numWords);
+    writeText(out, header);
+  } else if (format == MEMINIT_COE) {
+    writeText(out, "memory_initialization_radix=16;\nmemory_initialization_vector=\n");
+  }
+
+  // The last word may be short, in which case it is padded with the fill byte
+  //
+  for (i = 0; i < numWords; i++) {
+    word = self->data + i * wordSize;
+    if ((i + 1) * wordSize > self->length) {
+      memset(last, self->fill, wordSize);
+      memcpy(last, word, self->length - i * wordSize);
+      word = last;
+    }
+    switch (format) {
+    case MEMINIT_MIF:
+      writeWord(out, word, wordSize, bigEndian, true, (uint32)i, addressDigits, ";\n");
+      break;
+    case MEMINIT_COE:
+      writeWord(out, word, wordSize, bigEndian, false, 0, 0, (i + 1 < numWords) ? ",\n" : ";\n");
+      break;
+    default:
+      writeWord(out, word, wordSize, bigEndian, false, 0, 0, "\n");
+      break;
+    }
+  }
+  if (format == MEMINIT_MIF) {
+    writeText(out, "END;\n");
+  } else if (format == MEMINIT_COE && !numWords) {
+    writeText(out, ";\n");
+  }
+  if (!out->status) {
+    out->status = bufFlushOutput(out);
+  }
+  CHECK_STATUS(out->status, out->status, cleanup, "writeMemInit()");
+cleanup:
+  free(out);
+  return retVal;
+}
+
+// Write a buffer as a memory initialisation file.
+//
+DLLEXPORT(BufferStatus) bufWriteMemInitFile(
+  const struct Buffer *self, const char *fileName, MemInitFormat format, uint32 wordSize,
+  bool bigEndian, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  struct BufferSink sink;
+  FILE *const file = fopen(fileName, "wb");
+  if (!file) {
+    errRenderStd(error);
+    FAIL_RET(BUF_FOPEN, exit, "bufWriteMemInitFile()");
+  }
+  bufInitFileSink(&sink, file);
+  status = writeMemInit(&sink, self, format, wordSize, bigEndian, error);
+  if (status) {
+    fclose(file);
+    FAIL_RET(status, exit, "bufWriteMemInitFile()");
+  }
+  if (fclose(file)) {
+    errRenderStd(error);
+    FAIL_RET(BUF_FERROR, exit, "bufWriteMemInitFile()");
+  }
+exit:
+  return retVal;
+}
+
+// Write a buffer as a memory initialisation file to a sink.
+//
+DLLEXPORT(BufferStatus) bufWriteMemInitSink(
+  const struct Buffer *self, const struct BufferSink *sink, MemInitFormat format,
+  uint32 wordSize, bool bigEndian, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  status = writeMemInit(sink, self, format, wordSize, bigEndian, error);
+  CHECK_STATUS(status, status, cleanup, "bufWriteMemInitSink()");
+cleanup:
+  return retVal;
+}
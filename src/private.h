@@ -24,15 +24,187 @@
 extern "C" {
 #endif
 
+  // Op codes used in the delta stream produced by bufMakeDelta().
+  //
+  typedef enum {
+    DELTA_END = 0x00,
+    DELTA_COPY,
+    DELTA_INSERT,
+    DELTA_FILL
+  } DeltaOp;
+
+  extern const uint8 bufDeltaMagic[4];
+
+  typedef enum {
+    DATA_RECORD = 0x00,
+    EOF_RECORD,
+    EXT_SEG_RECORD,
+    START_SEG_RECORD,
+    EXT_LIN_RECORD,
+    START_LIN_RECORD
+  } RecordType;
+
+  // Summary of a run of Intel hex lines, gathered by bufScanRecords() without decoding the data.
+  // The "segment" is the linear address set by the last EXT_SEG or EXT_LIN record.
+  //
+  #define SCAN_NO_DATA ((size_t)-1)
+  struct HexScan {
+    uint32 lineCount;            // lines scanned, including any line the scan stopped at
+    bool stopped;                // scan stopped at an EOF record or a line it did not understand
+    const char *stopEnd;         // end of the scanned lines (after any stop line)
+    bool sawSegment;             // whether any EXT_SEG or EXT_LIN record was seen
+    uint32 segment;              // the segment in effect after the last line scanned
+    size_t lowestBeforeSegment;  // start of the lowest data record before the first segment
+    size_t extentBeforeSegment;  // end of the highest data record before the first segment
+    size_t lowest;               // start of the lowest data record after the first segment
+    size_t extent;               // end of the highest data record after the first segment
+  };
+
+  void bufScanRecords(
+    const char *p, const char *end, struct HexScan *scan
+  );
+
+  BufferStatus bufMakeRoom(
+    struct Buffer *self, size_t count, const char **error
+  ) WARN_UNUSED_RESULT;
+
+  // A whole file made available in memory by bufMapFile(). Regular files are mmap()'d; anything
+  // else is read into the copy buffer.
+  //
+  struct MappedFile {
+    const uint8 *data;
+    size_t length;
+    bool mapped;
+    struct Buffer copy;
+  };
+
+  BufferStatus bufMapFile(
+    struct MappedFile *self, const char *fileName, const char **error
+  ) WARN_UNUSED_RESULT;
+
+  void bufUnmapFile(
+    struct MappedFile *self
+  );
+
+  // A decoded Intel hex record.
+  //
+  struct HexRecord {
+    uint8 recordType;
+    uint8 byteCount;
+    uint16 address;
+    uint8 data[256];  // data bytes, then checksum
+  };
+
+  BufferStatus bufDecodeRecord(
+    const char *sourceLine, size_t lineLength, uint32 lineNumber, uint32 *seg,
+    struct HexRecord *record, const char **error
+  ) WARN_UNUSED_RESULT;
+
+  // A run of consecutive data records whose mask bytes have not been written yet.
+  //
+  struct MaskRun {
+    size_t start;
+    size_t length;
+  };
+
+  BufferStatus bufStoreRecord(
+    const struct HexRecord *record, uint32 lineNumber, struct Buffer *destData,
+    struct Buffer *destMask, uint32 seg, uint32 baseAddress, struct MaskRun *run,
+    const char **error
+  ) WARN_UNUSED_RESULT;
+
+  BufferStatus bufFlushMaskRun(
+    struct Buffer *destMask, struct MaskRun *run, const char **error
+  ) WARN_UNUSED_RESULT;
+
+  void bufReserveExtent(
+    struct Buffer *destData, struct Buffer *destMask, size_t extent, size_t textLength
+  );
+
+  BufferStatus bufProcessRecord(
+    const char *sourceLine, size_t lineLength, uint32 lineNumber, struct Buffer *destData,
+    struct Buffer *destMask, uint32 *seg, uint32 baseAddress, uint8 *recordType,
+    const char **error
+  ) WARN_UNUSED_RESULT;
+
+  BufferStatus bufReadMappedIntelHex(
+    const char *p, const char *end, struct Buffer *destData, struct Buffer *destMask,
+    const char **error
+  ) WARN_UNUSED_RESULT;
+
   BufferStatus bufProcessLine(
     const char *sourceLine, uint32 lineNumber, struct Buffer *destData, struct Buffer *destMask,
     uint32 *seg, uint8 *recordType, const char **error
   ) WARN_UNUSED_RESULT;
 
+  BufferStatus bufHexIndexBuildMapped(
+    const char *start, const char *end, bool quick, struct Buffer *index, const char **error
+  ) WARN_UNUSED_RESULT;
+
+  BufferStatus bufHexIndexCheck(
+    const struct Buffer *index, size_t textLength, uint32 *count, const char **error
+  ) WARN_UNUSED_RESULT;
+
+  void bufHexIndexEntry(
+    const struct Buffer *index, uint32 i, uint32 *address, uint32 *length
+  );
+
+  BufferStatus bufHexIndexReadMapped(
+    const struct Buffer *index, uint32 count, const char *start, const char *end,
+    uint32 address, size_t length, uint8 *data, uint8 *mask, const char **error
+  ) WARN_UNUSED_RESULT;
+
+  BufferStatus bufHexIndexReadEntries(
+    const struct Buffer *index, const uint32 *entries, size_t numEntries, const char *start,
+    const char *end, uint32 address, size_t length, uint8 *data, uint8 *mask,
+    const char **error
+  ) WARN_UNUSED_RESULT;
+
   BufferStatus bufDeriveMask(
     const struct Buffer *sourceData, struct Buffer *destMask, const char **error
   ) WARN_UNUSED_RESULT;
 
+  BufferStatus bufDefaultMask(
+    const struct Buffer *sourceData, bool compress, struct Buffer *destMask, const char **error
+  ) WARN_UNUSED_RESULT;
+
+  // The size of a writer's output block, and the longest line it may have to hold.
+  //
+  #define OUT_BLOCK 65536
+  #define OUT_LINE_MAX (1 + 2 * (4 + 255 + 1) + 1)
+
+  // Where a writer's text goes. Lines are formatted into block, and handed on to the sink
+  // whenever it is nearly full. Handing on can fail, so the first failure is kept in status and
+  // checked once at the end.
+  //
+  struct HexOutput {
+    const struct BufferSink *sink;
+    BufferStatus status;
+    const char **error;
+    size_t used;
+    char block[OUT_BLOCK];
+  };
+
+  struct HexOutput *bufNewOutput(const struct BufferSink *sink, const char **error);
+
+  BufferStatus bufFlushOutput(struct HexOutput *out) WARN_UNUSED_RESULT;
+
+  char *bufOutputLine(struct HexOutput *out);
+
+  size_t bufFindSet(const uint8 *mask, size_t from, size_t to);
+
+  size_t bufFindClear(const uint8 *mask, size_t from, size_t to);
+
+  BufferStatus bufSinkWriteBlocks(
+    const struct BufferSink *sink, const struct SinkBlock *blocks, size_t count,
+    const char **error
+  ) WARN_UNUSED_RESULT;
+
+  BufferStatus bufWriteHexWindows(
+    struct Buffer *text, const struct Buffer *sourceData, const struct Buffer *sourceMask,
+    uint32 baseAddress, size_t address, size_t end, uint8 lineLength, const char **error
+  ) WARN_UNUSED_RESULT;
+
 #ifdef __cplusplus
 }
 #endif
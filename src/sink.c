@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2009-2012 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Output sinks: the stock ones for stdio streams, file descriptors and Buffers, and the helper the
+// writers use to hand a batch of blocks to whichever sink they were given.
+//
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <makestuff/liberror.h>
+#include <makestuff/libbuffer.h>
+#include "private.h"
+#ifdef WIN32
+  #include <io.h>
+#else
+  #include <unistd.h>
+  #include <sys/uio.h>
+#endif
+
+// The most blocks given to one writev() call.
+//
+#define MAX_IOV 64
+
+static BufferStatus fileWrite(
+  void *context, const uint8 *data, size_t length, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS;
+  if (fwrite(data, 1, length, (FILE *)context) != length) {
+    errRenderStd(error);
+    FAIL_RET(BUF_FERROR, cleanup, "fileWrite()");
+  }
+cleanup:
+  return retVal;
+}
+
+static BufferStatus descriptorWrite(
+  void *context, const uint8 *data, size_t length, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS;
+  const int fd = (int)(intptr_t)context;
+  #ifdef WIN32
+    int written;
+  #else
+    ssize_t written;
+  #endif
+  while (length) {
+    #ifdef WIN32
+      written = _write(fd, data, (unsigned int)(length > 0x40000000 ? 0x40000000 : length));
+    #else
+      written = write(fd, data, length);
+    #endif
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      errRenderStd(error);
+      FAIL_RET(BUF_FERROR, cleanup, "descriptorWrite()");
+    }
+    data += written;
+    length -= (size_t)written;
+  }
+cleanup:
+  return retVal;
+}
+
+#ifndef WIN32
+  // Write a batch of blocks with as few writev() calls as possible, picking up where a short
+  // write left off.
+  //
+  static BufferStatus descriptorWriteVector(
+    void *context, const struct SinkBlock *blocks, size_t count, const char **error)
+  {
+    BufferStatus retVal = BUF_SUCCESS;
+    const int fd = (int)(intptr_t)context;
+    struct iovec iov[MAX_IOV];
+    size_t done = 0;  // bytes of blocks[0] already written
+    size_t n, i;
+    ssize_t written;
+    while (count) {
+      n = (count < MAX_IOV) ? count : MAX_IOV;
+      for (i = 0; i < n; i++) {
+        iov[i].iov_base = (void *)(blocks[i].data + (i ? 0 : done));
+        iov[i].iov_len = blocks[i].length - (i ? 0 : done);
+      }
+      written = writev(fd, iov, (int)n);
+      if (written < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        errRenderStd(error);
+        FAIL_RET(BUF_FERROR, cleanup, "descriptorWriteVector()");
+      }
+      done += (size_t)written;
+      while (count && done >= blocks->length) {
+        done -= blocks->length;
+        blocks++;
+        count--;
+      }
+    }
+  cleanup:
+    return retVal;
+  }
+#endif
+
+static BufferStatus bufferWrite(
+  void *context, const uint8 *data, size_t length, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  status = bufAppendBlock((struct Buffer *)context, data, length, error);
+  CHECK_STATUS(status, status, cleanup, "bufferWrite()");
+cleanup:
+  return retVal;
+}
+
+// Make a sink which writes to a stdio stream.
+//
+DLLEXPORT(void) bufInitFileSink(struct BufferSink *self, FILE *file) {
+  self->write = fileWrite;
+  self->writeVector = NULL;
+  self->context = file;
+}
+
+// Make a sink which writes to a file descriptor.
+//
+DLLEXPORT(void) bufInitDescriptorSink(struct BufferSink *self, int fd) {
+  self->write = descriptorWrite;
+  #ifdef WIN32
+    self->writeVector = NULL;
+  #else
+    self->writeVector = descriptorWriteVector;
+  #endif
+  self->context = (void *)(intptr_t)fd;
+}
+
+// Make a sink which appends to a Buffer.
+//
+DLLEXPORT(void) bufInitBufferSink(struct BufferSink *self, struct Buffer *dest) {
+  self->write = bufferWrite;
+  self->writeVector = NULL;
+  self->context = dest;
+}
+
+// Give a batch of blocks to a sink: all at once if it can take them that way, otherwise one at a
+// time.
+//
+BufferStatus bufSinkWriteBlocks(
+  const struct BufferSink *sink, const struct SinkBlock *blocks, size_t count,
+  const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  size_t i;
+  if (sink->writeVector) {
+    status = sink->writeVector(sink->context, blocks, count, error);
+    CHECK_STATUS(status, status, cleanup, "bufSinkWriteBlocks()");
+  } else {
+    for (i = 0; i < count; i++) {
+      status = sink->write(sink->context, blocks[i].data, blocks[i].length, error);
+      CHECK_STATUS(status, status, cleanup, "bufSinkWriteBlocks()");
+    }
+  }
+cleanup:
+  return retVal;
+}
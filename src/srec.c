@@ -0,0 +1,306 @@
+/*
+ * Copyright (C) 2009-2012 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Motorola S-record files. A line looks like:
+//
+//   S t cc aa..aa dd..dd ss
+//
+// where t is the record type, cc the number of bytes which follow, aa..aa a big-endian address of
+// two, three or four bytes (depending on t), and ss the ones' complement of the sum of the other
+// bytes. S1, S2 and S3 hold data; S7, S8 and S9 end the file; S0 is a header, and S5 and S6 give
+// a record count, both of which are checked but otherwise ignored.
+//
+// The reader and writer use the same digit kernels, mask handling and output blocks as the Intel
+// hex code.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <makestuff/liberror.h>
+#include <makestuff/libbuffer.h>
+#include "conv.h"
+#include "private.h"
+
+// The number of address bytes for each record type, or zero for an unknown type.
+//
+static const uint8 addressSize[10] = {2, 2, 3, 4, 0, 2, 3, 4, 3, 2};
+
+struct SRecord {
+  char type;
+  uint8 byteCount;
+  uint32 address;
+  const uint8 *data;
+  uint8 bytes[255];
+};
+
+// Decode and check one line.
+//
+static BufferStatus decodeSRecord(
+  const char *line, size_t length, uint32 lineNumber, struct SRecord *record, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS;
+  uint8 count, size, sum;
+  size_t badIndex, i;
+  bool lowerCase;
+  if (length && line[length - 1] == '\r') {
+    length--;
+  }
+  CHECK_STATUS(
+    length < 4 || line[0] != 'S' || line[1] < '0' || line[1] > '9' || !addressSize[line[1] - '0'],
+    SREC_BAD_RECORD, cleanup,
+    "decodeSRecord(): Not an S-record at line %lu", lineNumber
+  );
+  record->type = line[1];
+  size = addressSize[line[1] - '0'];
+  CHECK_STATUS(
+    getHexBytes(line + 2, 1, &count, &badIndex, &lowerCase) ||
+    count < size + 1 || length != 4 + 2 * (size_t)count,
+    SREC_BAD_RECORD, cleanup,
+    "decodeSRecord(): Bad byte count at line %lu", lineNumber
+  );
+  CHECK_STATUS(
+    getHexBytes(line + 4, count, record->bytes, &badIndex, &lowerCase),
+    SREC_BAD_RECORD, cleanup,
+    "decodeSRecord(): Illegal character at line %lu column %lu",
+    lineNumber, (unsigned long)(badIndex + 5)
+  );
+  sum = count;
+  for (i = 0; i < count; i++) {
+    sum = (uint8)(sum + record->bytes[i]);
+  }
+  CHECK_STATUS(
+    sum != 0xFF, SREC_BAD_CHECKSUM, cleanup,
+    "decodeSRecord(): Checksum mismatch at line %lu", lineNumber
+  );
+  record->address = 0;
+  for (i = 0; i < size; i++) {
+    record->address = (record->address << 8) | record->bytes[i];
+  }
+  record->data = record->bytes + size;
+  record->byteCount = (uint8)(count - size - 1);
+cleanup:
+  return retVal;
+}
+
+// Read Motorola S-records from a file.
+//
+DLLEXPORT(BufferStatus) bufReadFromSRecordFile(
+  struct Buffer *destData, struct Buffer *destMask, const char *fileName, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  struct MappedFile file;
+  struct SRecord record;
+  struct HexRecord hexRecord;
+  struct MaskRun run = {0, 0};
+  uint32 lineNumber = 1;
+  bool ended = false;
+  const char *p, *end, *eol;
+
+  status = bufMapFile(&file, fileName, error);
+  CHECK_STATUS(status, status, exit, "bufReadFromSRecordFile()");
+  bufZeroLength(destData);
+  if (destMask) {
+    bufZeroLength(destMask);
+  }
+  CHECK_STATUS(
+    !file.length, HEX_EMPTY_FILE, cleanup,
+    "bufReadFromSRecordFile(): Empty file!"
+  );
+  p = (const char *)file.data;
+  end = p + file.length;
+  hexRecord.recordType = DATA_RECORD;
+  while (p < end && !ended) {
+    eol = (const char *)memchr(p, '\n', (size_t)(end - p));
+    if (!eol) {
+      eol = end;
+    }
+    status = decodeSRecord(p, (size_t)(eol - p), lineNumber, &record, error);
+    CHECK_STATUS(status, status, cleanup, "bufReadFromSRecordFile()");
+    if (record.type >= '1' && record.type <= '3') {
+      // Stored as an Intel hex data record, so the mask runs are gathered the same way
+      CHECK_STATUS(
+        (uint64)record.address + record.byteCount > 0x100000000ULL, SREC_BAD_RECORD, cleanup,
+        "bufReadFromSRecordFile(): Data beyond 4GiB at line %lu", lineNumber
+      );
+      hexRecord.byteCount = record.byteCount;
+      hexRecord.address = (uint16)(record.address & 0xFFFF);
+      memcpy(hexRecord.data, record.data, record.byteCount);
+      status = bufStoreRecord(
+        &hexRecord, lineNumber, destData, destMask, record.address & 0xFFFF0000, 0x00000000,
+        &run, error);
+      CHECK_STATUS(status, status, cleanup, "bufReadFromSRecordFile()");
+    } else if (record.type >= '7') {
+      ended = true;
+    }
+    lineNumber++;
+    p = (eol < end) ? eol + 1 : end;
+  }
+  status = bufFlushMaskRun(destMask, &run, error);
+  CHECK_STATUS(status, status, cleanup, "bufReadFromSRecordFile()");
+  CHECK_STATUS(
+    !ended, SREC_MISSING_END, cleanup,
+    "bufReadFromSRecordFile(): Premature end of file - no S7, S8 or S9 record found!"
+  );
+cleanup:
+  bufUnmapFile(&file);
+exit:
+  return retVal;
+}
+
+// Write one S-record, ending with a newline.
+//
+static void writeSRecord(
+  struct HexOutput *out, char type, uint32 address, const uint8 *data, uint8 byteCount)
+{
+  const uint8 size = addressSize[type - '0'];
+  uint8 header[5], i, sum;
+  char *p = bufOutputLine(out);
+  if (!p) {
+    return;
+  }
+  header[0] = (uint8)(size + byteCount + 1);
+  for (i = size; i; i--) {
+    header[i] = (uint8)address;
+    address >>= 8;
+  }
+  sum = 0;
+  for (i = 0; i <= size; i++) {
+    sum = (uint8)(sum + header[i]);
+  }
+  for (i = 0; i < byteCount; i++) {
+    sum = (uint8)(sum + data[i]);
+  }
+  sum = (uint8)~sum;
+  p[0] = 'S';
+  p[1] = type;
+  putHexBytes(header, (size_t)size + 1, p + 2);
+  p += 4 + 2 * (size_t)size;
+  putHexBytes(data, byteCount, p);
+  p += 2 * (size_t)byteCount;
+  putHexBytes(&sum, 1, p);
+  p[2] = '\n';
+  out->used = (size_t)(p + 3 - out->block);
+}
+
+// Write the supplied buffer as S-records to a sink, using the smallest address size which reaches
+// the end of the buffer.
+//
+static BufferStatus writeSRecords(
+  const struct BufferSink *sink, const struct Buffer *sourceData, const struct Buffer *sourceMask,
+  uint8 lineLength, bool compress, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  struct Buffer tmpSourceMask = {NULL, 0, 0, 0, false};
+  struct HexOutput *out = NULL;
+  size_t address = 0, runEnd, recordCount = 0;
+  uint8 size, maxLength, bytesToWrite;
+  char dataType;
+  CHECK_STATUS(
+    (uint64)sourceData->length > 0x100000000ULL, HEX_BAD_EXT_LIN, cleanup,
+    "writeSRecords(): Addresses above 4GiB cannot be represented"
+  );
+  if (!sourceMask) {
+    status = bufInitialise(&tmpSourceMask, 1024, 0x00, error);
+    CHECK_STATUS(status, status, cleanup, "writeSRecords()");
+    status = bufDefaultMask(sourceData, compress, &tmpSourceMask, error);
+    CHECK_STATUS(status, status, cleanup, "writeSRecords()");
+    sourceMask = &tmpSourceMask;
+  }
+  if (sourceMask->length <= 0x10000) {
+    dataType = '1';
+  } else if (sourceMask->length <= 0x1000000) {
+    dataType = '2';
+  } else {
+    dataType = '3';
+  }
+  size = addressSize[dataType - '0'];
+  maxLength = (uint8)(255 - size - 1);
+  if (!lineLength || lineLength > maxLength) {
+    lineLength = maxLength;
+  }
+  out = bufNewOutput(sink, error);
+  CHECK_STATUS(!out, BUF_NO_MEM, cleanup, "writeSRecords(): Cannot allocate output block");
+  writeSRecord(out, '0', 0x0000, NULL, 0);
+  for (;;) {
+    address = bufFindSet(sourceMask->data, address, sourceMask->length);
+    if (address == sourceMask->length) {
+      break;
+    }
+    runEnd = (address + lineLength < sourceMask->length) ?
+      address + lineLength : sourceMask->length;
+    bytesToWrite = (uint8)(bufFindClear(sourceMask->data, address, runEnd) - address);
+    writeSRecord(out, dataType, (uint32)address, sourceData->data + address, bytesToWrite);
+    address += bytesToWrite;
+    recordCount++;
+  }
+  if (recordCount <= 0xFFFF) {
+    writeSRecord(out, '5', (uint32)recordCount, NULL, 0);
+  } else if (recordCount <= 0xFFFFFF) {
+    writeSRecord(out, '6', (uint32)recordCount, NULL, 0);
+  }
+  writeSRecord(out, (char)('9' + '1' - dataType), 0x00000000, NULL, 0);  // S9, S8 or S7
+  if (!out->status) {
+    out->status = bufFlushOutput(out);
+  }
+  CHECK_STATUS(out->status, out->status, cleanup, "writeSRecords()");
+cleanup:
+  free(out);
+  if (tmpSourceMask.data) {
+    bufDestroy(&tmpSourceMask);
+  }
+  return retVal;
+}
+
+// Write the supplied buffer as S-records to a file.
+//
+DLLEXPORT(BufferStatus) bufWriteToSRecordFile(
+  const struct Buffer *sourceData, const struct Buffer *sourceMask, const char *fileName,
+  uint8 lineLength, bool compress, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  struct BufferSink sink;
+  FILE *const file = fopen(fileName, "wb");
+  if (!file) {
+    errRenderStd(error);
+    FAIL_RET(BUF_FOPEN, exit, "bufWriteToSRecordFile()");
+  }
+  bufInitFileSink(&sink, file);
+  status = writeSRecords(&sink, sourceData, sourceMask, lineLength, compress, error);
+  if (status) {
+    fclose(file);
+    FAIL_RET(status, exit, "bufWriteToSRecordFile()");
+  }
+  if (fclose(file)) {
+    errRenderStd(error);
+    FAIL_RET(BUF_FERROR, exit, "bufWriteToSRecordFile()");
+  }
+exit:
+  return retVal;
+}
+
+// Write the supplied buffer as S-records to a sink.
+//
+DLLEXPORT(BufferStatus) bufWriteToSRecordSink(
+  const struct Buffer *sourceData, const struct Buffer *sourceMask,
+  const struct BufferSink *sink, uint8 lineLength, bool compress, const char **error)
+{
+  BufferStatus retVal = BUF_SUCCESS, status;
+  status = writeSRecords(sink, sourceData, sourceMask, lineLength, compress, error);
+  CHECK_STATUS(status, status, cleanup, "bufWriteToSRecordSink()");
+cleanup:
+  return retVal;
+}
@@ -17,6 +17,7 @@
 #include <gtest/gtest.h>
 #include <cstring>
 #include <fstream>
+#include <string>
 #include <makestuff/libbuffer.h>
 
 TEST(BinIO, testReadNonExistentFile) {
@@ -49,6 +50,79 @@ TEST(BinIO, testReadExistingFile) {
   bufDestroy(&buf);
 }
 
+TEST(BinIO, testReadFileRange) {
+  const char *const FILENAME = "tmpFile.bin";
+  const char *const DATA = "Just some test data";
+  std::ofstream file;
+  Buffer buf;
+  BufferStatus status = bufInitialise(&buf, 4, 0xEE, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  file.open(FILENAME, std::ios::out|std::ios::binary);
+  file << DATA;
+  file.close();
+  status = bufAppendFromBinaryFileRange(&buf, FILENAME, 5, 4, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufAppendFromBinaryFileRange(&buf, FILENAME, 15, 4, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufAppendFromBinaryFileRange(&buf, FILENAME, 19, 0, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(8UL, buf.length);
+  ASSERT_EQ(0, std::memcmp("somedata", buf.data, buf.length));
+
+  // Running off the end of the file reads nothing
+  status = bufAppendFromBinaryFileRange(&buf, FILENAME, 16, 4, NULL);
+  ASSERT_EQ(BUF_FEOF, status);
+  ASSERT_EQ(8UL, buf.length);
+  for (size_t i = buf.length; i < buf.capacity; i++) {
+    ASSERT_EQ(0xEE, buf.data[i]);
+  }
+  bufDestroy(&buf);
+}
+
+TEST(BinIO, testMapFile) {
+  const char *const FILENAME = "tmpFile.bin";
+  const char *const DATA = "Just some test data";
+  const size_t length = std::strlen(DATA);
+  std::ofstream file;
+  Buffer buf, copy;
+  BufferStatus status;
+  file.open(FILENAME, std::ios::out|std::ios::binary);
+  file << DATA;
+  file.close();
+  status = bufMapBinaryFile(&buf, FILENAME, 0xEE, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(length, buf.length);
+  ASSERT_EQ(0, std::memcmp(DATA, buf.data, length));
+#ifndef WIN32
+  ASSERT_TRUE(buf.mapped);
+#endif
+
+  // Writing in place leaves the file alone
+  status = bufWriteByte(&buf, 0, 'j', NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&copy, 8, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufAppendFromBinaryFile(&copy, FILENAME, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(0, std::memcmp(DATA, copy.data, length));
+
+  // Growing moves the data to the heap, and fills the rest as usual
+  status = bufAppendByte(&buf, '!', NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(length + 1, buf.length);
+  ASSERT_FALSE(buf.mapped);
+  ASSERT_EQ(0, std::memcmp("just some test data!", buf.data, buf.length));
+  for (size_t i = buf.length; i < buf.capacity; i++) {
+    ASSERT_EQ(0xEE, buf.data[i]);
+  }
+  bufDestroy(&copy);
+  bufDestroy(&buf);
+
+  // A missing file is still an error
+  status = bufMapBinaryFile(&buf, "nonExistentFile.bin", 0x00, NULL);
+  ASSERT_EQ(BUF_FOPEN, status);
+}
+
 TEST(BinIO, testWriteFile) {
   const char *const FILENAME = "tmpFile.bin";
   const char *const DATA = "Just some test data";
@@ -88,3 +162,436 @@ TEST(BinIO, testWriteFile) {
   delete[] fileData;
   bufDestroy(&buf);
 }
+
+#ifndef WIN32
+  #include <fcntl.h>
+  #include <unistd.h>
+
+  TEST(BinIO, testWriteSink) {
+    Buffer buf;
+    BufferSink sink;
+    BufferStatus status;
+    status = bufInitialise(&buf, 1024, 0x00, NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+    status = bufAppendBlock(&buf, (const uint8 *)"Hello, world!", 13, NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+
+    // A range of the buffer, then a batch of blocks, through one descriptor
+    const int fd = open("tmpFile.bin", O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    ASSERT_GE(fd, 0);
+    bufInitDescriptorSink(&sink, fd);
+    status = bufWriteBinarySink(&buf, &sink, 7, 5, NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+    ASSERT_TRUE(sink.writeVector != NULL);
+    const SinkBlock blocks[] = {
+      {(const uint8 *)" & ", 3}, {(const uint8 *)"", 0}, {buf.data, 5}, {(const uint8 *)"!", 1}
+    };
+    status = sink.writeVector(sink.context, blocks, 4, NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+    ASSERT_EQ(0, close(fd));
+    std::ifstream file("tmpFile.bin", std::ios::binary);
+    const std::string text(
+      (std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    ASSERT_EQ("world & Hello!", text);
+
+    // A closed descriptor cannot be written
+    const char *error = NULL;
+    status = bufWriteBinarySink(&buf, &sink, 0, 5, &error);
+    ASSERT_EQ(BUF_FERROR, status);
+    ASSERT_TRUE(error != NULL);
+    bufFreeError(error);
+    bufDestroy(&buf);
+  }
+
+  TEST(BinIO, testReadDescriptor) {
+    Buffer buf;
+    BufferStatus status;
+    int fds[2];
+    std::string data;
+    for (int i = 0; i < 3000; i++) {
+      data += (char)('A' + i % 26);
+    }
+    status = bufInitialise(&buf, 8, 0xEE, NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+    status = bufAppendByte(&buf, '>', NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+
+    // Everything in the pipe is appended, growing the buffer as it goes
+    ASSERT_EQ(0, pipe(fds));
+    ASSERT_EQ((ssize_t)data.length(), write(fds[1], data.data(), data.length()));
+    ASSERT_EQ(0, close(fds[1]));
+    status = bufAppendFromDescriptor(&buf, fds[0], NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+    ASSERT_EQ(0, close(fds[0]));
+    ASSERT_EQ(1 + data.length(), buf.length);
+    ASSERT_EQ('>', buf.data[0]);
+    ASSERT_EQ(0, std::memcmp(data.data(), buf.data + 1, data.length()));
+    for (size_t i = buf.length; i < buf.capacity; i++) {
+      ASSERT_EQ(0xEE, buf.data[i]);
+    }
+
+    // A file which cannot be sized up front is read until EOF too
+    status = bufAppendFromBinaryFile(&buf, "/dev/null", NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+    ASSERT_EQ(1 + data.length(), buf.length);
+
+    // A closed descriptor cannot be read, and leaves the buffer alone
+    const char *error = NULL;
+    status = bufAppendFromDescriptor(&buf, fds[0], &error);
+    ASSERT_EQ(BUF_FERROR, status);
+    ASSERT_EQ(1 + data.length(), buf.length);
+    bufFreeError(error);
+    bufDestroy(&buf);
+
+    // EOF exactly at the capacity still grows the buffer, and the new room must hold the fill
+    status = bufInitialise(&buf, 1024, 0xAA, NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+    ASSERT_EQ(0, pipe(fds));
+    ASSERT_EQ(1024, write(fds[1], data.data(), 1024));
+    ASSERT_EQ(0, close(fds[1]));
+    status = bufAppendFromDescriptor(&buf, fds[0], NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+    ASSERT_EQ(0, close(fds[0]));
+    ASSERT_EQ(1024U, buf.length);
+    ASSERT_LT(1024U, buf.capacity);
+    ASSERT_EQ(0, std::memcmp(data.data(), buf.data, 1024));
+    for (size_t i = buf.length; i < buf.capacity; i++) {
+      ASSERT_EQ(0xAA, buf.data[i]);
+    }
+    bufDestroy(&buf);
+  }
+#endif
+
+static std::string memInitText(
+  const Buffer *buf, MemInitFormat format, uint32 wordSize, bool bigEndian)
+{
+  Buffer text;
+  BufferSink sink;
+  BufferStatus status = bufInitialise(&text, 1024, 0x00, NULL);
+  EXPECT_EQ(BUF_SUCCESS, status);
+  bufInitBufferSink(&sink, &text);
+  status = bufWriteMemInitSink(buf, &sink, format, wordSize, bigEndian, NULL);
+  EXPECT_EQ(BUF_SUCCESS, status);
+  const std::string result((const char *)text.data, text.length);
+  bufDestroy(&text);
+  return result;
+}
+
+TEST(BinIO, testWriteMemInit) {
+  Buffer buf;
+  BufferStatus status;
+  status = bufInitialise(&buf, 1024, 0xEE, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufAppendBlock(
+    &buf, (const uint8 *)"\x01\x23\x45\x67\x89\xAB\xCD\xEF\xDE\xAD\xBE\xEF\xCA\xFE\xF0\x0D"
+    "\x12\x34", 18, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+
+  ASSERT_EQ(
+    "0123\n4567\n89AB\nCDEF\nDEAD\nBEEF\nCAFE\nF00D\n1234\n",
+    memInitText(&buf, MEMINIT_READMEMH, 2, true));
+  ASSERT_EQ(
+    "67452301\nEFCDAB89\nEFBEADDE\n0DF0FECA\nEEEE3412\n",
+    memInitText(&buf, MEMINIT_READMEMH, 4, false));
+  ASSERT_EQ(
+    "WIDTH=64;\nDEPTH=3;\n\nADDRESS_RADIX=HEX;\nDATA_RADIX=HEX;\n\nCONTENT BEGIN\n"
+    "  0 : 0123456789ABCDEF;\n  1 : DEADBEEFCAFEF00D;\n  2 : 1234EEEEEEEEEEEE;\nEND;\n",
+    memInitText(&buf, MEMINIT_MIF, 8, true));
+  ASSERT_EQ(
+    "memory_initialization_radix=16;\nmemory_initialization_vector=\n"
+    "0123456789ABCDEFDEADBEEF,\nCAFEF00D1234EEEEEEEEEEEE;\n",
+    memInitText(&buf, MEMINIT_COE, 12, true));
+
+  // Addresses are as wide as the deepest one needs
+  status = bufAppendConst(&buf, 0x00, 0x100 - buf.length, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  const std::string mif = memInitText(&buf, MEMINIT_MIF, 1, true);
+  ASSERT_NE(std::string::npos, mif.find("\n  00 : 01;\n"));
+  ASSERT_NE(std::string::npos, mif.find("\n  FF : 00;\nEND;\n"));
+
+  // Word sizes must be sensible
+  status = bufWriteMemInitFile(&buf, "tmpFile.mif", MEMINIT_MIF, 0, true, NULL);
+  ASSERT_EQ(BUF_BAD_MEMINIT, status);
+  status = bufWriteMemInitFile(&buf, "tmpFile.mif", MEMINIT_MIF, 33, true, NULL);
+  ASSERT_EQ(BUF_BAD_MEMINIT, status);
+  status = bufWriteMemInitFile(&buf, "tmpFile.mif", MEMINIT_MIF, 32, true, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+
+  bufDestroy(&buf);
+}
+
+// Put a value of the given size into an image at offset, in the given byte order.
+static void putField(std::string &image, size_t offset, uint64 value, int size, bool bigEndian) {
+  for (int i = 0; i < size; i++) {
+    image[offset + (size_t)(bigEndian ? size - 1 - i : i)] = (char)(value >> (8 * i));
+  }
+}
+
+// Make an ELF file with three program headers: a PT_LOAD with .text, a PT_NOTE, and a PT_LOAD
+// with .data followed by .bss.
+static void writeElf(const char *fileName, bool is64, bool bigEndian) {
+  const size_t ehdrSize = is64 ? 64 : 52;
+  const size_t phdrSize = is64 ? 56 : 32;
+  const size_t phoff = ehdrSize;
+  const size_t payload = phoff + 3 * phdrSize;
+  std::string image(payload + 16, '\0');
+  image.replace(0, 4, "\177ELF");
+  image[4] = is64 ? 2 : 1;
+  image[5] = bigEndian ? 2 : 1;
+  image[6] = 1;
+  putField(image, is64 ? 32 : 28, phoff, is64 ? 8 : 4, bigEndian);
+  putField(image, is64 ? 54 : 42, phdrSize, 2, bigEndian);
+  putField(image, is64 ? 56 : 44, 3, 2, bigEndian);
+  const struct {
+    uint32 type;
+    uint64 offset, vaddr, paddr, filesz, memsz;
+  } segments[] = {
+    {1, payload, 0x8000, 0x100, 8, 8},
+    {4, payload, 0, 0, 16, 16},
+    {1, payload + 8, 0x20000000, 0x110, 8, 24}
+  };
+  for (int i = 0; i < 3; i++) {
+    const size_t ph = phoff + (size_t)i * phdrSize;
+    putField(image, ph, segments[i].type, 4, bigEndian);
+    if (is64) {
+      putField(image, ph + 8, segments[i].offset, 8, bigEndian);
+      putField(image, ph + 16, segments[i].vaddr, 8, bigEndian);
+      putField(image, ph + 24, segments[i].paddr, 8, bigEndian);
+      putField(image, ph + 32, segments[i].filesz, 8, bigEndian);
+      putField(image, ph + 40, segments[i].memsz, 8, bigEndian);
+    } else {
+      putField(image, ph + 4, segments[i].offset, 4, bigEndian);
+      putField(image, ph + 8, segments[i].vaddr, 4, bigEndian);
+      putField(image, ph + 12, segments[i].paddr, 4, bigEndian);
+      putField(image, ph + 16, segments[i].filesz, 4, bigEndian);
+      putField(image, ph + 20, segments[i].memsz, 4, bigEndian);
+    }
+  }
+  for (int i = 0; i < 16; i++) {
+    image[payload + (size_t)i] = (char)(0xA0 + i);
+  }
+  std::ofstream file(fileName, std::ios::binary);
+  file << image;
+}
+
+TEST(BinIO, testReadElf) {
+  Buffer data, mask;
+  BufferStatus status;
+  status = bufInitialise(&data, 1024, 0xFF, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&mask, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  for (int is64 = 0; is64 < 2; is64++) {
+    for (int bigEndian = 0; bigEndian < 2; bigEndian++) {
+      writeElf("tmpFile.elf", is64 != 0, bigEndian != 0);
+      status = bufReadFromElfFile(&data, &mask, "tmpFile.elf", NULL);
+      ASSERT_EQ(BUF_SUCCESS, status);
+      ASSERT_EQ(0x128UL, data.length);
+      ASSERT_EQ(0x128UL, mask.length);
+      for (size_t i = 0; i < data.length; i++) {
+        const bool text = i >= 0x100 && i < 0x108;
+        const bool initialised = i >= 0x110 && i < 0x118;
+        const bool loaded = text || initialised;
+        ASSERT_EQ(text ? 0xA0 + (i - 0x100) : initialised ? 0xA8 + (i - 0x110) : 0xFF, data.data[i]);
+        ASSERT_EQ(loaded ? 0x01 : 0x00, mask.data[i]);
+      }
+    }
+  }
+
+  // Not an ELF file at all
+  {
+    std::ofstream file("tmpFile.elf", std::ios::binary);
+    file << "\177ELG and then some more bytes, enough to fill out a header of fifty-two bytes";
+  }
+  status = bufReadFromElfFile(&data, &mask, "tmpFile.elf", NULL);
+  ASSERT_EQ(BUF_BAD_ELF, status);
+
+  bufDestroy(&mask);
+  bufDestroy(&data);
+}
+
+TEST(BinIO, testImageRoundTrip) {
+  Buffer data, mask, loadedData, loadedMask;
+  BufferStatus status;
+  status = bufInitialise(&data, 1024, 0xFF, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&mask, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&loadedData, 1024, 0xFF, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&loadedMask, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+
+  // Three extents, with a hole at the start and unmasked fill at the end
+  for (size_t i = 0; i < 20000; i++) {
+    status = bufWriteByte(&data, 0x10 + i, (uint8)(i * 7), NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+    status = bufWriteByte(&mask, 0x10 + i, 0x01, NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+  }
+  status = bufWriteConst(&data, 30000, 0x5A, 5, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufWriteConst(&mask, 30000, 0x01, 5, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufWriteConst(&data, 40000, 0xA5, 3, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufWriteConst(&mask, 40000, 0x01, 3, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufWriteConst(&data, 40003, 0xFF, 100, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufWriteConst(&mask, 40003, 0x00, 100, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+
+  for (int checksum = 0; checksum < 2; checksum++) {
+    status = bufSaveImage(&data, &mask, "tmpFile.img", checksum != 0, NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+    std::ifstream file("tmpFile.img", std::ios::binary | std::ios::ate);
+    ASSERT_EQ(4096 + 20000 + 5 + 3, (int)file.tellg());
+    status = bufLoadImage(&loadedData, &loadedMask, "tmpFile.img", NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+    ASSERT_EQ(data.length, loadedData.length);
+    ASSERT_EQ(mask.length, loadedMask.length);
+    ASSERT_EQ(0, memcmp(data.data, loadedData.data, data.length));
+    ASSERT_EQ(0, memcmp(mask.data, loadedMask.data, mask.length));
+  }
+
+  // Without a mask, the whole buffer is one extent
+  status = bufSaveImage(&data, NULL, "tmpFile.img", true, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufLoadImage(&loadedData, &loadedMask, "tmpFile.img", NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(data.length, loadedData.length);
+  ASSERT_EQ(0, memcmp(data.data, loadedData.data, data.length));
+  for (size_t i = 0; i < loadedMask.length; i++) {
+    ASSERT_EQ(0x01, loadedMask.data[i]);
+  }
+
+  bufDestroy(&loadedMask);
+  bufDestroy(&loadedData);
+  bufDestroy(&mask);
+  bufDestroy(&data);
+}
+
+TEST(BinIO, testImageFragmented) {
+  Buffer data, mask, loadedData, loadedMask;
+  BufferStatus status;
+  status = bufInitialise(&data, 1024, 0xFF, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&mask, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&loadedData, 1024, 0xFF, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&loadedMask, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+
+  // A megabyte masked sixteen bytes on, sixteen off, then a few runs far apart
+  uint32 seed = 5;
+  status = bufAppendConst(&data, 0xFF, 0x100000, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufAppendConst(&mask, 0x00, 0x100000, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  for (size_t i = 0; i < 0x100000; i++) {
+    if (i & 0x10) {
+      seed = seed * 1103515245U + 12345U;
+      data.data[i] = (uint8)(seed >> 16);
+      mask.data[i] = 0x01;
+    }
+  }
+  for (size_t i = 0; i < 4; i++) {
+    status = bufWriteConst(&data, 0x110000 + i * 0x1000, (uint8)i, 1 + i, NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+    status = bufWriteConst(&mask, 0x110000 + i * 0x1000, 0x01, 1 + i, NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+  }
+
+  // The runs cost an eighth of a byte per byte in a bitmap, not a padded extent each, so the
+  // image is smaller than the same data as Intel Hex
+  status = bufSaveImage(&data, &mask, "tmpFile.img", true, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  std::ifstream file("tmpFile.img", std::ios::binary | std::ios::ate);
+  const size_t imageSize = (size_t)file.tellg();
+  file.close();
+  ASSERT_LT(imageSize, 0x100000U + 0x100000U / 8 + 4096U);
+  status = bufWriteToIntelHexFile(&data, &mask, "tmpFile.hex", 16, false, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  file.open("tmpFile.hex", std::ios::binary | std::ios::ate);
+  ASSERT_LT(imageSize, (size_t)file.tellg());
+  file.close();
+
+  status = bufLoadImage(&loadedData, &loadedMask, "tmpFile.img", NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(data.length, loadedData.length);
+  ASSERT_EQ(mask.length, loadedMask.length);
+  ASSERT_EQ(0, memcmp(data.data, loadedData.data, data.length));
+  ASSERT_EQ(0, memcmp(mask.data, loadedMask.data, mask.length));
+
+  bufDestroy(&loadedMask);
+  bufDestroy(&loadedData);
+  bufDestroy(&mask);
+  bufDestroy(&data);
+}
+
+TEST(BinIO, testImageBad) {
+  Buffer data, mask;
+  BufferStatus status;
+  const char *error = NULL;
+  std::string image;
+  status = bufInitialise(&data, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&mask, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufAppendConst(&data, 0x42, 16, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufSaveImage(&data, NULL, "tmpFile.img", true, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  {
+    std::ifstream file("tmpFile.img", std::ios::binary);
+    image.assign((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  }
+  ASSERT_EQ(64U + 16U, image.length());
+
+  // A version 1 file, which is laid out the same way
+  image[8] = 0x01;
+  {
+    std::ofstream file("tmpFile.img", std::ios::binary);
+    file << image;
+  }
+  status = bufLoadImage(&data, &mask, "tmpFile.img", NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(16U, data.length);
+
+  // A corrupted payload byte
+  image[64 + 3] = 0x43;
+  {
+    std::ofstream file("tmpFile.img", std::ios::binary);
+    file << image;
+  }
+  status = bufLoadImage(&data, &mask, "tmpFile.img", &error);
+  ASSERT_EQ(BUF_BAD_CRC, status);
+  ASSERT_STREQ("bufLoadImage(): Extent 0 has a bad CRC", error);
+  bufFreeError(error);
+  error = NULL;
+
+  // An extent running off the end of the file
+  image.resize(64 + 8);
+  {
+    std::ofstream file("tmpFile.img", std::ios::binary);
+    file << image;
+  }
+  status = bufLoadImage(&data, &mask, "tmpFile.img", NULL);
+  ASSERT_EQ(BUF_BAD_IMAGE, status);
+
+  // Not an image at all
+  image[0] = 'X';
+  {
+    std::ofstream file("tmpFile.img", std::ios::binary);
+    file << image;
+  }
+  status = bufLoadImage(&data, &mask, "tmpFile.img", &error);
+  ASSERT_EQ(BUF_BAD_IMAGE, status);
+  ASSERT_STREQ("bufLoadImage(): Not an image file", error);
+  bufFreeError(error);
+
+  bufDestroy(&mask);
+  bufDestroy(&data);
+}
@@ -15,6 +15,9 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <gtest/gtest.h>
+#include <cstring>
+#include <string>
+#include <makestuff/libbuffer.h>
 #include "conv.h"
 
 TEST(Conv, testGetHexNibble) {
@@ -145,3 +148,97 @@ TEST(Conv, testGetHexLowerNibble) {
   ASSERT_EQ('E', getHexLowerNibble(0xFE));
   ASSERT_EQ('F', getHexLowerNibble(0xFF));
 }
+
+TEST(Conv, testGetHexBytes) {
+  const char *const digits = "0123456789ABCDEFabcdef00FF7f80A5";
+  const uint8 expected[] = {
+    0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF, 0xAB, 0xCD, 0xEF, 0x00, 0xFF, 0x7F, 0x80, 0xA5
+  };
+  uint8 bytes[16];
+  size_t badIndex;
+  bool status, lowerCase;
+  for (size_t count = 0; count <= 16; count++) {
+    std::memset(bytes, 0x55, sizeof(bytes));
+    lowerCase = false;
+    status = getHexBytes(digits, count, bytes, &badIndex, &lowerCase);
+    ASSERT_FALSE(status);
+    ASSERT_EQ(count > 8, lowerCase);
+    ASSERT_EQ(std::memcmp(expected, bytes, count), 0);
+    for (size_t i = count; i < 16; i++) {
+      ASSERT_EQ(0x55, bytes[i]);
+    }
+  }
+}
+
+TEST(Conv, testGetHexBytesJunk) {
+  // Every possible char, in every position of a run long enough to take the word-at-a-time path
+  char digits[33];
+  uint8 bytes[16];
+  uint8 nibble;
+  size_t badIndex;
+  bool status, lowerCase;
+  for (int c = 0; c < 256; c++) {
+    const bool isHex = !getHexNibble((char)c, &nibble);
+    for (size_t pos = 0; pos < 32; pos++) {
+      std::memset(digits, 'A', 32);
+      digits[pos] = (char)c;
+      lowerCase = false;
+      status = getHexBytes(digits, 16, bytes, &badIndex, &lowerCase);
+      if (isHex) {
+        ASSERT_FALSE(status);
+        ASSERT_EQ(c >= 'a', lowerCase);
+        ASSERT_EQ(nibble, (pos & 1) ? bytes[pos/2] & 0x0F : bytes[pos/2] >> 4);
+      } else {
+        ASSERT_TRUE(status);
+        ASSERT_EQ(pos, badIndex);
+      }
+    }
+  }
+}
+
+TEST(Conv, testPutHexBytes) {
+  // Every byte value, at every offset of a run long enough to take the word-at-a-time path
+  uint8 bytes[16];
+  char digits[33];
+  for (int b = 0; b < 256; b++) {
+    for (size_t pos = 0; pos < 16; pos++) {
+      std::memset(bytes, 0x00, 16);
+      bytes[pos] = (uint8)b;
+      digits[32] = '#';
+      putHexBytes(bytes, 16, digits);
+      ASSERT_EQ('#', digits[32]);
+      for (size_t i = 0; i < 16; i++) {
+        ASSERT_EQ(getHexUpperNibble(bytes[i]), digits[2*i]);
+        ASSERT_EQ(getHexLowerNibble(bytes[i]), digits[2*i + 1]);
+      }
+    }
+  }
+}
+
+TEST(Conv, testHexString) {
+  Buffer text, data;
+  BufferStatus status;
+  const char *error = NULL;
+  const uint8 bytes[] = {0x00, 0x12, 0x9A, 0xFF, 0xDE, 0xAD, 0xBE, 0xEF, 0x5C};
+  status = bufInitialise(&text, 4, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&data, 4, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufToHexString(bytes, sizeof(bytes), &text, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ("00129AFFDEADBEEF5C", std::string((const char *)text.data, text.length));
+  status = bufFromHexString(&data, "00129aFFdeADbeef5C", 18, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(sizeof(bytes), data.length);
+  ASSERT_EQ(0, std::memcmp(bytes, data.data, sizeof(bytes)));
+  status = bufFromHexString(&data, "00129", 5, NULL);
+  ASSERT_EQ(BUF_BAD_HEX, status);
+  ASSERT_EQ(0UL, data.length);
+  status = bufFromHexString(&data, "00129AFFDEADBEXF", 16, &error);
+  ASSERT_EQ(BUF_BAD_HEX, status);
+  ASSERT_STREQ("bufFromHexString(): Illegal character 0x58 at offset 14", error);
+  ASSERT_EQ(0UL, data.length);
+  bufFreeError(error);
+  bufDestroy(&data);
+  bufDestroy(&text);
+}
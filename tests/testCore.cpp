@@ -750,8 +750,31 @@ TEST(Core, testZeroLength) {
   bufDestroy(&buf);
 }
 
+TEST(Core, testReserve) {
+  Buffer buf;
+  BufferStatus status;
+  status = bufInitialise(&buf, 8, 23, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  const unsigned char expected[] = {1, 2, 3, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23};
+  status = bufAppendBlock(&buf, expected, 3, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufReserve(&buf, 13, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(13UL, buf.capacity);
+  ASSERT_EQ(3UL, buf.length);
+  ASSERT_EQ(std::memcmp(expected, buf.data, 13), 0);
+  status = bufReserve(&buf, 4, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(13UL, buf.capacity);
+  status = bufAppendConst(&buf, 23, 10, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(13UL, buf.capacity);
+  ASSERT_EQ(std::memcmp(expected, buf.data, 13), 0);
+  bufDestroy(&buf);
+}
+
 TEST(Core, testCopyConstruct) {
-  Buffer src, dst = {0, 0, 0, 0};
+  Buffer src, dst = {0, 0, 0, 0, false};
   BufferStatus status;
   status = bufInitialise(&src, 8, 23, NULL);
   ASSERT_EQ(BUF_SUCCESS, status);
@@ -0,0 +1,274 @@
+/*
+ * Copyright (C) 2009-2012 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <gtest/gtest.h>
+#include <cstring>
+#include "private.h"
+
+static void fillPseudoRandom(Buffer *buf, size_t length, uint32 seed) {
+  BufferStatus status;
+  bufZeroLength(buf);
+  for (size_t i = 0; i < length; i++) {
+    seed = seed * 1103515245U + 12345U;
+    status = bufAppendByte(buf, (uint8)(seed >> 16), NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+  }
+}
+
+TEST(Delta, testIdentical) {
+  Buffer oldData, newData, delta;
+  BufferStatus status;
+  status = bufInitialise(&oldData, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&newData, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&delta, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  fillPseudoRandom(&oldData, 65536, 1);
+  fillPseudoRandom(&newData, 65536, 1);
+  status = bufMakeDelta(&oldData, &newData, NULL, &delta, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(std::memcmp(bufDeltaMagic, delta.data, 4), 0);
+  ASSERT_LT(delta.length, 20UL);
+  ASSERT_EQ(DELTA_END, delta.data[delta.length - 1]);
+  bufDestroy(&delta);
+  bufDestroy(&newData);
+  bufDestroy(&oldData);
+}
+
+TEST(Delta, testSmallEdits) {
+  Buffer oldData, newData, delta;
+  BufferStatus status;
+  const uint8 patch[] = {0xDE, 0xAD, 0xBE, 0xEF};
+  status = bufInitialise(&oldData, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&newData, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&delta, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  fillPseudoRandom(&oldData, 65536, 2);
+  fillPseudoRandom(&newData, 65536, 2);
+
+  // Overwrite a few bytes in place, and insert a few more further on
+  status = bufWriteBlock(&newData, 1000, patch, sizeof(patch), NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufWriteBlock(&newData, 40000, patch, sizeof(patch), NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufAppendBlock(&newData, oldData.data + 20000, 5000, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+
+  status = bufMakeDelta(&oldData, &newData, NULL, &delta, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_LT(delta.length, 64UL);
+  bufDestroy(&delta);
+  bufDestroy(&newData);
+  bufDestroy(&oldData);
+}
+
+TEST(Delta, testMaskedHoles) {
+  Buffer oldData, newData, newMask, delta;
+  BufferStatus status;
+  status = bufInitialise(&oldData, 1024, 0xFF, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&newData, 1024, 0xFF, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&newMask, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&delta, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+
+  // The new image is unrelated to the old one, but only 256 bytes of it matter
+  fillPseudoRandom(&newData, 65536, 3);
+  status = bufWriteConst(&newMask, 0, 0x00, 65536, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufWriteConst(&newMask, 4096, 0x01, 256, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+
+  status = bufMakeDelta(&oldData, &newData, &newMask, &delta, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_LT(delta.length, 256UL + 32UL);
+  bufDestroy(&delta);
+  bufDestroy(&newMask);
+  bufDestroy(&newData);
+  bufDestroy(&oldData);
+}
+
+static void testApply(const Buffer *oldData, const Buffer *newData, const Buffer *newMask) {
+  Buffer base, delta, out;
+  BufferStatus status;
+  status = bufInitialise(&delta, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&out, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufMakeDelta(oldData, newData, newMask, &delta, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+
+  // Out of place
+  base = {NULL, 0, 0, 0, false};
+  status = bufDeepCopy(&base, oldData, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufApplyDelta(&base, &delta, &out, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(newData->length, out.length);
+  ASSERT_EQ(std::memcmp(oldData->data, base.data, oldData->length), 0);
+  for (size_t i = 0; i < out.length; i++) {
+    if (!newMask || newMask->data[i]) {
+      ASSERT_EQ(newData->data[i], out.data[i]);
+    }
+  }
+
+  // In place
+  status = bufApplyDelta(&base, &delta, &base, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(out.length, base.length);
+  ASSERT_EQ(std::memcmp(out.data, base.data, out.length), 0);
+
+  bufDestroy(&base);
+  bufDestroy(&out);
+  bufDestroy(&delta);
+}
+
+TEST(Delta, testApply) {
+  Buffer oldData, newData, newMask;
+  BufferStatus status;
+  const uint8 patch[] = {0xDE, 0xAD, 0xBE, 0xEF};
+  status = bufInitialise(&oldData, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&newData, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&newMask, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  fillPseudoRandom(&oldData, 65536, 4);
+
+  // Identical
+  status = bufDeepCopy(&newData, &oldData, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  testApply(&oldData, &newData, NULL);
+
+  // Patched and grown: safe to apply in place
+  status = bufWriteBlock(&newData, 1000, patch, sizeof(patch), NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufWriteConst(&newData, 70000, 0x55, 100, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  testApply(&oldData, &newData, NULL);
+
+  // Shrunk
+  newData.length = 30000;
+  testApply(&oldData, &newData, NULL);
+
+  // Shifted up: copies read from below their destinations, so in place needs a temporary
+  bufZeroLength(&newData);
+  status = bufAppendBlock(&newData, patch, sizeof(patch), NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufAppendBlock(&newData, oldData.data, oldData.length, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  testApply(&oldData, &newData, NULL);
+
+  // Masked
+  fillPseudoRandom(&newData, 65536, 5);
+  status = bufWriteConst(&newMask, 0, 0x00, 65536, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufWriteConst(&newMask, 100, 0x01, 1000, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  testApply(&oldData, &newData, &newMask);
+
+  // Empty
+  newData.length = 0;
+  testApply(&oldData, &newData, NULL);
+
+  bufDestroy(&newMask);
+  bufDestroy(&newData);
+  bufDestroy(&oldData);
+}
+
+TEST(Delta, testApplyNewFill) {
+  Buffer oldData, newData, delta, out;
+  BufferStatus status;
+  status = bufInitialise(&oldData, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&newData, 1024, 0xFF, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&delta, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&out, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  fillPseudoRandom(&oldData, 8192, 8);
+
+  // A shrunk copy with a different fill byte: the delta is safe to apply in place
+  status = bufAppendBlock(&newData, oldData.data, 3000, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufMakeDelta(&oldData, &newData, NULL, &delta, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufApplyDelta(&oldData, &delta, &out, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufApplyDelta(&oldData, &delta, &oldData, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+
+  // Both ways give the new fill byte, and everything past the end is that fill byte
+  ASSERT_EQ(0xFF, out.fill);
+  ASSERT_EQ(0xFF, oldData.fill);
+  ASSERT_EQ(3000UL, oldData.length);
+  ASSERT_EQ(std::memcmp(newData.data, oldData.data, oldData.length), 0);
+  for (size_t i = oldData.length; i < oldData.capacity; i++) {
+    ASSERT_EQ(0xFF, oldData.data[i]);
+  }
+
+  bufDestroy(&out);
+  bufDestroy(&delta);
+  bufDestroy(&newData);
+  bufDestroy(&oldData);
+}
+
+TEST(Delta, testBadDelta) {
+  Buffer oldData, newData, delta, out;
+  BufferStatus status;
+  status = bufInitialise(&oldData, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&newData, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&delta, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&out, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  fillPseudoRandom(&oldData, 4096, 6);
+  fillPseudoRandom(&newData, 4096, 7);
+  status = bufMakeDelta(&oldData, &newData, NULL, &delta, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+
+  // Wrong base
+  oldData.length--;
+  status = bufApplyDelta(&oldData, &delta, &out, NULL);
+  ASSERT_EQ(BUF_BAD_DELTA, status);
+  oldData.length++;
+
+  // Truncated
+  delta.length--;
+  status = bufApplyDelta(&oldData, &delta, &out, NULL);
+  ASSERT_EQ(BUF_BAD_DELTA, status);
+  delta.length = 10;
+  status = bufApplyDelta(&oldData, &delta, &out, NULL);
+  ASSERT_EQ(BUF_BAD_DELTA, status);
+
+  // Bad magic
+  delta.data[0] = 'X';
+  status = bufApplyDelta(&oldData, &delta, &out, NULL);
+  ASSERT_EQ(BUF_BAD_DELTA, status);
+
+  bufDestroy(&out);
+  bufDestroy(&delta);
+  bufDestroy(&newData);
+  bufDestroy(&oldData);
+}
@@ -19,6 +19,8 @@
 #include <string>
 #include <fstream>
 #include <cstring>
+#include <algorithm>
+#include <vector>
 #include "private.h"
 
 TEST(HexIO, testValidDataLine) {
@@ -180,6 +182,89 @@ TEST(HexIO, testCorruptLine) {
   bufDestroy(&data);
 }
 
+TEST(HexIO, testLowerCaseLine) {
+  Buffer data;
+  BufferStatus status;
+  uint8 recordType;
+  uint32 seg = 0x00000000;
+  status = bufInitialise(&data, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufProcessLine(":040BE10075820022f7\n", 0, &data, NULL, &seg, &recordType, NULL);
+  ASSERT_EQ(HEX_CORRUPT_LINE, status);
+  status = bufProcessLine(":040bE10075820022F7\n", 0, &data, NULL, &seg, &recordType, NULL);
+  ASSERT_EQ(HEX_CORRUPT_LINE, status);
+  status = bufProcessLine(":040BE10075820022F8\r\n", 0, &data, NULL, &seg, &recordType, NULL);
+  ASSERT_EQ(HEX_BAD_CHECKSUM, status);
+  status = bufProcessLine(":040BE10075820022F7\r\n", 0, &data, NULL, &seg, &recordType, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufProcessLine(":040BE10075820022F7", 0, &data, NULL, &seg, &recordType, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  bufDestroy(&data);
+}
+
+TEST(HexIO, testTruncatedLine) {
+  Buffer data;
+  BufferStatus status;
+  uint8 recordType;
+  uint32 seg = 0x00000000;
+  status = bufInitialise(&data, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufProcessLine(":040BE1", 0, &data, NULL, &seg, &recordType, NULL);
+  ASSERT_EQ(HEX_JUNK_REC_TYPE, status);
+  status = bufProcessLine(":040BE1007582", 0, &data, NULL, &seg, &recordType, NULL);
+  ASSERT_EQ(HEX_JUNK_DATA_BYTE, status);
+  status = bufProcessLine(":040BE100758200221\n", 0, &data, NULL, &seg, &recordType, NULL);
+  ASSERT_EQ(HEX_JUNK_CHECKSUM, status);
+  bufDestroy(&data);
+}
+
+static BufferStatus readHexText(const char *text, Buffer *data, Buffer *mask) {
+  const char *const FILENAME = "tmpFile.hex";
+  std::ofstream file;
+  file.open(FILENAME, std::ios::out|std::ios::binary);
+  file << text;
+  file.close();
+  return bufReadFromIntelHexFile(data, mask, FILENAME, NULL);
+}
+
+TEST(HexIO, testReadFile) {
+  Buffer data, mask;
+  BufferStatus status;
+  const uint8 expected[] = {0x75, 0x82, 0x00, 0x22};
+  status = bufInitialise(&data, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&mask, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+
+  status = bufReadFromIntelHexFile(&data, &mask, "nonExistentFile.hex", NULL);
+  ASSERT_EQ(BUF_FOPEN, status);
+  status = readHexText("", &data, &mask);
+  ASSERT_EQ(HEX_EMPTY_FILE, status);
+  status = readHexText(":040BE10075820022F7\n", &data, &mask);
+  ASSERT_EQ(HEX_MISSING_EOF, status);
+  status = readHexText(":040BE10075820022F7\n\n:00000001FF\n", &data, &mask);
+  ASSERT_EQ(HEX_JUNK_START_CODE, status);
+
+  // Line terminators are optional on the last line, and may be CRLF
+  status = readHexText(":040BE10075820022F7\r\n:00000001FF", &data, &mask);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(0x0BE1+4UL, data.length);
+  ASSERT_EQ(0x0BE1+4UL, mask.length);
+  ASSERT_EQ(std::memcmp(expected, data.data + 0x0BE1, 4), 0);
+  ASSERT_EQ(1, mask.data[0x0BE1]);
+  ASSERT_EQ(0, mask.data[0x0BE0]);
+
+  // Lines longer than any valid record are not split
+  std::string longLine = ":040BE10075820022F7";
+  longLine.append(600, ' ');
+  longLine += ":00000001FF\n";
+  status = readHexText(longLine.c_str(), &data, &mask);
+  ASSERT_EQ(HEX_CORRUPT_LINE, status);
+
+  bufDestroy(&mask);
+  bufDestroy(&data);
+}
+
 void testRoundTrip(const char *firstLine, ...) {
   const char *const FILENAME = "tmpFile.hex";
   Buffer data, mask, readbackData, readbackMask;
@@ -274,6 +359,124 @@ TEST(HexIO, testRoundTrip) {
 }
 
 
+TEST(HexIO, testExtLinRecord) {
+  Buffer data, mask;
+  BufferStatus status;
+  uint8 recordType;
+  uint32 seg = 0x00000000;
+  status = bufInitialise(&data, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&mask, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+
+  // Upper linear address 0x0001 puts subsequent data at 0x0001xxxx
+  status = bufProcessLine(":020000040001F9", 0, &data, &mask, &seg, &recordType, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(EXT_LIN_RECORD, recordType);
+  ASSERT_EQ(0x00010000U, seg);
+  status = bufProcessLine(":040BE10075820022F7", 0, &data, &mask, &seg, &recordType, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(0x10BE1+4UL, data.length);
+  ASSERT_EQ(0x75, data.data[0x10BE1]);
+
+  // Malformed EXT_LIN records
+  status = bufProcessLine(":020010040001E9", 0, &data, &mask, &seg, &recordType, NULL);
+  ASSERT_EQ(HEX_BAD_EXT_LIN, status);
+  status = bufProcessLine(":0100100401EA", 0, &data, &mask, &seg, &recordType, NULL);
+  ASSERT_EQ(HEX_BAD_EXT_LIN, status);
+
+  // Start address records are accepted but have no effect
+  status = bufProcessLine(":04000005080001C12D", 0, &data, &mask, &seg, &recordType, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(START_LIN_RECORD, recordType);
+  status = bufProcessLine(":0400000300001234B3", 0, &data, &mask, &seg, &recordType, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(START_SEG_RECORD, recordType);
+  status = bufProcessLine(":03000005080001EF", 0, &data, &mask, &seg, &recordType, NULL);
+  ASSERT_EQ(HEX_BAD_REC_TYPE, status);
+  ASSERT_EQ(0x00010000U, seg);
+  ASSERT_EQ(0x10BE1+4UL, data.length);
+
+  bufDestroy(&mask);
+  bufDestroy(&data);
+}
+
+static std::string readText(const char *fileName) {
+  std::ifstream in(fileName, std::ios::in|std::ios::binary);
+  return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+TEST(HexIO, testRebased) {
+  const char *const FILENAME = "tmpFile.hex";
+  Buffer data, mask, readbackData, readbackMask;
+  BufferStatus status;
+  uint32 baseAddress = 0;
+  std::string text;
+  status = bufInitialise(&data, 1024, 0xFF, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&mask, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&readbackData, 1024, 0xFF, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&readbackMask, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+
+  // Two runs, either side of a 64KiB boundary, in flash at 0x08000000
+  for (size_t i = 0; i < 0x100; i++) {
+    status = bufWriteByte(&data, 0x100 + i, (uint8)i, NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+    status = bufWriteByte(&data, 0x1FFF8 + i, (uint8)~i, NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+    status = bufWriteByte(&mask, 0x100 + i, 0x01, NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+    status = bufWriteByte(&mask, 0x1FFF8 + i, 0x01, NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+  }
+  status = bufWriteToIntelHexFileRebased(&data, &mask, 0x08000000, FILENAME, 16, false, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  text = readText(FILENAME);
+  ASSERT_EQ(0U, text.find(":020000040800F2\n:10010000"));
+  ASSERT_NE(std::string::npos, text.find(":08FFF800"));
+  ASSERT_NE(std::string::npos, text.find(":020000040802F0\n:10000000"));
+
+  status = bufReadFromIntelHexFileRebased(&readbackData, &readbackMask, FILENAME, &baseAddress, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(0x08000000U, baseAddress);
+  ASSERT_EQ(data.length, readbackData.length);
+  ASSERT_EQ(std::memcmp(data.data, readbackData.data, data.length), 0);
+  ASSERT_EQ(mask.length, readbackMask.length);
+  ASSERT_EQ(std::memcmp(mask.data, readbackMask.data, mask.length), 0);
+
+  // Data above 1MiB is addressed with EXT_LIN records rather than failing
+  status = bufWriteToIntelHexFile(&readbackData, &readbackMask, FILENAME, 16, false, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufWriteToIntelHexFileRebased(&data, &mask, 0x00100000, FILENAME, 16, false, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  text = readText(FILENAME);
+  ASSERT_EQ(0U, text.find(":020000040010EA\n"));
+  status = bufReadFromIntelHexFile(&readbackData, &readbackMask, FILENAME, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(0x00100000 + data.length, readbackData.length);
+  ASSERT_EQ(std::memcmp(data.data, readbackData.data + 0x00100000, data.length), 0);
+
+  // A file with no data has base address zero
+  status = readHexText(":00000001FF\n", &readbackData, &readbackMask);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufReadFromIntelHexFileRebased(&readbackData, &readbackMask, FILENAME, &baseAddress, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(0U, baseAddress);
+  ASSERT_EQ(0UL, readbackData.length);
+
+  // Nothing can be written beyond 4GiB
+  status = bufWriteToIntelHexFileRebased(&data, &mask, 0xFFFF0000, FILENAME, 16, false, NULL);
+  ASSERT_EQ(HEX_BAD_EXT_LIN, status);
+
+  bufDestroy(&readbackMask);
+  bufDestroy(&readbackData);
+  bufDestroy(&mask);
+  bufDestroy(&data);
+}
+
 void testDeriveWriteMap(const char *inputData, const char *expectedWriteMap) {
   Buffer data, mask;
   BufferStatus status;
@@ -302,3 +505,800 @@ TEST(HexIO, testDeriveWriteMap) {
   testDeriveWriteMap("Hello........World", "*****........*****");
   testDeriveWriteMap("Hello.......World", "*****************");
 }
+
+// The innermost part of an error message, without the prefixes of the functions it passed through.
+static const char *innermost(const char *error) {
+  const char *p, *result = error;
+  while ((p = std::strstr(result, "(): "))) {
+    result = p + 4;
+  }
+  return result;
+}
+
+static void compareParallel(const char *fileName, uint32 numThreads) {
+  Buffer data, mask, parData, parMask;
+  BufferStatus status, parStatus;
+  const char *error = NULL, *parError = NULL;
+  status = bufInitialise(&data, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&mask, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&parData, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&parMask, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufReadFromIntelHexFile(&data, &mask, fileName, &error);
+  parStatus = bufReadFromIntelHexFileParallel(&parData, &parMask, fileName, numThreads, &parError);
+  ASSERT_EQ(status, parStatus);
+  if (status) {
+    ASSERT_STREQ(innermost(error), innermost(parError));
+    bufFreeError(parError);
+    bufFreeError(error);
+  }
+
+  // Even after an error, the buffers must hold just what the serial reader left in them
+  ASSERT_EQ(data.length, parData.length);
+  ASSERT_EQ(std::memcmp(data.data, parData.data, data.length), 0);
+  ASSERT_EQ(mask.length, parMask.length);
+  ASSERT_EQ(std::memcmp(mask.data, parMask.data, mask.length), 0);
+  bufDestroy(&parMask);
+  bufDestroy(&parData);
+  bufDestroy(&mask);
+  bufDestroy(&data);
+}
+
+TEST(HexIO, testReadParallel) {
+  const char *const FILENAME = "tmpFile.hex";
+  Buffer data, mask;
+  BufferStatus status;
+  status = bufInitialise(&data, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&mask, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+
+  // Half a megabyte of data in several separate runs, spread across segments
+  uint32 seed = 1;
+  for (size_t i = 0; i < 0x80000; i++) {
+    seed = seed * 1103515245U + 12345U;
+    status = bufWriteByte(&data, 0x10 + i + (i / 0x18000) * 0x1234, (uint8)(seed >> 16), NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+    status = bufWriteByte(&mask, 0x10 + i + (i / 0x18000) * 0x1234, 0x01, NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+  }
+  status = bufWriteToIntelHexFile(&data, &mask, FILENAME, 16, false, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  for (uint32 numThreads = 0; numThreads <= 16; numThreads += 3) {
+    compareParallel(FILENAME, numThreads);
+  }
+
+  // The same error as the serial reader must be reported, whichever chunk it occurs in
+  std::ifstream in(FILENAME, std::ios::in|std::ios::binary);
+  std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  in.close();
+  const size_t offsets[] = {text.size() / 3, text.size() / 2, text.size() - 20};
+  for (size_t offset : offsets) {
+    for (char junk : {'.', 'a', ':'}) {
+      std::string bad = text;
+      bad[bad.find('\n', offset) + 5] = junk;
+      std::ofstream out(FILENAME, std::ios::out|std::ios::binary);
+      out << bad;
+      out.close();
+      compareParallel(FILENAME, 8);
+    }
+  }
+
+  // Data after the EOF record is ignored; a missing EOF record is an error
+  std::ofstream out(FILENAME, std::ios::out|std::ios::binary);
+  out << text.substr(0, text.size() / 2) << ":00000001FF\n" << text.substr(text.size() / 2);
+  out.close();
+  compareParallel(FILENAME, 8);
+  out.open(FILENAME, std::ios::out|std::ios::binary);
+  out << text.substr(0, text.size() - 12);
+  out.close();
+  compareParallel(FILENAME, 8);
+
+  // Empty data records in every chunk, which write nothing
+  std::string empties;
+  for (size_t line = 0, p = 0; p < text.size() - 12; line++) {
+    const size_t eol = text.find('\n', p) + 1;
+    empties += text.substr(p, eol - p);
+    if (line % 1000 == 999) {
+      empties += ":00FFFF0002\n";
+    }
+    p = eol;
+  }
+  out.open(FILENAME, std::ios::out|std::ios::binary);
+  out << empties << ":00000001FF\n";
+  out.close();
+  compareParallel(FILENAME, 8);
+
+  // The same addresses written twice with different data, in different chunks: the later
+  // records must win, as they do when read serially
+  for (size_t i = 0; i < data.length; i++) {
+    data.data[i] = (uint8)~data.data[i];
+  }
+  status = bufWriteToIntelHexFile(&data, &mask, FILENAME, 16, false, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  in.open(FILENAME, std::ios::in|std::ios::binary);
+  const std::string inverted(
+    (std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  in.close();
+  out.open(FILENAME, std::ios::out|std::ios::binary);
+  out << text.substr(0, text.size() - 12) << inverted;
+  out.close();
+  compareParallel(FILENAME, 8);
+
+  // An empty data record beyond the rest of the data extends the mask as well as the data
+  out.open(FILENAME, std::ios::out|std::ios::binary);
+  out << ":0400000001020304F2\n:00FFFF0002\n:00000001FF\n";
+  out.close();
+  status = bufReadFromIntelHexFile(&data, &mask, FILENAME, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(0xFFFFU, data.length);
+  ASSERT_EQ(0xFFFFU, mask.length);
+  compareParallel(FILENAME, 8);
+
+  bufDestroy(&mask);
+  bufDestroy(&data);
+}
+
+// Feed the text to a parser in pieces of the given size, and compare the outcome with reading it
+// from a file.
+static void compareStreamed(const std::string &text, size_t pieceSize) {
+  Buffer data, mask, strData, strMask;
+  BufferStatus status, strStatus;
+  const char *error = NULL, *strError = NULL;
+  HexParser parser;
+  status = bufInitialise(&data, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&mask, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&strData, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&strMask, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  {
+    std::ofstream out("tmpFile.hex", std::ios::out|std::ios::binary);
+    out << text;
+  }
+  status = bufReadFromIntelHexFile(&data, &mask, "tmpFile.hex", &error);
+
+  bufHexParserInit(&parser, &strData, &strMask, NULL, NULL);
+  strStatus = BUF_SUCCESS;
+  for (size_t i = 0; i < text.size() && !strStatus; i += pieceSize) {
+    const size_t n = (text.size() - i < pieceSize) ? text.size() - i : pieceSize;
+    strStatus = bufHexParserFeed(&parser, (const uint8 *)text.data() + i, n, &strError);
+  }
+  if (!strStatus) {
+    strStatus = bufHexParserFinish(&parser, &strError);
+  }
+  ASSERT_EQ(status, strStatus);
+  if (status) {
+    ASSERT_STREQ(innermost(error), innermost(strError));
+    bufFreeError(strError);
+    bufFreeError(error);
+
+    // Once failed, always failed
+    strStatus = bufHexParserFeed(&parser, (const uint8 *)":00000001FF\n", 12, NULL);
+    ASSERT_EQ(status, strStatus);
+    strStatus = bufHexParserFinish(&parser, NULL);
+    ASSERT_EQ(status, strStatus);
+  } else {
+    ASSERT_EQ(data.length, strData.length);
+    ASSERT_EQ(std::memcmp(data.data, strData.data, data.length), 0);
+    ASSERT_EQ(mask.length, strMask.length);
+    ASSERT_EQ(std::memcmp(mask.data, strMask.data, mask.length), 0);
+  }
+  bufDestroy(&strMask);
+  bufDestroy(&strData);
+  bufDestroy(&mask);
+  bufDestroy(&data);
+}
+
+static BufferStatus collectRecord(
+  void *context, uint32 address, const uint8 *data, uint8 count, const char **)
+{
+  Buffer *const image = (Buffer *)context;
+  if (address == 0xDEAD) {
+    return BUF_FERROR;
+  }
+  return bufWriteBlock(image, address, data, count, NULL);
+}
+
+TEST(HexIO, testStreamed) {
+  Buffer data, mask, image;
+  BufferStatus status;
+  HexParser parser;
+  std::string text;
+  status = bufInitialise(&data, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&mask, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&image, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+
+  // A few runs of data, spread over several segments
+  uint32 seed = 3;
+  for (size_t i = 0; i < 0x8000; i++) {
+    seed = seed * 1103515245U + 12345U;
+    status = bufWriteByte(&data, 0xFF00 + i + (i / 0x2000) * 0x10123, (uint8)(seed >> 16), NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+    status = bufWriteByte(&mask, 0xFF00 + i + (i / 0x2000) * 0x10123, 0x01, NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+  }
+  status = bufWriteToIntelHexFile(&data, &mask, "tmpFile.hex", 32, false, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  text = readText("tmpFile.hex");
+  for (size_t pieceSize : {1, 2, 7, 43, 4096, 1 << 20}) {
+    compareStreamed(text, pieceSize);
+  }
+
+  // Errors are reported just as the file reader reports them
+  compareStreamed("", 1);
+  compareStreamed(":040BE10075820022F7\n", 5);
+  compareStreamed(":040BE10075820022F7\r\n:00000001FF", 5);
+  compareStreamed(":040BE10075820022F7\n\n:00000001FF\n", 5);
+  compareStreamed(":00000001FF\njunk after the EOF record", 5);
+  compareStreamed(text.substr(0, text.size() / 2) + "x" + text.substr(text.size() / 2), 43);
+  std::string longLine = ":040BE10075820022F7";
+  longLine.append(600, ' ');
+  longLine += "\n:00000001FF\n";
+  compareStreamed(longLine, 1);
+  compareStreamed(longLine, 100);
+
+  // Data records can be handed to a callback instead
+  bufHexParserInit(&parser, NULL, NULL, collectRecord, &image);
+  for (size_t i = 0; i < text.size(); i += 1000) {
+    status = bufHexParserFeed(&parser, (const uint8 *)text.data() + i, std::min<size_t>(1000, text.size() - i), NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+  }
+  status = bufHexParserFinish(&parser, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(data.length, image.length);
+  ASSERT_EQ(std::memcmp(data.data, image.data, data.length), 0);
+
+  // ...which can stop the parse
+  bufHexParserInit(&parser, NULL, NULL, collectRecord, &image);
+  text = ":01DEAD004232\n:00000001FF\n";
+  status = bufHexParserFeed(&parser, (const uint8 *)text.data(), text.size(), NULL);
+  ASSERT_EQ(BUF_FERROR, status);
+
+  bufDestroy(&image);
+  bufDestroy(&mask);
+  bufDestroy(&data);
+}
+
+TEST(HexIO, testInMemory) {
+  Buffer data, mask, text, readbackData, readbackMask;
+  BufferStatus status;
+  std::string fileText;
+  status = bufInitialise(&data, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&mask, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&text, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&readbackData, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&readbackMask, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  for (size_t i = 0; i < 0x3000; i++) {
+    status = bufWriteConst(&data, 0xE000 + i * 3, (uint8)i, 2, NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+    status = bufWriteConst(&mask, 0xE000 + i * 3, 0x01, 2, NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+  }
+
+  // The text is the same as would be written to a file
+  status = bufWriteToIntelHexFile(&data, &mask, "tmpFile.hex", 16, false, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  fileText = readText("tmpFile.hex");
+  status = bufAppendConst(&text, 'X', 100, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufWriteToIntelHexBuffer(&data, &mask, &text, 16, false, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(fileText.size(), text.length);
+  ASSERT_EQ(std::memcmp(fileText.data(), text.data, text.length), 0);
+
+  // ...and reads back the same
+  status = bufReadFromIntelHexBuffer(&readbackData, &readbackMask, &text, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+
+  // The buffers were sized once, to fit exactly
+  ASSERT_EQ(readbackData.length, readbackData.capacity);
+  ASSERT_EQ(readbackMask.length, readbackMask.capacity);
+  ASSERT_EQ(data.length, readbackData.length);
+  ASSERT_EQ(std::memcmp(data.data, readbackData.data, data.length), 0);
+  ASSERT_EQ(mask.length, readbackMask.length);
+  ASSERT_EQ(std::memcmp(mask.data, readbackMask.data, mask.length), 0);
+
+  // Errors
+  text.length -= 3;
+  status = bufReadFromIntelHexBuffer(&readbackData, &readbackMask, &text, NULL);
+  ASSERT_EQ(HEX_JUNK_CHECKSUM, status);
+  text.length = 0;
+  status = bufReadFromIntelHexBuffer(&readbackData, &readbackMask, &text, NULL);
+  ASSERT_EQ(HEX_EMPTY_FILE, status);
+
+  bufDestroy(&readbackMask);
+  bufDestroy(&readbackData);
+  bufDestroy(&text);
+  bufDestroy(&mask);
+  bufDestroy(&data);
+}
+
+TEST(HexIO, testValidate) {
+  Buffer intervals;
+  BufferStatus status;
+  uint64 payloadSize = 0;
+  const HexInterval *iv;
+  status = bufInitialise(&intervals, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+
+  // Records out of order, touching and in different segments
+  {
+    std::ofstream out("tmpFile.hex", std::ios::out|std::ios::binary);
+    out <<
+      ":10120000E200A5DD80E060E042E18EDD71DF8091EB\n"
+      ":1011F000E2008E7F8093E2008091E2008061809324\n"
+      ":020000021000EC\n"
+      ":10000000BEBAFECA6E3B8209D926430DADDEADDE17\n"
+      ":020000020000FC\n"
+      ":101250000801882361F01091E9001092E900809163\n"
+      ":10126000E80083FF01C03DDC17701093E9001F9177\n"
+      ":00000001FF\n";
+  }
+  status = bufValidateIntelHex("tmpFile.hex", &intervals, &payloadSize, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(80UL, payloadSize);
+  ASSERT_EQ(3 * sizeof(HexInterval), intervals.length);
+  iv = (const HexInterval *)intervals.data;
+  ASSERT_EQ(0x11F0U, iv[0].address);
+  ASSERT_EQ(0x20U, iv[0].length);
+  ASSERT_EQ(0x1250U, iv[1].address);
+  ASSERT_EQ(0x20U, iv[1].length);
+  ASSERT_EQ(0x10000U, iv[2].address);
+  ASSERT_EQ(0x10U, iv[2].length);
+
+  // A run ending exactly at 4GiB is not joined to a record at address zero
+  {
+    std::ofstream out("tmpFile.hex", std::ios::out|std::ios::binary);
+    out <<
+      ":02000004FFFFFC\n"
+      ":10FFF000000102030405060708090A0B0C0D0E0F89\n"
+      ":020000040000FA\n"
+      ":0400000001020304F2\n"
+      ":00000001FF\n";
+  }
+  status = bufValidateIntelHex("tmpFile.hex", &intervals, &payloadSize, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(20UL, payloadSize);
+  ASSERT_EQ(2 * sizeof(HexInterval), intervals.length);
+  iv = (const HexInterval *)intervals.data;
+  ASSERT_EQ(0x0U, iv[0].address);
+  ASSERT_EQ(0x4U, iv[0].length);
+  ASSERT_EQ(0xFFFFFFF0U, iv[1].address);
+  ASSERT_EQ(0x10U, iv[1].length);
+
+  // Errors are the same as the reader's
+  std::ofstream("tmpFile.hex", std::ios::out|std::ios::binary) << ":040BE10075820022F7\n";
+  status = bufValidateIntelHex("tmpFile.hex", &intervals, NULL, NULL);
+  ASSERT_EQ(HEX_MISSING_EOF, status);
+  std::ofstream("tmpFile.hex", std::ios::out|std::ios::binary) << ":040BE10075820022F8\n:00000001FF\n";
+  status = bufValidateIntelHex("tmpFile.hex", NULL, NULL, NULL);
+  ASSERT_EQ(HEX_BAD_CHECKSUM, status);
+  status = bufValidateIntelHex("nonExistentFile.hex", NULL, NULL, NULL);
+  ASSERT_EQ(BUF_FOPEN, status);
+
+  bufDestroy(&intervals);
+}
+
+TEST(HexIO, testIndex) {
+  const char *const FILENAME = "tmpFile.hex";
+  Buffer data, mask, index, loaded, part, partMask;
+  BufferStatus status;
+  status = bufInitialise(&data, 1024, 0xFF, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&mask, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&index, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&loaded, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&part, 1024, 0xFF, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&partMask, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+
+  // Several runs with holes between them, spread over several segments
+  uint32 seed = 5;
+  for (size_t i = 0; i < 0x40000; i++) {
+    seed = seed * 1103515245U + 12345U;
+    const size_t addr = i + (i / 0x7000) * 0x2345;
+    status = bufWriteByte(&data, addr, (uint8)(seed >> 16), NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+    status = bufWriteByte(&mask, addr, 0x01, NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+  }
+  status = bufWriteToIntelHexFile(&data, &mask, FILENAME, 16, false, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufHexIndexBuild(FILENAME, &index, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_LT(index.length, 0x40000UL / 100);
+
+  // The index survives a trip through a sidecar file
+  status = bufWriteBinaryFile(&index, "tmpFile.idx", 0, index.length, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufAppendFromBinaryFile(&loaded, "tmpFile.idx", NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(index.length, loaded.length);
+
+  // Ranges inside runs, straddling holes and segments, and beyond the end of the data
+  const size_t ranges[][2] = {
+    {0, 16}, {0x1234, 1}, {0x6FF0, 0x3000}, {0xFFF8, 0x10}, {0x12345, 0x9000},
+    {data.length - 20, 100}, {data.length + 1000, 10}
+  };
+  for (const auto &range : ranges) {
+    status = bufHexIndexRead(&loaded, FILENAME, (uint32)range[0], range[1], &part, &partMask, NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+    ASSERT_EQ(range[1], part.length);
+    ASSERT_EQ(range[1], partMask.length);
+    for (size_t i = 0; i < range[1]; i++) {
+      const size_t addr = range[0] + i;
+      const uint8 expected = (addr < data.length) ? data.data[addr] : 0xFF;
+      const uint8 expectedMask = (addr < mask.length) ? mask.data[addr] : 0x00;
+      ASSERT_EQ(expected, part.data[i]);
+      ASSERT_EQ(expectedMask, partMask.data[i]);
+    }
+  }
+
+  // An index is only good for the file it was built from
+  status = bufWriteToIntelHexFile(&data, &mask, FILENAME, 32, false, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufHexIndexRead(&loaded, FILENAME, 0, 16, &part, NULL, NULL);
+  ASSERT_EQ(HEX_BAD_INDEX, status);
+  loaded.length--;
+  status = bufHexIndexRead(&loaded, FILENAME, 0, 16, &part, NULL, NULL);
+  ASSERT_EQ(HEX_BAD_INDEX, status);
+
+  bufDestroy(&partMask);
+  bufDestroy(&part);
+  bufDestroy(&loaded);
+  bufDestroy(&index);
+  bufDestroy(&mask);
+  bufDestroy(&data);
+}
+
+TEST(HexIO, testLazyImage) {
+  const char *const FILENAME = "tmpFile.hex";
+  Buffer data, mask;
+  HexImage *image;
+  BufferStatus status;
+  status = bufInitialise(&data, 1024, 0xFF, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&mask, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+
+  // Data starting well above zero, with holes, over several segments
+  uint32 seed = 9;
+  for (size_t i = 0; i < 0x30000; i++) {
+    seed = seed * 1103515245U + 12345U;
+    const size_t addr = 0x5432 + i + (i / 0x5000) * 0x1777;
+    status = bufWriteByte(&data, addr, (uint8)(seed >> 16), NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+    status = bufWriteByte(&mask, addr, 0x01, NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+  }
+  status = bufWriteToIntelHexFile(&data, &mask, FILENAME, 16, false, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufHexImageOpen(&image, FILENAME, 0xFF, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  uint32 baseAddress;
+  uint64 length;
+  bufHexImageRange(image, &baseAddress, &length);
+  ASSERT_EQ(0x5000U, baseAddress);
+  ASSERT_GE(baseAddress + length, (uint64)data.length);
+  ASSERT_LT(baseAddress + length, (uint64)data.length + 4096);
+
+  // Ranges before the data, straddling pages and holes, and beyond the end; each range is read
+  // twice, so the second read comes from pages already decoded
+  const size_t ranges[][2] = {
+    {0, 0x6000}, {0x5432, 1}, {0x7FF0, 0x3000}, {0xFFF8, 0x10}, {0x12345, 0x9000},
+    {data.length - 20, 100}, {data.length + 1000, 10}
+  };
+  std::vector<uint8> part, partMask;
+  for (int pass = 0; pass < 2; pass++) {
+    for (const auto &range : ranges) {
+      part.assign(range[1], 0x00);
+      partMask.assign(range[1], 0xAA);
+      status = bufHexImageRead(
+        image, (uint32)range[0], range[1], part.data(), partMask.data(), NULL);
+      ASSERT_EQ(BUF_SUCCESS, status);
+      for (size_t i = 0; i < range[1]; i++) {
+        const size_t addr = range[0] + i;
+        const uint8 expected = (addr < data.length) ? data.data[addr] : 0xFF;
+        const uint8 expectedMask = (addr < mask.length) ? mask.data[addr] : 0x00;
+        ASSERT_EQ(expected, part[i]);
+        ASSERT_EQ(expectedMask, partMask[i]);
+      }
+    }
+  }
+  bufHexImageClose(image);
+
+  // A bad checksum is only found when its page is read, and is found again on a second read
+  {
+    std::ofstream file(FILENAME, std::ios::binary);
+    file << ":0400000001020304F2\n:041000000102030400\n:00000001FF\n";
+  }
+  status = bufHexImageOpen(&image, FILENAME, 0xFF, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  uint8 bytes[4];
+  status = bufHexImageRead(image, 0, 4, bytes, NULL, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(0x01, bytes[0]);
+  status = bufHexImageRead(image, 0x1000, 4, bytes, NULL, NULL);
+  ASSERT_EQ(HEX_BAD_CHECKSUM, status);
+  status = bufHexImageRead(image, 0x1000, 4, bytes, NULL, NULL);
+  ASSERT_EQ(HEX_BAD_CHECKSUM, status);
+  bufHexImageClose(image);
+
+  // Runs which overlap across a page boundary are applied in file order, whichever page is
+  // decoded first
+  {
+    std::ofstream file(FILENAME, std::ios::binary);
+    file << ":040FFE0001020304E5\n:02100000AABB89\n:020FFE00CCDD48\n:00000001FF\n";
+  }
+  status = bufHexImageOpen(&image, FILENAME, 0xFF, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufHexImageRead(image, 0x1000, 2, bytes, NULL, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(0xAA, bytes[0]);
+  ASSERT_EQ(0xBB, bytes[1]);
+  status = bufHexImageRead(image, 0x0FFE, 4, bytes, NULL, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(0xCC, bytes[0]);
+  ASSERT_EQ(0xDD, bytes[1]);
+  ASSERT_EQ(0xAA, bytes[2]);
+  ASSERT_EQ(0xBB, bytes[3]);
+  bufHexImageClose(image);
+
+  // A missing EOF record is found up front
+  {
+    std::ofstream file(FILENAME, std::ios::binary);
+    file << ":0400000001020304F2\n";
+  }
+  status = bufHexImageOpen(&image, FILENAME, 0xFF, NULL);
+  ASSERT_EQ(HEX_MISSING_EOF, status);
+  ASSERT_EQ(NULL, image);
+
+  bufDestroy(&mask);
+  bufDestroy(&data);
+}
+
+TEST(HexIO, testWriteBlocks) {
+  const char *const FILENAME = "tmpFile.hex";
+  Buffer data, text;
+  BufferStatus status;
+  status = bufInitialise(&data, 1024, 0xFF, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&text, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+
+  // Enough text to fill the writer's block several times over, with lines of every length
+  uint32 seed = 3;
+  for (size_t i = 0; i < 0x28000; i++) {
+    seed = seed * 1103515245U + 12345U;
+    status = bufAppendByte(&data, (uint8)(seed >> 16), NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+  }
+  for (uint32 lineLength = 1; lineLength <= 255; lineLength += 127) {
+    status = bufWriteToIntelHexFile(&data, NULL, FILENAME, (uint8)lineLength, false, NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+    status = bufWriteToIntelHexBuffer(&data, NULL, &text, (uint8)lineLength, false, NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+    const std::string fromFile = readText(FILENAME);
+    ASSERT_EQ(fromFile, std::string((const char *)text.data, text.length));
+    ASSERT_EQ(":00000001FF\n", fromFile.substr(fromFile.size() - 12));
+  }
+
+  #ifndef WIN32
+    // Write errors are reported, not ignored
+    const char *error = NULL;
+    status = bufWriteToIntelHexFile(&data, NULL, "/dev/full", 16, false, &error);
+    ASSERT_EQ(BUF_FERROR, status);
+    ASSERT_TRUE(error != NULL);
+    bufFreeError(error);
+  #endif
+
+  bufDestroy(&text);
+  bufDestroy(&data);
+}
+
+TEST(HexIO, testWriteParallel) {
+  const char *const FILENAME = "tmpFile.hex";
+  Buffer data, mask;
+  BufferStatus status;
+  status = bufInitialise(&data, 1024, 0xFF, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&mask, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+
+  // Nothing at all, then data with holes reaching past 1MiB, so both kinds of extended address
+  // record are needed
+  std::string serial;
+  for (int pass = 0; pass < 2; pass++) {
+    if (pass) {
+      uint32 seed = 11;
+      for (size_t i = 0; i < 0x118000; i++) {
+        seed = seed * 1103515245U + 12345U;
+        const bool hole = ((i >> 12) % 5) == 3;
+        status = bufAppendByte(&data, hole ? 0xFF : (uint8)(seed >> 16), NULL);
+        ASSERT_EQ(BUF_SUCCESS, status);
+        status = bufAppendByte(&mask, hole ? 0x00 : 0x01, NULL);
+        ASSERT_EQ(BUF_SUCCESS, status);
+      }
+    }
+    for (const Buffer *m : {(const Buffer *)&mask, (const Buffer *)NULL}) {
+      status = bufWriteToIntelHexFile(&data, m, FILENAME, 32, true, NULL);
+      ASSERT_EQ(BUF_SUCCESS, status);
+      serial = readText(FILENAME);
+      for (uint32 numThreads : {0U, 1U, 2U, 3U, 7U, 64U}) {
+        status = bufWriteToIntelHexFileParallel(&data, m, FILENAME, 32, true, numThreads, NULL);
+        ASSERT_EQ(BUF_SUCCESS, status);
+        ASSERT_EQ(serial, readText(FILENAME));
+      }
+    }
+  }
+
+  bufDestroy(&mask);
+  bufDestroy(&data);
+}
+
+TEST(HexIO, testWriteSparse) {
+  Buffer data, mask, text, readData, readMask;
+  BufferStatus status;
+  status = bufInitialise(&data, 1024, 0xFF, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&mask, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&text, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&readData, 1024, 0xFF, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&readMask, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+
+  // Runs of every length from 1 to 40 at every alignment, separated by holes of varying length,
+  // with a long hole in the middle
+  size_t addr = 3;
+  for (size_t runLength = 1; runLength <= 40; runLength++) {
+    for (size_t i = 0; i < runLength; i++) {
+      status = bufWriteByte(&data, addr + i, (uint8)(addr + i), NULL);
+      ASSERT_EQ(BUF_SUCCESS, status);
+      status = bufWriteByte(&mask, addr + i, 0x01, NULL);
+      ASSERT_EQ(BUF_SUCCESS, status);
+    }
+    addr += runLength + runLength % 9 + 1;
+    if (runLength == 20) {
+      addr += 0x23456;
+    }
+  }
+  status = bufWriteToIntelHexBuffer(&data, &mask, &text, 16, false, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufReadFromIntelHexBuffer(&readData, &readMask, &text, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(data.length, readData.length);
+  ASSERT_EQ(0, std::memcmp(data.data, readData.data, data.length));
+  ASSERT_EQ(0, std::memcmp(mask.data, readMask.data, mask.length));
+
+  bufDestroy(&readMask);
+  bufDestroy(&readData);
+  bufDestroy(&text);
+  bufDestroy(&mask);
+  bufDestroy(&data);
+}
+
+TEST(HexIO, testWriteSkipEmpty) {
+  const char *const FILENAME = "tmpFile.hex";
+  Buffer data, mask, readData, readMask;
+  BufferStatus status;
+  status = bufInitialise(&data, 1024, 0xFF, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&mask, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&readData, 1024, 0xFF, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&readMask, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+
+  // Data in windows 0, 5 and 0x20 (above 1MiB), with a long tail of nothing after it
+  status = bufWriteBlock(&data, 0x00010, (const uint8 *)"\x01\x02\x03", 3, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufWriteBlock(&data, 0x5FFFE, (const uint8 *)"\x04\x05", 2, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufWriteBlock(&data, 0x200000, (const uint8 *)"\x06", 1, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufWriteConst(&data, data.length, 0xFF, 0x100000, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufWriteConst(&mask, 0x00010, 0x01, 3, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufWriteConst(&mask, 0x5FFFE, 0x01, 2, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufWriteConst(&mask, 0x200000, 0x01, 1, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufWriteConst(&mask, mask.length, 0x00, data.length - mask.length, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+
+  // Only the windows holding data get an extended address record
+  status = bufWriteToIntelHexFileSparse(&data, &mask, FILENAME, 16, false, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(
+    ":03001000010203E7\n"
+    ":020000025000AC\n"
+    ":02FFFE000405F8\n"
+    ":020000040020DA\n"
+    ":0100000006F9\n"
+    ":00000001FF\n",
+    readText(FILENAME));
+  status = bufReadFromIntelHexFile(&readData, &readMask, FILENAME, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(0x200001U, readData.length);
+  ASSERT_EQ(0, std::memcmp(data.data, readData.data, readData.length));
+  ASSERT_EQ(0, std::memcmp(mask.data, readMask.data, readMask.length));
+
+  // The default writer introduces every window, empty or not, but reads back the same
+  status = bufWriteToIntelHexFile(&data, &mask, FILENAME, 16, false, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_GT(readText(FILENAME).size(), 0x2FU * 15);
+  status = bufReadFromIntelHexFile(&readData, &readMask, FILENAME, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(0x200001U, readData.length);
+  ASSERT_EQ(0, std::memcmp(data.data, readData.data, readData.length));
+
+  bufDestroy(&readMask);
+  bufDestroy(&readData);
+  bufDestroy(&mask);
+  bufDestroy(&data);
+}
+
+static BufferStatus countingWrite(
+  void *context, const uint8 *data, size_t length, const char **)
+{
+  std::string *const text = (std::string *)context;
+  text->append((const char *)data, length);
+  return (text->size() > 200000) ? BUF_FERROR : BUF_SUCCESS;
+}
+
+TEST(HexIO, testWriteSink) {
+  Buffer data, text;
+  BufferStatus status;
+  status = bufInitialise(&data, 1024, 0xFF, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&text, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  for (size_t i = 0; i < 0x8000; i++) {
+    status = bufAppendByte(&data, (uint8)(i * 7), NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+  }
+  status = bufWriteToIntelHexBuffer(&data, NULL, &text, 16, false, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+
+  // A sink of the caller's own gets the same text as a buffer
+  std::string collected;
+  BufferSink sink = {countingWrite, NULL, &collected};
+  status = bufWriteToIntelHexSink(&data, NULL, &sink, 16, false, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(std::string((const char *)text.data, text.length), collected);
+
+  // A sink which fails stops the writer with its code
+  for (size_t i = 0; i < 0x10000; i++) {
+    status = bufAppendByte(&data, (uint8)i, NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+  }
+  collected.clear();
+  status = bufWriteToIntelHexSink(&data, NULL, &sink, 16, false, NULL);
+  ASSERT_EQ(BUF_FERROR, status);
+
+  bufDestroy(&text);
+  bufDestroy(&data);
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2009-2012 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <gtest/gtest.h>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <makestuff/libbuffer.h>
+
+static const char *const FILENAME = "tmpFile.srec";
+
+static void writeText(const char *text) {
+  std::ofstream file(FILENAME, std::ios::binary);
+  file << text;
+}
+
+static std::string readText() {
+  std::ifstream file(FILENAME, std::ios::binary);
+  return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+static const char *const HELLO_DATA =
+  "S11F00007C0802A6900100049421FFF07C6C1B787C8C23783C6000003863000026\n"
+  "S11F001C4BFFFFE5398000007D83637880010014382100107C0803A64E800020E9\n"
+  "S111003848656C6C6F20776F726C642E0A0042\n"
+  "S5030003F9\n"
+  "S9030000FC\n";
+
+TEST(SRec, testRead) {
+  Buffer data, mask;
+  BufferStatus status;
+  status = bufInitialise(&data, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&mask, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  writeText((std::string("S00F000068656C6C6F202020202000003C\r\n") + HELLO_DATA).c_str());
+  status = bufReadFromSRecordFile(&data, &mask, FILENAME, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(0x46UL, data.length);
+  ASSERT_EQ(0x46UL, mask.length);
+  ASSERT_EQ(0x7C, data.data[0x00]);
+  ASSERT_EQ(0x4B, data.data[0x1C]);
+  ASSERT_EQ(0, std::memcmp(data.data + 0x38, "Hello world.\n", 13));
+  for (size_t i = 0; i < mask.length; i++) {
+    ASSERT_EQ(0x01, mask.data[i]);
+  }
+
+  // Writing it back gives the same records, with an empty header
+  status = bufWriteToSRecordFile(&data, &mask, FILENAME, 28, false, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  ASSERT_EQ(std::string("S0030000FC\n") + HELLO_DATA, readText());
+
+  bufDestroy(&mask);
+  bufDestroy(&data);
+}
+
+TEST(SRec, testRoundTrip) {
+  Buffer data, mask, readData, readMask;
+  BufferStatus status;
+  status = bufInitialise(&data, 1024, 0xFF, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&mask, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&readData, 1024, 0xFF, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+  status = bufInitialise(&readMask, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+
+  // Each highest address needs a bigger record type: S1, then S2, then S3
+  const struct {
+    size_t address;
+    char dataType;
+    char endType;
+  } cases[] = {{0xFE00, '1', '9'}, {0x123456, '2', '8'}, {0x1000010, '3', '7'}};
+  for (const auto &c : cases) {
+    for (size_t i = 0; i < 300; i++) {
+      const size_t addr = c.address - 150 + i * 3 / 2;
+      status = bufWriteByte(&data, addr, (uint8)(i * 13), NULL);
+      ASSERT_EQ(BUF_SUCCESS, status);
+      status = bufWriteByte(&mask, addr, 0x01, NULL);
+      ASSERT_EQ(BUF_SUCCESS, status);
+    }
+    status = bufWriteToSRecordFile(&data, &mask, FILENAME, 0, false, NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+    const std::string text = readText();
+    ASSERT_EQ('S', text[text.rfind('\n', text.size() - 2) + 1]);
+    ASSERT_EQ(c.endType, text[text.rfind('\n', text.size() - 2) + 2]);
+    ASSERT_EQ(c.dataType, text[text.find('\n') + 2]);
+    status = bufReadFromSRecordFile(&readData, &readMask, FILENAME, NULL);
+    ASSERT_EQ(BUF_SUCCESS, status);
+    ASSERT_EQ(data.length, readData.length);
+    ASSERT_EQ(0, std::memcmp(data.data, readData.data, data.length));
+    ASSERT_EQ(0, std::memcmp(mask.data, readMask.data, mask.length));
+  }
+
+  bufDestroy(&readMask);
+  bufDestroy(&readData);
+  bufDestroy(&mask);
+  bufDestroy(&data);
+}
+
+TEST(SRec, testBadFiles) {
+  Buffer data;
+  BufferStatus status;
+  const char *error = NULL;
+  status = bufInitialise(&data, 1024, 0x00, NULL);
+  ASSERT_EQ(BUF_SUCCESS, status);
+
+  writeText("");
+  status = bufReadFromSRecordFile(&data, NULL, FILENAME, NULL);
+  ASSERT_EQ(HEX_EMPTY_FILE, status);
+
+  writeText("S111003848656C6C6F20776F726C642E0A0043\nS9030000FC\n");
+  status = bufReadFromSRecordFile(&data, NULL, FILENAME, &error);
+  ASSERT_EQ(SREC_BAD_CHECKSUM, status);
+  ASSERT_STREQ("bufReadFromSRecordFile(): decodeSRecord(): Checksum mismatch at line 1", error);
+  bufFreeError(error);
+  error = NULL;
+
+  writeText("S111003848656C6C6F20776F726C642E0A0042\nS4030000FC\n");
+  status = bufReadFromSRecordFile(&data, NULL, FILENAME, NULL);
+  ASSERT_EQ(SREC_BAD_RECORD, status);
+
+  writeText("S111003848656C6C6F20776F726C642E0A00\nS9030000FC\n");
+  status = bufReadFromSRecordFile(&data, NULL, FILENAME, NULL);
+  ASSERT_EQ(SREC_BAD_RECORD, status);
+
+  writeText("S111003848656C6C6F20776F726CG42E0A0042\nS9030000FC\n");
+  status = bufReadFromSRecordFile(&data, NULL, FILENAME, &error);
+  ASSERT_EQ(SREC_BAD_RECORD, status);
+  ASSERT_STREQ(
+    "bufReadFromSRecordFile(): decodeSRecord(): Illegal character at line 1 column 29", error);
+  bufFreeError(error);
+
+  writeText("S111003848656C6C6F20776F726C642E0A0042\n");
+  status = bufReadFromSRecordFile(&data, NULL, FILENAME, NULL);
+  ASSERT_EQ(SREC_MISSING_END, status);
+
+  bufDestroy(&data);
+}